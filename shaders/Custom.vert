@@ -14,6 +14,10 @@ in vec4 in_normal;
 in vec4 in_tangent;
 in vec2 in_uv;
 
+// Per-instance center (xyz) and scale (w) of instanced meshes. Draws without
+// an instance buffer read the default (0, 0, 0, 1), which is the identity.
+in vec4 in_instance;
+
 // In a vertex shader, the "out" variables are per-vertex properties
 // that are read/write. These properties allow us to communicate
 // information from the vertex shader to the fragment shader.
@@ -33,12 +37,14 @@ void main() {
   // Here, we just apply the model's transformation to the various
   // per-vertex properties. That way, when the fragment shader reads
   // them, we already have the position in world-space.
-  v_position = u_model * in_position;
+  vec4 position = vec4(in_position.xyz * in_instance.w + in_instance.xyz, in_position.w);
+
+  v_position = u_model * position;
   v_normal = normalize(u_model * in_normal);
   v_uv = in_uv;
   v_tangent = normalize(u_model * in_tangent);
   
   // The final screen-space location of this vertex which the
   // GPU's triangle rasterizer takes in.
-  gl_Position = u_view_projection * u_model * in_position;
+  gl_Position = u_view_projection * u_model * position;
 }
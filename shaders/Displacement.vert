@@ -14,6 +14,10 @@ in vec4 in_normal;
 in vec4 in_tangent;
 in vec2 in_uv;
 
+// Per-instance center (xyz) and scale (w) of instanced meshes. Draws without
+// an instance buffer read the default (0, 0, 0, 1), which is the identity.
+in vec4 in_instance;
+
 out vec4 v_position;
 out vec4 v_normal;
 out vec2 v_uv;
@@ -28,9 +32,11 @@ void main() {
   // YOUR CODE HERE
   
   // (Placeholder code. You will want to replace it.)
-  v_position = u_model * in_position;
+  vec4 position = vec4(in_position.xyz * in_instance.w + in_instance.xyz, in_position.w);
+
+  v_position = u_model * position;
   v_normal = normalize(u_model * in_normal);
   v_uv = in_uv;
   v_tangent = normalize(u_model * in_tangent);
-  gl_Position = u_view_projection * u_model * in_position;
+  gl_Position = u_view_projection * u_model * position;
 }
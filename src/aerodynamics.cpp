@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cmath>
+
+#include "aerodynamics.h"
+
+using namespace std;
+using namespace CGL;
+
+// Wind grid points per axis around the cloth
+#define WIND_GRID_RESOLUTION 8
+
+static unsigned int hash_lattice(int x, int y, int z, unsigned int w) {
+  unsigned int h = (unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^
+                   (unsigned int)z * 83492791u ^ w * 2654435761u;
+  h ^= h >> 15;
+  h *= 2246822519u;
+  h ^= h >> 13;
+  return h;
+}
+
+static double smooth(double t) { return t * t * (3 - 2 * t); }
+
+double WindField::noise(double x, double y, double z, unsigned int channel) const {
+  int x0 = (int)floor(x), y0 = (int)floor(y), z0 = (int)floor(z);
+  double tx = smooth(x - x0), ty = smooth(y - y0), tz = smooth(z - z0);
+
+  // Trilinear blend of lattice values in [-1, 1]
+  double corners[8];
+  for (int i = 0; i < 8; i++) {
+    unsigned int h = hash_lattice(x0 + (i & 1), y0 + ((i >> 1) & 1), z0 + (i >> 2), channel);
+    corners[i] = h * (2.0 / 4294967295.0) - 1;
+  }
+  double x00 = corners[0] + tx * (corners[1] - corners[0]);
+  double x10 = corners[2] + tx * (corners[3] - corners[2]);
+  double x01 = corners[4] + tx * (corners[5] - corners[4]);
+  double x11 = corners[6] + tx * (corners[7] - corners[6]);
+  double y0v = x00 + ty * (x10 - x00);
+  double y1v = x01 + ty * (x11 - x01);
+  return y0v + tz * (y1v - y0v);
+}
+
+Vector3D WindField::velocity(const Vector3D &p, double t) const {
+  if (turbulence <= 0) return base;
+
+  // Turbulence drifts with the base wind and its eddies turn over in about
+  // scale / turbulence seconds, blended between two noise layers
+  Vector3D q = (p - base * t) / scale;
+  double evolution = t * turbulence / scale;
+  unsigned int layer = (unsigned int)(long long)floor(evolution);
+  double blend = smooth(evolution - floor(evolution));
+
+  Vector3D gust;
+  for (int c = 0; c < 3; c++) {
+    unsigned int channel = seed * 7919u + c * 104729u;
+    double a = noise(q.x, q.y, q.z, channel + layer);
+    double b = noise(q.x, q.y, q.z, channel + layer + 1);
+    gust[c] = a + blend * (b - a);
+  }
+  return base + gust * turbulence;
+}
+
+void Aerodynamics::build_topology(vector<PointMass> &point_masses, ClothMesh *mesh) {
+  this->mesh = mesh;
+  int num_vertices = point_masses.size();
+  int num_triangles = mesh->triangles.size();
+  PointMass *pms = &point_masses[0];
+
+  for (int k = 0; k < 3; k++) {
+    corners[k].resize(num_triangles);
+    rel[k].resize(num_vertices);
+    force[k].resize(num_triangles);
+  }
+
+  vertex_start.assign(num_vertices + 1, 0);
+  for (int i = 0; i < num_triangles; i++) {
+    Triangle *tri = mesh->triangles[i];
+    corners[0][i] = tri->pm1 - pms;
+    corners[1][i] = tri->pm2 - pms;
+    corners[2][i] = tri->pm3 - pms;
+    for (int k = 0; k < 3; k++) {
+      vertex_start[corners[k][i] + 1]++;
+    }
+  }
+  for (int v = 0; v < num_vertices; v++) {
+    vertex_start[v + 1] += vertex_start[v];
+  }
+
+  vertex_triangles.resize(3 * num_triangles);
+  vector<int> fill(vertex_start.begin(), vertex_start.end() - 1);
+  for (int i = 0; i < num_triangles; i++) {
+    for (int k = 0; k < 3; k++) {
+      vertex_triangles[fill[corners[k][i]]++] = i;
+    }
+  }
+}
+
+void Aerodynamics::fill_snapshot(const WindField &wind, double t, vector<float> &snapshot) {
+  int n = WIND_GRID_RESOLUTION;
+  snapshot.resize(3 * n * n * n);
+  for (int z = 0; z < n; z++) {
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x++) {
+        Vector3D v = wind.velocity(grid_min + Vector3D(x, y, z) * cell_size, t);
+        float *out = &snapshot[3 * ((z * n + y) * n + x)];
+        out[0] = v.x;
+        out[1] = v.y;
+        out[2] = v.z;
+      }
+    }
+  }
+}
+
+void Aerodynamics::update_cache(const WindField &wind, const vector<PointMass> &point_masses) {
+  int n = WIND_GRID_RESOLUTION;
+  long long index = (long long)floor(wind.time / wind.cache_interval);
+  if (index == snapshot_index && !out_of_grid) return;
+
+  if (snapshot_index < 0 || out_of_grid) {
+    Vector3D min = point_masses[0].position, max = min;
+    for (const PointMass &pm : point_masses) {
+      const Vector3D &p = pm.position;
+      min = Vector3D(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+      max = Vector3D(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    }
+
+    // Refit a cube around the cloth, with room to move before the next refit
+    Vector3D center = (min + max) / 2;
+    Vector3D extent = max - min;
+    double half = std::max(0.625 * std::max(extent.x, std::max(extent.y, extent.z)), wind.scale / 2);
+    grid_min = center - Vector3D(half, half, half);
+    cell_size = 2 * half / (n - 1);
+
+    fill_snapshot(wind, index * wind.cache_interval, snapshots[0]);
+    fill_snapshot(wind, (index + 1) * wind.cache_interval, snapshots[1]);
+  } else if (index == snapshot_index + 1) {
+    swap(snapshots[0], snapshots[1]);
+    fill_snapshot(wind, (index + 1) * wind.cache_interval, snapshots[1]);
+  } else {
+    fill_snapshot(wind, index * wind.cache_interval, snapshots[0]);
+    fill_snapshot(wind, (index + 1) * wind.cache_interval, snapshots[1]);
+  }
+  snapshot_index = index;
+
+  // Particles move a small fraction of a grid cell in one interval, so they
+  // sample the grid only when the snapshots change
+  out_of_grid = false;
+  for (int k = 0; k < 2; k++) {
+    sample(point_masses, snapshots[k], particle_wind[k]);
+  }
+}
+
+void Aerodynamics::sample(const vector<PointMass> &point_masses, const vector<float> &snapshot,
+                          vector<double> *out) {
+  int n = WIND_GRID_RESOLUTION;
+  int sx = 3, sy = 3 * n, sz = 3 * n * n;
+  double inv_cell = 1.0 / cell_size;
+  double last = n - 1;
+  int num_vertices = point_masses.size();
+
+  for (int c = 0; c < 3; c++) {
+    out[c].resize(num_vertices);
+  }
+
+  for (int v = 0; v < num_vertices; v++) {
+    const Vector3D &p = point_masses[v].position;
+    double gx = (p.x - grid_min.x) * inv_cell;
+    double gy = (p.y - grid_min.y) * inv_cell;
+    double gz = (p.z - grid_min.z) * inv_cell;
+
+    // Particles outside the grid read its clamped edge, and make the next
+    // step refit the grid
+    out_of_grid |= gx < 0 || gy < 0 || gz < 0 || gx > last || gy > last || gz > last;
+    int x0 = std::min(n - 2, std::max(0, (int)gx));
+    int y0 = std::min(n - 2, std::max(0, (int)gy));
+    int z0 = std::min(n - 2, std::max(0, (int)gz));
+    double tx = gx - x0, ty = gy - y0, tz = gz - z0;
+
+    const float *g = &snapshot[x0 * sx + y0 * sy + z0 * sz];
+    for (int c = 0; c < 3; c++) {
+      double c00 = g[c] + tx * (g[sx + c] - g[c]);
+      double c10 = g[sy + c] + tx * (g[sy + sx + c] - g[sy + c]);
+      double c01 = g[sz + c] + tx * (g[sz + sx + c] - g[sz + c]);
+      double c11 = g[sz + sy + c] + tx * (g[sz + sy + sx + c] - g[sz + sy + c]);
+      double c0 = c00 + ty * (c10 - c00);
+      double c1 = c01 + ty * (c11 - c01);
+      out[c][v] = c0 + tz * (c1 - c0);
+    }
+  }
+}
+
+void Aerodynamics::apply(vector<PointMass> &point_masses, ClothMesh *mesh, const WindField &wind,
+                         double delta_t) {
+  if (point_masses.empty() || !mesh) return;
+  if (mesh != this->mesh || vertex_start.size() != point_masses.size() + 1) {
+    build_topology(point_masses, mesh);
+  }
+
+  int num_vertices = point_masses.size();
+  int num_triangles = corners[0].size();
+
+  update_cache(wind, point_masses);
+
+  // Air velocity relative to each particle, with the wind blended between
+  // the snapshots it sampled
+  double blend = wind.time / wind.cache_interval - snapshot_index;
+  double inv_dt = 1.0 / delta_t;
+  for (int c = 0; c < 3; c++) {
+    const double *w0 = particle_wind[0][c].data(), *w1 = particle_wind[1][c].data();
+    double *r = rel[c].data();
+    for (int v = 0; v < num_vertices; v++) {
+      const PointMass &pm = point_masses[v];
+      r[v] = w0[v] + blend * (w1[v] - w0[v]) - (pm.position[c] - pm.last_position[c]) * inv_dt;
+    }
+  }
+
+  // With n the area-weighted normal (|n| = 2A) and u the relative air
+  // velocity, the dynamic pressure force 1/2 rho |u|^2 A cos(theta) splits
+  // into drag along n and lift along the part of n across the flow. Written
+  // in n and u directly, it needs one division and no normalization:
+  //   F = rho / 4 |u| (n.u) / |n| ((cd + cl) n - cl (n.u) u / |u|^2)
+  // A third goes to each corner. The sign of n.u makes both faces agree.
+  const int *c0 = corners[0].data(), *c1 = corners[1].data(), *c2 = corners[2].data();
+  const double *rx = rel[0].data(), *ry = rel[1].data(), *rz = rel[2].data();
+  double *fx = force[0].data(), *fy = force[1].data(), *fz = force[2].data();
+  const PointMass *pms = point_masses.data();
+  double scale = wind.air_density / 12;
+  double cn = wind.drag + wind.lift, cl = wind.lift;
+
+  #pragma omp simd
+  for (int i = 0; i < num_triangles; i++) {
+    const Vector3D &pa = pms[c0[i]].position;
+    const Vector3D &pb = pms[c1[i]].position;
+    const Vector3D &pc = pms[c2[i]].position;
+    double e1x = pb.x - pa.x, e1y = pb.y - pa.y, e1z = pb.z - pa.z;
+    double e2x = pc.x - pa.x, e2y = pc.y - pa.y, e2z = pc.z - pa.z;
+    double nx = e1y * e2z - e1z * e2y;
+    double ny = e1z * e2x - e1x * e2z;
+    double nz = e1x * e2y - e1y * e2x;
+
+    double ux = (rx[c0[i]] + rx[c1[i]] + rx[c2[i]]) * (1.0 / 3);
+    double uy = (ry[c0[i]] + ry[c1[i]] + ry[c2[i]]) * (1.0 / 3);
+    double uz = (rz[c0[i]] + rz[c1[i]] + rz[c2[i]]) * (1.0 / 3);
+
+    double n_length = sqrt(nx * nx + ny * ny + nz * nz);
+    double speed2 = ux * ux + uy * uy + uz * uz;
+    double n_dot_u = nx * ux + ny * uy + nz * uz;
+
+    // 1 / (|n| |u|^2) gives both 1 / |n| and 1 / |u|^2 with one division
+    double inv = 1.0 / std::max(n_length * speed2, 1e-300);
+    double k = scale * sqrt(speed2) * n_dot_u * speed2 * inv;
+    double across = cl * n_dot_u * n_length * inv;
+
+    fx[i] = k * (cn * nx - across * ux);
+    fy[i] = k * (cn * ny - across * uy);
+    fz[i] = k * (cn * nz - across * uz);
+  }
+
+  // Each particle gathers its triangles' shares
+  for (int v = 0; v < num_vertices; v++) {
+    double sx = 0, sy = 0, sz = 0;
+    for (int k = vertex_start[v]; k < vertex_start[v + 1]; k++) {
+      int i = vertex_triangles[k];
+      sx += fx[i];
+      sy += fy[i];
+      sz += fz[i];
+    }
+    point_masses[v].forces += Vector3D(sx, sy, sz);
+  }
+}
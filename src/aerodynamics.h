@@ -0,0 +1,104 @@
+#ifndef AERODYNAMICS_H
+#define AERODYNAMICS_H
+
+#include <vector>
+
+#include "CGL/CGL.h"
+#include "clothMesh.h"
+#include "pointMass.h"
+
+using namespace CGL;
+using namespace std;
+
+/**
+ * Procedural wind: a steady base velocity plus turbulence from value noise.
+ * The turbulence is carried along with the base wind (frozen turbulence), so
+ * gusts travel across the scene instead of flickering in place.
+ */
+class WindField {
+public:
+  WindField()
+      : turbulence(0), scale(1), air_density(1.2), drag(1.0), lift(0.0),
+        cache_interval(1.0 / 30), seed(0), time(0) {}
+
+  // Wind velocity at a point and time
+  Vector3D velocity(const Vector3D &p, double t) const;
+
+  // Sets the time the field is sampled at, like CollisionObject::advance
+  void advance(double t) { time = t; }
+
+  // Base wind velocity (m/s)
+  Vector3D base;
+  // Amplitude (m/s) and feature size (m) of the turbulence
+  double turbulence;
+  double scale;
+
+  // Air density and the drag and lift coefficients of the cloth
+  double air_density;
+  double drag;
+  double lift;
+
+  // Seconds between the cached snapshots the cloth samples from
+  double cache_interval;
+  unsigned int seed;
+
+  double time;
+
+private:
+  double noise(double x, double y, double z, unsigned int channel) const;
+};
+
+/**
+ * Per-triangle aerodynamic drag and lift on a cloth.
+ *
+ * The wind field is evaluated only on a coarse grid around the cloth, at two
+ * snapshots cache_interval apart. Particles sample it trilinearly whenever a
+ * new snapshot is taken and blend the two samples linearly in time. Forces
+ * are computed per triangle from the relative air velocity and the triangle
+ * normal in branch-free loops over flat arrays, then gathered per particle,
+ * so no two iterations write the same value.
+ */
+class Aerodynamics {
+public:
+  Aerodynamics() : mesh(nullptr), cell_size(0), snapshot_index(-1), out_of_grid(false) {}
+
+  // Adds the air forces on every particle to PointMass::forces
+  void apply(vector<PointMass> &point_masses, ClothMesh *mesh, const WindField &wind,
+             double delta_t);
+
+  // Drops the cached wind, so the next apply refits the grid around the
+  // cloth as it is then
+  void reset() { snapshot_index = -1; }
+
+private:
+  void build_topology(vector<PointMass> &point_masses, ClothMesh *mesh);
+  void update_cache(const WindField &wind, const vector<PointMass> &point_masses);
+  void fill_snapshot(const WindField &wind, double t, vector<float> &snapshot);
+  void sample(const vector<PointMass> &point_masses, const vector<float> &snapshot,
+              vector<double> *out);
+
+  // Triangle corners as particle indices, and the triangles around each
+  // particle as CSR ranges
+  ClothMesh *mesh;
+  vector<int> corners[3];
+  vector<int> vertex_start;
+  vector<int> vertex_triangles;
+
+  // Per-particle relative air velocity, and per-triangle force (a third of
+  // the triangle's total, one share per corner)
+  vector<double> rel[3];
+  vector<double> force[3];
+
+  // Cached wind grid: two snapshots of 3 * resolution^3 velocities
+  Vector3D grid_min;
+  double cell_size;
+  // Snapshots are taken at snapshot_index and snapshot_index + 1 intervals
+  long long snapshot_index;
+  // Set when a particle left the grid, which is refit on the next step
+  bool out_of_grid;
+  vector<float> snapshots[2];
+  // Wind at each particle in both snapshots, per axis
+  vector<double> particle_wind[2][3];
+};
+
+#endif /* AERODYNAMICS_H */
@@ -0,0 +1,527 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef _WIN32
+#include "../misc/getopt.h" // getopt for windows
+#else
+#include <getopt.h>
+#include <unistd.h>
+#endif
+
+#include "../cloth.h"
+#include "../collision/plane.h"
+#include "../collision/sphere.h"
+#include "../misc/file_utils.h"
+#include "scene_bench.h"
+
+using namespace std;
+
+/**
+ * Microbenchmarks for the phases of Cloth::simulate, and with -S, end-to-end
+ * throughput of whole scenes (see scene_bench.h).
+ *
+ * Every kernel runs on a balloon of each requested grid size: buildGrid
+ * wraps the n x n grid around a sphere whose diameter is the cloth's width,
+ * with the first and last rows meeting at the poles. The cloth's width and
+ * mass grow with n, so the grid spacing and the mass per particle are the
+ * same at every size and ns/particle is comparable across sizes. The balloon
+ * is pinned at two opposite points of its equator. Its particles are
+ * jittered by a fixed-seed generator, so some springs are stretched, the
+ * cap around one pole is inside the sphere, the lower half is below the
+ * plane, and every run does the same work.
+ *
+ * Kernels that move particles are timed one call at a time, each from the
+ * same starting state; restoring that state is not timed. Each measurement
+ * repeats the kernel for at least the minimum time, and the median and
+ * fastest of several measurements are reported.
+ */
+
+// Grid spacing and thickness of the bundled scenes' 50x50, 1 m cloths
+#define BENCH_SPACING 0.02
+#define BENCH_THICKNESS 0.0095
+#define BENCH_FRAMES_PER_SEC 90
+#define BENCH_SIMULATION_STEPS 30
+#define BENCH_SEED 184
+
+namespace {
+
+struct Fixture {
+  Fixture(int n);
+  ~Fixture();
+
+  // Puts the particles back where they started
+  void restore();
+
+  Cloth cloth;
+  ClothParameters cp;
+  double mass;
+  double delta_t;
+  vector<Vector3D> external_accelerations;
+  Sphere *sphere;
+  Plane *plane;
+  vector<CollisionObject *> objects;
+
+  vector<Vector3D> positions;
+  vector<Vector3D> last_positions;
+};
+
+Fixture::Fixture(int n) : cp(true, true, true, 0.2, 15, 5000) {
+  cloth.width = cloth.height = BENCH_SPACING * n;
+  cloth.num_width_points = cloth.num_height_points = n;
+  cloth.thickness = BENCH_THICKNESS;
+  // Opposite ends of the equator, half a turn apart on the middle row
+  cloth.pinned.assign(n * n, false);
+  cloth.pinned[(n / 2) * n] = cloth.pinned[(n / 2) * n + (n - 1) / 2] = true;
+  cloth.buildGrid();
+  cloth.buildClothMesh();
+
+  mt19937 generator(BENCH_SEED);
+  uniform_real_distribution<double> jitter(-0.3 * BENCH_SPACING, 0.3 * BENCH_SPACING);
+  for (PointMass &pm : cloth.point_masses) {
+    pm.position += Vector3D(jitter(generator), jitter(generator), jitter(generator));
+    pm.last_position += Vector3D(jitter(generator), jitter(generator), jitter(generator));
+  }
+
+  // Half the balloon is below the plane; the sphere sits on its pole at +z
+  Vector3D min, max;
+  cloth.bounds(min, max);
+  Vector3D center = (min + max) / 2;
+  sphere = new Sphere(center + Vector3D(0, 0, cloth.width / 2), cloth.width / 4, 0.3, 8, 8);
+  plane = new Plane(center, Vector3D(0, 1, 0), 0.5);
+
+  mass = cloth.width * cloth.height * cp.density / n / n;
+  delta_t = 1.0 / BENCH_FRAMES_PER_SEC / BENCH_SIMULATION_STEPS;
+  external_accelerations.push_back(Vector3D(0, -9.8, 0));
+
+  // One step without colliders sets up the forces and the sleep state the
+  // phases need
+  cloth.simulate(BENCH_FRAMES_PER_SEC, BENCH_SIMULATION_STEPS, &cp, external_accelerations, &objects);
+  objects.push_back(sphere);
+  objects.push_back(plane);
+
+  for (PointMass &pm : cloth.point_masses) {
+    positions.push_back(pm.position);
+    last_positions.push_back(pm.last_position);
+  }
+}
+
+Fixture::~Fixture() {
+  delete sphere;
+  delete plane;
+}
+
+void Fixture::restore() {
+  for (size_t i = 0; i < positions.size(); i++) {
+    cloth.point_masses[i].position = positions[i];
+    cloth.point_masses[i].last_position = last_positions[i];
+  }
+}
+
+// Keeps results of pure kernels alive
+volatile double sink;
+
+struct Kernel {
+  const char *name;
+  // Untimed, before every call
+  void (*prepare)(Fixture &f);
+  void (*run)(Fixture &f);
+};
+
+void no_prepare(Fixture &f) {}
+
+void restore_particles(Fixture &f) { f.restore(); }
+
+void restore_map(Fixture &f) {
+  f.restore();
+  f.cloth.build_spatial_map();
+}
+
+void restore_blocks(Fixture &f) {
+  f.restore();
+  f.cloth.build_collision_blocks();
+}
+
+const Kernel KERNELS[] = {
+  {"integrate", restore_particles,
+   [](Fixture &f) { f.cloth.integrate(&f.cp, f.mass, f.delta_t); }},
+  {"satisfy_constraints", restore_particles,
+   [](Fixture &f) { f.cloth.satisfy_constraints(f.delta_t); }},
+  {"build_spatial_map", restore_particles,
+   [](Fixture &f) { f.cloth.build_spatial_map(); }},
+  {"self_collide", restore_map,
+   [](Fixture &f) {
+     for (PointMass &pm : f.cloth.point_masses) {
+       f.cloth.self_collide(pm, BENCH_SIMULATION_STEPS);
+     }
+   }},
+  {"sphere_collide", restore_blocks,
+   [](Fixture &f) {
+     for (PointMassBlock &block : f.cloth.collision_blocks) {
+       f.sphere->collide(block);
+     }
+   }},
+  {"plane_collide", restore_blocks,
+   [](Fixture &f) {
+     for (PointMassBlock &block : f.cloth.collision_blocks) {
+       f.plane->collide(block);
+     }
+   }},
+  {"normal", no_prepare,
+   [](Fixture &f) {
+     Vector3D sum;
+     for (PointMass &pm : f.cloth.point_masses) {
+       sum += pm.normal();
+     }
+     sink = sum.x + sum.y + sum.z;
+   }},
+  {"build_cloth_mesh", no_prepare,
+   [](Fixture &f) { f.cloth.buildClothMesh(); }},
+  // The whole substep, with both colliders, for reference
+  {"simulate", [](Fixture &f) { f.restore(); f.cloth.wake(); },
+   [](Fixture &f) {
+     f.cloth.simulate(BENCH_FRAMES_PER_SEC, BENCH_SIMULATION_STEPS, &f.cp,
+                      f.external_accelerations, &f.objects);
+   }},
+};
+
+const size_t NUM_KERNELS = sizeof(KERNELS) / sizeof(KERNELS[0]);
+
+struct Result {
+  string kernel;
+  int grid;
+  size_t particles;
+  size_t springs;
+  int threads;
+  long iterations;
+  double median_ns;
+  double min_ns;
+  double speedup;
+};
+
+// Mean time of one call over iterations calls, in nanoseconds
+double measure(const Kernel &kernel, Fixture &f, long iterations) {
+  chrono::steady_clock::duration total(0);
+  for (long i = 0; i < iterations; i++) {
+    kernel.prepare(f);
+    auto start = chrono::steady_clock::now();
+    kernel.run(f);
+    total += chrono::steady_clock::now() - start;
+  }
+  return chrono::duration<double, nano>(total).count() / iterations;
+}
+
+Result run_kernel(const Kernel &kernel, Fixture &f, int n, int threads, int repetitions,
+                  double min_time_ms) {
+  // Warm up, and find how many calls take the minimum time
+  double once = measure(kernel, f, 1);
+  long iterations = max(1L, (long)(min_time_ms * 1e6 / max(once, 1.0)));
+
+  vector<double> samples;
+  for (int r = 0; r < repetitions; r++) {
+    samples.push_back(measure(kernel, f, iterations));
+  }
+  sort(samples.begin(), samples.end());
+
+  Result result;
+  result.kernel = kernel.name;
+  result.grid = n;
+  result.particles = f.cloth.point_masses.size();
+  result.springs = f.cloth.springs.size();
+  result.threads = threads;
+  result.iterations = iterations;
+  result.median_ns = samples[samples.size() / 2];
+  result.min_ns = samples[0];
+  result.speedup = 1.0;
+  return result;
+}
+
+void set_threads(int threads) {
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#endif
+}
+
+int max_threads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+// Parses a comma-separated list of positive integers
+bool parse_list(const char *arg, vector<int> &values) {
+  values.clear();
+  stringstream ss(arg);
+  string item;
+  while (getline(ss, item, ',')) {
+    int value = atoi(item.c_str());
+    if (value < 1) return false;
+    values.push_back(value);
+  }
+  return !values.empty();
+}
+
+bool parse_names(const char *arg, vector<string> &names) {
+  names.clear();
+  stringstream ss(arg);
+  string item;
+  while (getline(ss, item, ',')) {
+    bool known = false;
+    for (size_t k = 0; k < NUM_KERNELS; k++) {
+      known = known || item == KERNELS[k].name;
+    }
+    if (!known) {
+      fprintf(stderr, "Unknown kernel: %s\n", item.c_str());
+      return false;
+    }
+    names.push_back(item);
+  }
+  return !names.empty();
+}
+
+void write_csv(FILE *out, const vector<Result> &results) {
+  fprintf(out, "kernel,grid,particles,springs,threads,iterations,median_ns,min_ns,ns_per_particle,speedup\n");
+  for (const Result &r : results) {
+    fprintf(out, "%s,%d,%zu,%zu,%d,%ld,%.1f,%.1f,%.4f,%.3f\n", r.kernel.c_str(), r.grid,
+            r.particles, r.springs, r.threads, r.iterations, r.median_ns, r.min_ns,
+            r.median_ns / r.particles, r.speedup);
+  }
+}
+
+void write_json(FILE *out, const vector<Result> &results, int repetitions, double min_time_ms,
+                int cores) {
+  fprintf(out, "{\n  \"seed\": %d,\n  \"repetitions\": %d,\n  \"min_time_ms\": %g,\n",
+          BENCH_SEED, repetitions, min_time_ms);
+  fprintf(out, "  \"max_threads\": %d,\n  \"results\": [", cores);
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    fprintf(out, "%s\n    {\"kernel\": \"%s\", \"grid\": %d, \"particles\": %zu, \"springs\": %zu, "
+                 "\"threads\": %d, \"iterations\": %ld, \"median_ns\": %.1f, \"min_ns\": %.1f, "
+                 "\"ns_per_particle\": %.4f, \"speedup\": %.3f}",
+            i ? "," : "", r.kernel.c_str(), r.grid, r.particles, r.springs, r.threads,
+            r.iterations, r.median_ns, r.min_ns, r.median_ns / r.particles, r.speedup);
+  }
+  fprintf(out, "\n  ]\n}\n");
+}
+
+// Finds the directory holding the bundled scenes, like the viewer finds its
+// project root
+bool find_project_root(string &root) {
+  for (const char *path : {".", "..", "../..", "../../.."}) {
+    if (FileUtils::file_exists(string(path) + "/scene/pinned2.json")) {
+      root = path;
+      return true;
+    }
+  }
+  return false;
+}
+
+void usageError(const char *binaryName) {
+  printf("Usage: %s [options]\n", binaryName);
+  printf("Options:\n");
+  printf("  -s     <LIST>      Grid sizes, e.g. 16,64. Default 16,32,...,1024.\n");
+  printf("  -t     <LIST>      Thread counts. Default 1,2,4,... up to the number of cores.\n");
+  printf("  -k     <LIST>      Kernels to run. Default all; -l lists them.\n");
+  printf("  -r     <INT>       Measurements per kernel or scene. Default 5 and 3.\n");
+  printf("  -m     <FLOAT>     Minimum time of a measurement in ms. Default 100.\n");
+  printf("  -j                 Write JSON instead of CSV.\n");
+  printf("  -o     <STRING>    Write results to a file instead of stdout.\n");
+  printf("  -l                 List kernels and exit.\n");
+  printf("Scene options:\n");
+  printf("  -S                 Run whole scenes instead of kernels.\n");
+  printf("  -f     <STRING>    Scene to run; may be repeated. Default the bundled\n");
+  printf("                     plane, sphere, pinned2, pinned4 and selfCollision.\n");
+  printf("  -n     <INT>       Frames per scene. Default 300.\n");
+  printf("  -b     <STRING>    Baseline to compare against: the output of a -S -j run.\n");
+  printf("                     Exits with status 1 on regressions.\n");
+  printf("  -x     <FLOAT>     Regression threshold in percent. Default 10.\n");
+  printf("  -H     <STRING>    Log the state hash of every frame to a CSV file.\n");
+  printf("  -D                 Check that every thread count given with -t steps\n");
+  printf("                     each scene to the same state, frame by frame.\n");
+  printf("                     Exits with status 1 if any differ.\n");
+  printf("\n");
+  exit(-1);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  vector<int> sizes = {16, 32, 64, 128, 256, 512, 1024};
+  int cores = max_threads();
+  vector<int> thread_counts;
+  for (int t = 1; t < cores; t *= 2) {
+    thread_counts.push_back(t);
+  }
+  thread_counts.push_back(cores);
+  vector<string> names;
+  int repetitions = 0;
+  double min_time_ms = 100;
+  bool json = false;
+  string output;
+
+  bool scene_mode = false;
+  bool check_determinism = false;
+  SceneBenchOptions scene_options;
+  scene_options.frames = 300;
+  scene_options.threshold = 0.1;
+
+  int c;
+  while ((c = getopt(argc, argv, "s:t:k:r:m:jo:lSf:n:b:x:H:D")) != -1) {
+    switch (c) {
+      case 's': {
+        if (!parse_list(optarg, sizes)) usageError(argv[0]);
+        break;
+      }
+      case 't': {
+        if (!parse_list(optarg, thread_counts)) usageError(argv[0]);
+        break;
+      }
+      case 'k': {
+        if (!parse_names(optarg, names)) usageError(argv[0]);
+        break;
+      }
+      case 'r': {
+        repetitions = max(1, atoi(optarg));
+        break;
+      }
+      case 'm': {
+        min_time_ms = max(0.0, atof(optarg));
+        break;
+      }
+      case 'j': {
+        json = true;
+        break;
+      }
+      case 'o': {
+        output = optarg;
+        break;
+      }
+      case 'l': {
+        for (size_t k = 0; k < NUM_KERNELS; k++) {
+          printf("%s\n", KERNELS[k].name);
+        }
+        return 0;
+      }
+      case 'S': {
+        scene_mode = true;
+        break;
+      }
+      case 'f': {
+        scene_options.scenes.push_back(optarg);
+        break;
+      }
+      case 'n': {
+        scene_options.frames = max(1, atoi(optarg));
+        break;
+      }
+      case 'b': {
+        scene_options.baseline = optarg;
+        break;
+      }
+      case 'x': {
+        scene_options.threshold = max(0.0, atof(optarg)) / 100;
+        break;
+      }
+      case 'H': {
+        scene_options.hash_log = optarg;
+        break;
+      }
+      case 'D': {
+        scene_mode = check_determinism = true;
+        break;
+      }
+      default: {
+        usageError(argv[0]);
+        break;
+      }
+    }
+  }
+
+  FILE *out = stdout;
+  if (!output.empty()) {
+    out = fopen(output.c_str(), "w");
+    if (!out) {
+      fprintf(stderr, "Cannot write %s\n", output.c_str());
+      return -1;
+    }
+  }
+
+  if (scene_mode) {
+    if (scene_options.scenes.empty()) {
+      string root;
+      if (!find_project_root(root)) {
+        fprintf(stderr, "Cannot find the bundled scenes; name them with -f\n");
+        return -1;
+      }
+      for (const char *name : {"plane", "sphere", "pinned2", "pinned4", "selfCollision"}) {
+        scene_options.scenes.push_back(root + "/scene/" + name + ".json");
+      }
+    }
+    scene_options.repetitions = repetitions ? repetitions : 3;
+    scene_options.json = json;
+    scene_options.out = out;
+    scene_options.thread_counts = thread_counts;
+    if (check_determinism) {
+      if (out != stdout) fclose(out);
+      int diverged = check_scene_determinism(scene_options);
+      if (diverged < 0) return -1;
+      return diverged > 0 ? 1 : 0;
+    }
+    int regressions = run_scene_bench(scene_options);
+    if (out != stdout) fclose(out);
+    if (regressions < 0) return -1;
+    if (regressions > 0) {
+      fprintf(stderr, "%d regression%s against %s\n", regressions, regressions == 1 ? "" : "s",
+              scene_options.baseline.c_str());
+      // Not the count, which a shell would see modulo 256
+      return 1;
+    }
+    return 0;
+  }
+
+  if (!repetitions) repetitions = 5;
+  for (int n : sizes) {
+    if (n < 3) {
+      fprintf(stderr, "Grid sizes must be at least 3\n");
+      return -1;
+    }
+  }
+
+  vector<Result> results;
+  for (int n : sizes) {
+    Fixture f(n);
+    for (size_t k = 0; k < NUM_KERNELS; k++) {
+      const Kernel &kernel = KERNELS[k];
+      if (!names.empty() && find(names.begin(), names.end(), kernel.name) == names.end()) continue;
+
+      double single = 0;
+      for (size_t t = 0; t < thread_counts.size(); t++) {
+        set_threads(thread_counts[t]);
+        Result r = run_kernel(kernel, f, n, thread_counts[t], repetitions, min_time_ms);
+        if (t == 0) single = r.median_ns;
+        r.speedup = single / r.median_ns;
+        fprintf(stderr, "%-20s %5dx%-5d %3d threads %12.1f ns %9.3f ns/particle\n", r.kernel.c_str(),
+                n, n, r.threads, r.median_ns, r.median_ns / r.particles);
+        results.push_back(r);
+      }
+    }
+  }
+
+  if (json) {
+    write_json(out, results, repetitions, min_time_ms, cores);
+  } else {
+    write_csv(out, results);
+  }
+  if (out != stdout) fclose(out);
+  return 0;
+}
@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "../misc/json_reader.h"
+#include "../simulation.h"
+#include "scene_bench.h"
+
+using CGL::Misc::JsonReader;
+
+// Same stepping as the viewer's defaults
+#define SCENE_FRAMES_PER_SEC 90
+#define SCENE_SIMULATION_STEPS 30
+
+/**
+ * Every allocation through operator new in the benchmark binary is counted,
+ * so a frame that starts allocating shows up even when it is not slower on
+ * this machine.
+ */
+static std::atomic<size_t> num_allocations(0);
+
+void *operator new(size_t size) {
+  num_allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  num_allocations++;
+  return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
+
+namespace {
+
+struct SceneResult {
+  string scene;
+  double seconds;
+  double frames_per_sec;
+  double substeps_per_sec;
+  long peak_rss_kb;
+  double allocations_per_frame;
+};
+
+// Starts a new peak resident set size measurement, where the system allows
+// it; otherwise the peak is that of the whole run so far
+void reset_peak_rss() {
+#ifdef __linux__
+  ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+#endif
+}
+
+long peak_rss_kb() {
+#ifdef __linux__
+  ifstream status("/proc/self/status");
+  string line;
+  while (getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) return atol(line.c_str() + 6);
+  }
+  return 0;
+#elif defined(_WIN32)
+  return 0;
+#else
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // Bytes on macOS
+  return usage.ru_maxrss / 1024;
+#endif
+}
+
+// File name without its directory and extension
+string scene_name(const string &filename) {
+  size_t slash = filename.find_last_of("/\\");
+  string name = slash == string::npos ? filename : filename.substr(slash + 1);
+  size_t dot = name.rfind('.');
+  return dot == string::npos ? name : name.substr(0, dot);
+}
+
+bool load(Simulation &simulation, const string &filename) {
+  if (!simulation.load(filename)) {
+    cerr << "Cannot read scene " << filename << endl;
+    return false;
+  }
+  return true;
+}
+
+void step(Simulation &simulation) {
+  simulation.step(SCENE_FRAMES_PER_SEC, SCENE_SIMULATION_STEPS, Vector3D(0, -9.8, 0));
+}
+
+bool run_scene(const string &filename, const SceneBenchOptions &options, FILE *hashes,
+               SceneResult &result) {
+  result.scene = scene_name(filename);
+
+  vector<double> seconds;
+  size_t allocations = 0;
+  reset_peak_rss();
+  for (int r = 0; r < options.repetitions; r++) {
+    Simulation simulation;
+    if (!load(simulation, filename)) return false;
+
+    // Hashing is not timed, and its allocations are not counted
+    chrono::steady_clock::duration total(0);
+    size_t frame_allocations = 0;
+    for (int f = 0; f < options.frames; f++) {
+      size_t allocations_before = num_allocations;
+      auto start = chrono::steady_clock::now();
+      step(simulation);
+      total += chrono::steady_clock::now() - start;
+      frame_allocations += num_allocations - allocations_before;
+      if (hashes && r == 0) {
+        fprintf(hashes, "%s,%d,%016llx\n", result.scene.c_str(), f + 1,
+                (unsigned long long)simulation.state_hash());
+      }
+    }
+    seconds.push_back(chrono::duration<double>(total).count());
+    allocations = max(allocations, frame_allocations);
+  }
+  sort(seconds.begin(), seconds.end());
+
+  result.seconds = seconds[seconds.size() / 2];
+  result.frames_per_sec = options.frames / result.seconds;
+  result.substeps_per_sec = result.frames_per_sec * SCENE_SIMULATION_STEPS;
+  result.peak_rss_kb = peak_rss_kb();
+  result.allocations_per_frame = (double)allocations / options.frames;
+  return true;
+}
+
+bool read_file(const string &filename, string &text) {
+  ifstream in(filename.c_str(), ios::binary);
+  if (!in) return false;
+  stringstream ss;
+  ss << in.rdbuf();
+  text = ss.str();
+  return true;
+}
+
+bool read_baseline(const string &filename, int &frames, vector<SceneResult> &results) {
+  string text;
+  if (!read_file(filename, text)) {
+    cerr << "Cannot read baseline " << filename << endl;
+    return false;
+  }
+
+  JsonReader in(text.c_str(), text.c_str() + text.size());
+  frames = 0;
+  string key;
+  in.begin_object();
+  while (in.next_key(key)) {
+    if (key == "frames") {
+      in.read(frames);
+    } else if (key == "scenes" && in.begin_array()) {
+      while (in.next_element()) {
+        SceneResult r = SceneResult();
+        in.begin_object();
+        while (in.next_key(key)) {
+          bool read = true;
+          if (key == "scene") read = in.read(r.scene);
+          else if (key == "frames_per_sec") read = in.read(r.frames_per_sec);
+          else if (key == "allocations_per_frame") read = in.read(r.allocations_per_frame);
+          else if (key == "peak_rss_kb") {
+            double kb;
+            read = in.read(kb);
+            r.peak_rss_kb = (long)kb;
+          } else {
+            in.skip();
+          }
+          if (!read) in.skip();
+        }
+        results.push_back(r);
+      }
+    } else {
+      in.skip();
+    }
+  }
+  if (!in.finish()) {
+    const JsonReader::Location &at = in.error_location();
+    cerr << filename << ":" << at.line << ":" << at.column << ": " << in.error() << endl;
+    return false;
+  }
+  return true;
+}
+
+// Reports how far a measurement is past its limit; false if it is within
+bool regressed(const string &scene, const char *metric, double value, double base,
+               double threshold, bool higher_is_better) {
+  double limit = higher_is_better ? base * (1 - threshold) : base * (1 + threshold);
+  if (higher_is_better ? value >= limit : value <= limit) return false;
+  cerr << "Regression: " << scene << " " << metric << " " << value << ", baseline " << base
+       << " (" << (value / base - 1) * 100 << "%)" << endl;
+  return true;
+}
+
+int compare(const vector<SceneResult> &results, const SceneBenchOptions &options) {
+  int frames;
+  vector<SceneResult> baseline;
+  if (!read_baseline(options.baseline, frames, baseline)) return -1;
+  if (frames != options.frames) {
+    cerr << "Baseline " << options.baseline << " ran " << frames << " frames, not "
+         << options.frames << endl;
+    return -1;
+  }
+
+  int regressions = 0;
+  for (const SceneResult &r : results) {
+    const SceneResult *base = nullptr;
+    for (const SceneResult &b : baseline) {
+      if (b.scene == r.scene) base = &b;
+    }
+    if (!base) {
+      cerr << "No baseline for " << r.scene << endl;
+      continue;
+    }
+    double t = options.threshold;
+    regressions += regressed(r.scene, "frames/sec", r.frames_per_sec, base->frames_per_sec, t, true);
+    regressions += regressed(r.scene, "peak RSS (KiB)", r.peak_rss_kb, base->peak_rss_kb, t, false);
+    // Less than one allocation a frame is amortized growth, not a regression
+    regressions += regressed(r.scene, "allocations/frame", r.allocations_per_frame,
+                             max(base->allocations_per_frame, 1.0), t, false);
+  }
+  return regressions;
+}
+
+void write_csv(FILE *out, const vector<SceneResult> &results, int frames) {
+  fprintf(out, "scene,frames,seconds,frames_per_sec,substeps_per_sec,peak_rss_kb,allocations_per_frame\n");
+  for (const SceneResult &r : results) {
+    fprintf(out, "%s,%d,%.4f,%.2f,%.1f,%ld,%.2f\n", r.scene.c_str(), frames, r.seconds,
+            r.frames_per_sec, r.substeps_per_sec, r.peak_rss_kb, r.allocations_per_frame);
+  }
+}
+
+void write_json(FILE *out, const vector<SceneResult> &results, int frames) {
+  fprintf(out, "{\n  \"frames\": %d,\n  \"simulation_steps\": %d,\n  \"scenes\": [", frames,
+          SCENE_SIMULATION_STEPS);
+  for (size_t i = 0; i < results.size(); i++) {
+    const SceneResult &r = results[i];
+    fprintf(out, "%s\n    {\"scene\": \"%s\", \"seconds\": %.4f, \"frames_per_sec\": %.2f, "
+                 "\"substeps_per_sec\": %.1f, \"peak_rss_kb\": %ld, \"allocations_per_frame\": %.2f}",
+            i ? "," : "", r.scene.c_str(), r.seconds, r.frames_per_sec, r.substeps_per_sec,
+            r.peak_rss_kb, r.allocations_per_frame);
+  }
+  fprintf(out, "\n  ]\n}\n");
+}
+
+} // namespace
+
+int run_scene_bench(const SceneBenchOptions &options) {
+  FILE *hashes = nullptr;
+  if (!options.hash_log.empty()) {
+    hashes = fopen(options.hash_log.c_str(), "w");
+    if (!hashes) {
+      cerr << "Cannot write " << options.hash_log << endl;
+      return -1;
+    }
+    fprintf(hashes, "scene,frame,hash\n");
+  }
+
+  vector<SceneResult> results;
+  for (const string &filename : options.scenes) {
+    SceneResult r;
+    bool ran = run_scene(filename, options, hashes, r);
+    if (!ran) {
+      if (hashes) fclose(hashes);
+      return -1;
+    }
+    fprintf(stderr, "%-16s %9.2f frames/sec %10.1f substeps/sec %8ld KiB %8.2f allocations/frame\n",
+            r.scene.c_str(), r.frames_per_sec, r.substeps_per_sec, r.peak_rss_kb,
+            r.allocations_per_frame);
+    results.push_back(r);
+  }
+  if (hashes) fclose(hashes);
+
+  if (options.json) {
+    write_json(options.out, results, options.frames);
+  } else {
+    write_csv(options.out, results, options.frames);
+  }
+
+  return options.baseline.empty() ? 0 : compare(results, options);
+}
+
+int check_scene_determinism(const SceneBenchOptions &options) {
+  int diverged = 0;
+  for (const string &filename : options.scenes) {
+    string scene = scene_name(filename);
+    vector<uint64_t> reference;
+    int first_divergence = 0;
+    int divergent_threads = 0;
+
+    for (size_t t = 0; t < options.thread_counts.size(); t++) {
+#ifdef _OPENMP
+      omp_set_num_threads(options.thread_counts[t]);
+#endif
+      Simulation simulation;
+      if (!load(simulation, filename)) return -1;
+      for (int f = 0; f < options.frames; f++) {
+        step(simulation);
+        uint64_t h = simulation.state_hash();
+        if (t == 0) {
+          reference.push_back(h);
+        } else if (h != reference[f]) {
+          first_divergence = f + 1;
+          divergent_threads = options.thread_counts[t];
+          break;
+        }
+      }
+      if (first_divergence) break;
+    }
+
+    if (first_divergence) {
+      fprintf(stderr, "%-16s %d threads diverge from %d at frame %d\n", scene.c_str(),
+              divergent_threads, options.thread_counts[0], first_divergence);
+      diverged++;
+    } else {
+      fprintf(stderr, "%-16s identical over %d frames, final hash %016llx\n", scene.c_str(),
+              options.frames, (unsigned long long)reference.back());
+    }
+  }
+  return diverged;
+}
@@ -0,0 +1,38 @@
+#ifndef SCENE_BENCH_H
+#define SCENE_BENCH_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct SceneBenchOptions {
+  vector<string> scenes;
+  int frames;
+  int repetitions;
+  // Results to compare against, if not empty; written by a JSON run
+  string baseline;
+  // Largest slowdown, or growth in memory or allocations, that passes, as
+  // a fraction of the baseline
+  double threshold;
+  bool json;
+  FILE *out;
+  // File to log every frame's state hash to, if not empty
+  string hash_log;
+  // Thread counts to compare for check_scene_determinism
+  vector<int> thread_counts;
+};
+
+// Runs each scene headless for a fixed number of frames and writes its
+// throughput, peak memory and allocations. Returns the number of
+// regressions against the baseline, or -1 if a scene or the baseline cannot
+// be read.
+int run_scene_bench(const SceneBenchOptions &options);
+
+// Runs each scene at every thread count and compares the state hashes frame
+// by frame. Returns the number of scenes whose runs differ, or -1 if a scene
+// cannot be read.
+int check_scene_determinism(const SceneBenchOptions &options);
+
+#endif /* SCENE_BENCH_H */
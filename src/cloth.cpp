@@ -10,6 +10,7 @@
 #include "cloth.h"
 #include "collision/plane.h"
 #include "collision/sphere.h"
+#include "misc/hash.h"
 #include "pointMass.h"
 #include "spring.h"
 
@@ -22,6 +23,9 @@ Cloth::Cloth(double width, double height, int num_width_points,
   this->num_width_points = num_width_points;
   this->num_height_points = num_height_points;
   this->thickness = thickness;
+  this->clothMesh = nullptr;
+  this->revision = 0;
+  this->num_asleep = 0;
 
   buildGrid();
   buildClothMesh();
@@ -34,66 +38,94 @@ Cloth::~Cloth() {
   if (clothMesh) {
     delete clothMesh;
   }
+  for (const auto &entry : map) {
+    delete entry.second;
+  }
 }
 
-void Cloth::buildGrid() {
-  // TODO (Part 1): Build a grid of masses and springs.
+// Springs starting at each particle of row j, as laid out by buildGrid
+static size_t springs_in_row(int j, int w, int h) {
+	size_t count = w - 1 + max(w - 2, 0);
+	if (j < h - 1) count += w + 2 * (w - 1);
+	if (j < h - 2) count += w;
+	return count;
+}
 
+void Cloth::buildGrid() {
+	// TODO (Part 1): Build a grid of masses and springs.
 
+	// Rows are independent, so each is filled in place in parallel; every
+	// particle and spring lands where serial construction would put it.
+	int w = num_width_points;
+	int h = num_height_points;
 
 	double radius = std::min(width, height) / 2.0;
-	Vector3D center(width / 2.0, height / 2.0, 0.0);
+	Vector3D center = Vector3D(width / 2.0, height / 2.0, 0.0) + offset;
+
+	point_masses.assign(w * h, PointMass(Vector3D(), false));
 
-	for (int y = 0; y < this->num_height_points; y++) {
-		for (int x = 0; x < this->num_width_points; x++) {
-			double u = (double)x / (num_width_points - 1);
-			double v = (double)y / (num_height_points - 1);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			double u = (double)x / (w - 1);
+			double v = (double)y / (h - 1);
 
 			double theta = u * 2.0 * M_PI;
 			double phi = v * M_PI;
 
+			int index = y * w + x;
 			Vector3D pos;
-			pos.x = radius * std::cos(theta) * std::sin(phi) + center.x;
-			pos.y = radius * std::sin(theta) * std::sin(phi) + center.y;
-			pos.z = radius * std::cos(phi);
-
-			bool pin = false;
-			for (int i = 0; i < this->pinned.size(); i++) {
-				if (this->pinned[i][0] == x && this->pinned[i][1] == y) {
-					pin = true;
-				}
+			if (!initial_positions.empty()) {
+				pos = initial_positions[index];
+			} else {
+				pos.x = radius * std::cos(theta) * std::sin(phi) + center.x;
+				pos.y = radius * std::sin(theta) * std::sin(phi) + center.y;
+				pos.z = radius * std::cos(phi) + center.z;
 			}
 
-			this->point_masses.emplace_back(PointMass(pos, pin));
+			bool pin = !pinned.empty() && pinned[index];
+			point_masses[index] = PointMass(pos, pin);
 		}
 	}
 
-	for (int j = 0; j < num_height_points; ++j) {
-		for (int i = 0; i < num_width_points; ++i) {
-			PointMass* pm = &point_masses[j * num_width_points + i];
+	for (Tether &tether : tethers) {
+		tether.build(point_masses[tether.vertex].position);
+	}
+
+	vector<size_t> row_start(h + 1, 0);
+	for (int j = 0; j < h; j++) {
+		row_start[j + 1] = row_start[j] + springs_in_row(j, w, h);
+	}
+	springs.assign(row_start[h], Spring(nullptr, nullptr, 0.0));
+
+	#pragma omp parallel for schedule(static)
+	for (int j = 0; j < h; ++j) {
+		Spring *spring = &springs[row_start[j]];
+		for (int i = 0; i < w; ++i) {
+			PointMass* pm = &point_masses[j * w + i];
 
 			// Structural springs
-			if (i < num_width_points - 1) {
-				springs.emplace_back(pm, &point_masses[j * num_width_points + i + 1], STRUCTURAL);
+			if (i < w - 1) {
+				*spring++ = Spring(pm, &point_masses[j * w + i + 1], STRUCTURAL);
 			}
-			if (j < num_height_points - 1) {
-				springs.emplace_back(pm, &point_masses[(j + 1) * num_width_points + i], STRUCTURAL);
+			if (j < h - 1) {
+				*spring++ = Spring(pm, &point_masses[(j + 1) * w + i], STRUCTURAL);
 			}
 
 			// Shearing springs
-			if (i < num_width_points - 1 && j < num_height_points - 1) {
-				springs.emplace_back(pm, &point_masses[(j + 1) * num_width_points + i + 1], SHEARING);
+			if (i < w - 1 && j < h - 1) {
+				*spring++ = Spring(pm, &point_masses[(j + 1) * w + i + 1], SHEARING);
 			}
-			if (i > 0 && j < num_height_points - 1) {
-				springs.emplace_back(pm, &point_masses[(j + 1) * num_width_points + i - 1], SHEARING);
+			if (i > 0 && j < h - 1) {
+				*spring++ = Spring(pm, &point_masses[(j + 1) * w + i - 1], SHEARING);
 			}
 
 			// Bending springs
-			if (i < num_width_points - 2) {
-				springs.emplace_back(pm, &point_masses[j * num_width_points + i + 2], BENDING);
+			if (i < w - 2) {
+				*spring++ = Spring(pm, &point_masses[j * w + i + 2], BENDING);
 			}
-			if (j < num_height_points - 2) {
-				springs.emplace_back(pm, &point_masses[(j + 2) * num_width_points + i], BENDING);
+			if (j < h - 2) {
+				*spring++ = Spring(pm, &point_masses[(j + 2) * w + i], BENDING);
 			}
 		}
 	}
@@ -101,7 +133,8 @@ void Cloth::buildGrid() {
 
 void Cloth::simulate(double frames_per_sec, double simulation_steps, ClothParameters *cp,
                      vector<Vector3D> external_accelerations,
-                     vector<CollisionObject *> *collision_objects) {
+                     vector<CollisionObject *> *collision_objects,
+                     const WindField *wind) {
 	double mass = width * height * cp->density / num_width_points / num_height_points;
 	double delta_t = 1.0f / frames_per_sec / simulation_steps;
 
@@ -112,61 +145,119 @@ void Cloth::simulate(double frames_per_sec, double simulation_steps, ClothParame
 		external_force += external_accelerations[i] * mass;
 	}
 
+	prepare_sleep(cp, external_force, wind != nullptr);
+
 	// Apply outward force to each point mass
-	double inflation_force = 1.0; // Adjust this value to control the inflation strength
+	Vector3D center = Vector3D(width / 2.0, height / 2.0, 0.0) + offset;
+	#pragma omp parallel for schedule(static)
 	for (int i = 0; i < point_masses.size(); i++) {
-		Vector3D normal = point_masses[i].position - Vector3D(width / 2.0, height / 2.0, 0.0);
+		if (block_asleep[i / COLLISION_BLOCK_SIZE]) continue;
+		Vector3D normal = point_masses[i].position - center;
 		normal.normalize();
-		point_masses[i].forces = external_force + normal * inflation_force;
+		point_masses[i].forces = external_force + normal * cp->inflation;
 	}
 
-	// TODO (Part 2): Use Verlet integration to compute new point mass positions
-	for (int i = 0; i < point_masses.size(); i++) {
-		if (point_masses[i].pinned) continue;
-		Vector3D a = point_masses[i].forces / mass;
-		// Verlet integration
-		Vector3D new_position = point_masses[i].position + (1 - cp->damping / 100.0) * (point_masses[i].position - point_masses[i].last_position) + a * delta_t * delta_t;
-		// Update last position
-		point_masses[i].last_position = point_masses[i].position;
-		point_masses[i].position = new_position;
+	if (wind) {
+		aerodynamics.apply(point_masses, clothMesh, *wind, delta_t);
 	}
 
-
+	integrate(cp, mass, delta_t);
 
   // TODO (Part 4): Handle self-collisions.
-	build_spatial_map();
+	// A cloth that is fully asleep has not moved, so its map still holds
+	if (!asleep()) {
+		build_spatial_map();
+	}
 //	for (int i = 0; i < point_masses.size(); i ++) {
 //		self_collide(point_masses[i], simulation_steps);
 //	}
 
 
 	// TODO (Part 3): Handle collisions with other primitives.
-	for (int i = 0; i < point_masses.size(); i ++) {
-		for (CollisionObject *object : *collision_objects) {
-			object -> collide(point_masses[i]);
+	// Each object sees whole particle blocks, so the virtual dispatch and
+	// bounds rejection are paid once per block rather than once per particle.
+	// The broadphase narrows each block down to the colliders near it.
+	if (!collision_objects->empty()) {
+		build_collision_blocks();
+		broadphase.update(*collision_objects);
+		for (size_t b = 0; b < collision_blocks.size(); b++) {
+			PointMassBlock &block = collision_blocks[b];
+			broadphase.for_each_near(block, [&](int idx) {
+				CollisionObject *co = (*collision_objects)[idx];
+				// Colliders standing still cannot disturb a block that settled
+				// against them
+				if (block_asleep[b]) {
+					if (!co->moving()) return;
+					wake_block(b);
+				}
+				co -> collide(block);
+			});
 		}
 	}
 
+	satisfy_constraints(delta_t);
+
+	// Strings take their own substeps and pull back on the particles they hang from
+	Vector3D acceleration = external_force / mass;
+	for (Tether &tether : tethers) {
+		PointMass &attachment = point_masses[tether.vertex];
+		bool fixed = attachment.pinned || block_asleep[tether.vertex / COLLISION_BLOCK_SIZE];
+		tether.simulate(attachment, mass, fixed, delta_t, acceleration, cp->damping,
+		                collision_objects, broadphase);
+	}
+	if (!wind) {
+		update_sleep(delta_t);
+	}
+}
+
+void Cloth::integrate(const ClothParameters *cp, double mass, double delta_t) {
+	// TODO (Part 2): Use Verlet integration to compute new point mass positions
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < point_masses.size(); i++) {
+		if (point_masses[i].pinned || block_asleep[i / COLLISION_BLOCK_SIZE]) continue;
+		Vector3D a = point_masses[i].forces / mass;
+		// Verlet integration
+		Vector3D new_position = point_masses[i].position + (1 - cp->damping / 100.0) * (point_masses[i].position - point_masses[i].last_position) + a * delta_t * delta_t;
+		// Update last position
+		point_masses[i].last_position = point_masses[i].position;
+		point_masses[i].position = new_position;
+	}
+}
+
+void Cloth::satisfy_constraints(double delta_t) {
   // TODO (Part 2): Constrain the changes to be such that the spring does not change
   // in length more than 10% per timestep [Provot 1995].
-	for (int i = 0; i < springs.size(); i ++) {
+	// Sleeping particles hold still like pinned ones, unless a correction
+	// larger than a sleeping block may drift wakes them
+	double wake_length = SLEEP_SPEED * SLEEP_SUBSTEPS * delta_t;
+	PointMass *pms = &point_masses[0];
+	for (int i = 0; i < springs.size() && !asleep(); i ++) {
 		Spring spring = springs[i];
+		size_t block_a = (spring.pm_a - pms) / COLLISION_BLOCK_SIZE;
+		size_t block_b = (spring.pm_b - pms) / COLLISION_BLOCK_SIZE;
+		if (block_asleep[block_a] && block_asleep[block_b]) continue;
 		Vector3D direction = spring.pm_b -> position - spring.pm_a -> position;
 		direction.normalize();
 		double spring_length = (spring.pm_b -> position - spring.pm_a -> position).norm();
 		// Check if over constraint
 		if (spring_length > spring.rest_length * 1.1) {
 			double new_length = spring_length - spring.rest_length * 1.1;
-			// Check if a pinned and b isn't
-			if (spring.pm_a -> pinned && !spring.pm_b -> pinned) {
+			if (new_length > wake_length) {
+				wake_block(block_a);
+				wake_block(block_b);
+			}
+			bool a_fixed = spring.pm_a -> pinned || block_asleep[block_a];
+			bool b_fixed = spring.pm_b -> pinned || block_asleep[block_b];
+			// Check if a fixed and b isn't
+			if (a_fixed && !b_fixed) {
 				spring.pm_b -> position -= direction * new_length;
 			}
-			// a not pinned, b is
-			if (!spring.pm_a -> pinned && spring.pm_b -> pinned) {
+			// a not fixed, b is
+			if (!a_fixed && b_fixed) {
 				spring.pm_a -> position += direction * new_length;
 			}
-			// both not pinned
-			if (!spring.pm_a -> pinned && !spring.pm_b -> pinned) {
+			// both not fixed
+			if (!a_fixed && !b_fixed) {
 				spring.pm_a -> position += direction * (new_length / 2);
 				spring.pm_b -> position -= direction * (new_length / 2);
 			}
@@ -174,6 +265,183 @@ void Cloth::simulate(double frames_per_sec, double simulation_steps, ClothParame
 	}
 }
 
+void Cloth::prepare_sleep(const ClothParameters *cp, const Vector3D &external_force, bool windy) {
+	size_t num_blocks = (point_masses.size() + COLLISION_BLOCK_SIZE - 1) / COLLISION_BLOCK_SIZE;
+	if (block_asleep.size() != num_blocks) {
+		block_asleep.assign(num_blocks, 0);
+		block_calm_substeps.assign(num_blocks, 0);
+		num_asleep = 0;
+		sleep_reference.resize(point_masses.size());
+		for (size_t i = 0; i < point_masses.size(); i++) {
+			sleep_reference[i] = point_masses[i].position;
+		}
+		sleep_parameters = *cp;
+		sleep_external_force = external_force;
+	}
+
+	// Anything that changes the forces wakes the whole cloth
+	const ClothParameters &last = sleep_parameters;
+	bool changed = !(external_force == sleep_external_force) ||
+	               cp->enable_structural_constraints != last.enable_structural_constraints ||
+	               cp->enable_shearing_constraints != last.enable_shearing_constraints ||
+	               cp->enable_bending_constraints != last.enable_bending_constraints ||
+	               cp->damping != last.damping || cp->density != last.density || cp->ks != last.ks ||
+	               cp->inflation != last.inflation;
+	if (changed || (windy && num_asleep > 0)) {
+		wake();
+		sleep_parameters = *cp;
+		sleep_external_force = external_force;
+	}
+	if (num_asleep == 0) return;
+
+	// Sleeping particles have no velocity, so one that moved was pushed by
+	// another cloth or a tether since the last step
+	for (size_t b = 0; b < num_blocks; b++) {
+		if (!block_asleep[b]) continue;
+		size_t end = min(point_masses.size(), (b + 1) * COLLISION_BLOCK_SIZE);
+		for (size_t i = b * COLLISION_BLOCK_SIZE; i < end; i++) {
+			if (!(point_masses[i].position == point_masses[i].last_position)) {
+				wake_block(b);
+				break;
+			}
+		}
+	}
+}
+
+void Cloth::update_sleep(double delta_t) {
+	double limit = SLEEP_SPEED * SLEEP_SUBSTEPS * delta_t;
+
+	for (size_t b = 0; b < block_asleep.size(); b++) {
+		if (block_asleep[b] || ++block_calm_substeps[b] < SLEEP_SUBSTEPS) continue;
+
+		// End of the block's window: asleep if nothing drifted further than
+		// SLEEP_SPEED allows, otherwise start a new window from here
+		size_t begin = b * COLLISION_BLOCK_SIZE;
+		size_t end = min(point_masses.size(), begin + COLLISION_BLOCK_SIZE);
+		bool calm = true;
+		for (size_t i = begin; i < end && calm; i++) {
+			calm = (point_masses[i].position - sleep_reference[i]).norm2() <= limit * limit;
+		}
+		block_calm_substeps[b] = 0;
+		if (!calm) {
+			for (size_t i = begin; i < end; i++) {
+				sleep_reference[i] = point_masses[i].position;
+			}
+			continue;
+		}
+
+		// Settle exactly, so the block restarts at rest when woken
+		for (size_t i = begin; i < end; i++) {
+			point_masses[i].last_position = point_masses[i].position;
+		}
+		block_asleep[b] = 1;
+		num_asleep++;
+	}
+}
+
+void Cloth::wake_block(size_t b) {
+	if (!block_asleep[b]) return;
+	block_asleep[b] = 0;
+	block_calm_substeps[b] = 0;
+	num_asleep--;
+
+	size_t end = min(point_masses.size(), (b + 1) * COLLISION_BLOCK_SIZE);
+	for (size_t i = b * COLLISION_BLOCK_SIZE; i < end; i++) {
+		sleep_reference[i] = point_masses[i].position;
+	}
+}
+
+void Cloth::wake() {
+	block_asleep.assign(block_asleep.size(), 0);
+	block_calm_substeps.assign(block_calm_substeps.size(), 0);
+	num_asleep = 0;
+	for (size_t i = 0; i < sleep_reference.size(); i++) {
+		sleep_reference[i] = point_masses[i].position;
+	}
+}
+
+bool Cloth::asleep() const {
+	return !block_asleep.empty() && num_asleep == block_asleep.size();
+}
+
+void Cloth::build_collision_blocks() {
+	size_t num_blocks = (point_masses.size() + COLLISION_BLOCK_SIZE - 1) / COLLISION_BLOCK_SIZE;
+	collision_blocks.resize(num_blocks);
+
+	for (size_t b = 0; b < num_blocks; b++) {
+		PointMassBlock &block = collision_blocks[b];
+		block.begin = &point_masses[b * COLLISION_BLOCK_SIZE];
+		block.count = min((size_t)COLLISION_BLOCK_SIZE, point_masses.size() - b * COLLISION_BLOCK_SIZE);
+		// A sleeping block has not moved since its bounds were taken
+		if (b < block_asleep.size() && block_asleep[b]) continue;
+		block.min = block.max = block.begin[0].position;
+		for (size_t i = 0; i < block.count; i++) {
+			block.extend(block.begin[i].position);
+			block.extend(block.begin[i].last_position);
+		}
+	}
+}
+
+void Cloth::track_changes() {
+	size_t num_particles = point_masses.size();
+	size_t num_blocks = (num_particles + COLLISION_BLOCK_SIZE - 1) / COLLISION_BLOCK_SIZE;
+	bool rebuilt = tracked_positions.size() != num_particles;
+	if (rebuilt) {
+		tracked_positions.resize(num_particles);
+		block_revisions.assign(num_blocks, 0);
+		block_min.resize(num_blocks);
+		block_max.resize(num_blocks);
+	}
+
+	bool changed = false;
+	for (size_t b = 0; b < num_blocks; b++) {
+		size_t begin = b * COLLISION_BLOCK_SIZE;
+		size_t end = min(num_particles, begin + COLLISION_BLOCK_SIZE);
+
+		bool moved = rebuilt;
+		for (size_t i = begin; i < end && !moved; i++) {
+			moved = (point_masses[i].position - tracked_positions[i]).norm2() > CHANGE_EPSILON * CHANGE_EPSILON;
+		}
+		if (!moved) continue;
+
+		if (!changed) {
+			revision++;
+			changed = true;
+		}
+		block_revisions[b] = revision;
+
+		block_min[b] = block_max[b] = point_masses[begin].position;
+		for (size_t i = begin; i < end; i++) {
+			const Vector3D &p = point_masses[i].position;
+			tracked_positions[i] = p;
+			block_min[b] = Vector3D(std::min(block_min[b].x, p.x), std::min(block_min[b].y, p.y), std::min(block_min[b].z, p.z));
+			block_max[b] = Vector3D(std::max(block_max[b].x, p.x), std::max(block_max[b].y, p.y), std::max(block_max[b].z, p.z));
+		}
+	}
+
+	if (!changed || num_blocks == 0) return;
+	tracked_min = block_min[0];
+	tracked_max = block_max[0];
+	for (size_t b = 1; b < num_blocks; b++) {
+		tracked_min = Vector3D(std::min(tracked_min.x, block_min[b].x), std::min(tracked_min.y, block_min[b].y), std::min(tracked_min.z, block_min[b].z));
+		tracked_max = Vector3D(std::max(tracked_max.x, block_max[b].x), std::max(tracked_max.y, block_max[b].y), std::max(tracked_max.z, block_max[b].z));
+	}
+}
+
+uint64_t Cloth::state_hash(uint64_t h) const {
+	for (const PointMass &pm : point_masses) {
+		h = Misc::fnv1a(&pm.position, sizeof(Vector3D), h);
+		h = Misc::fnv1a(&pm.last_position, sizeof(Vector3D), h);
+	}
+	for (const Tether &tether : tethers) {
+		for (const PointMass &pm : tether.particles) {
+			h = Misc::fnv1a(&pm.position, sizeof(Vector3D), h);
+			h = Misc::fnv1a(&pm.last_position, sizeof(Vector3D), h);
+		}
+	}
+	return h;
+}
+
 void Cloth::build_spatial_map() {
   for (const auto &entry : map) {
     delete(entry.second);
@@ -246,6 +514,25 @@ void Cloth::reset() {
     pm->last_position = pm->start_position;
     pm++;
   }
+
+  for (Tether &tether : tethers) {
+    tether.reset();
+  }
+  aerodynamics.reset();
+  wake();
+  track_changes();
+}
+
+bool Cloth::bounds(Vector3D &min, Vector3D &max) const {
+  if (point_masses.empty()) return false;
+
+  min = max = point_masses[0].position;
+  for (const PointMass &pm : point_masses) {
+    const Vector3D &p = pm.position;
+    min = Vector3D(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+    max = Vector3D(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+  }
+  return true;
 }
 
 void Cloth::buildClothMesh() {
@@ -397,5 +684,6 @@ void Cloth::buildClothMesh() {
   }
 
   clothMesh->triangles = triangles;
+  delete this->clothMesh;
   this->clothMesh = clothMesh;
 }
@@ -1,23 +1,37 @@
 #ifndef CLOTH_H
 #define CLOTH_H
 
+#include <cstdint>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
 
 #include "CGL/CGL.h"
 #include "CGL/misc.h"
+#include "aerodynamics.h"
 #include "clothMesh.h"
+#include "collision/broadphase.h"
 #include "collision/collisionObject.h"
 #include "spring.h"
+#include "tether.h"
 
 using namespace CGL;
 using namespace std;
 
+// Smallest particle motion, in meters, that invalidates derived data
+#define CHANGE_EPSILON 1e-6
+
+// A block falls asleep once none of its particles has drifted faster than
+// SLEEP_SPEED (m/s) on average over SLEEP_SUBSTEPS substeps. Net drift is
+// measured rather than per-substep speed, which never settles for particles
+// resting against a collider.
+#define SLEEP_SPEED 2e-2
+#define SLEEP_SUBSTEPS 90
+
 enum e_orientation { HORIZONTAL = 0, VERTICAL = 1 };
 
 struct ClothParameters {
-  ClothParameters() {}
+  ClothParameters() : inflation(1.0) {}
   ClothParameters(bool enable_structural_constraints,
                   bool enable_shearing_constraints,
                   bool enable_bending_constraints, double damping,
@@ -25,7 +39,7 @@ struct ClothParameters {
       : enable_structural_constraints(enable_structural_constraints),
         enable_shearing_constraints(enable_shearing_constraints),
         enable_bending_constraints(enable_bending_constraints),
-        damping(damping), density(density), ks(ks) {}
+        damping(damping), density(density), ks(ks), inflation(1.0) {}
   ~ClothParameters() {}
 
   // Global simulation parameters
@@ -39,10 +53,13 @@ struct ClothParameters {
   // Mass-spring parameters
   double density;
   double ks;
+
+  // Outward force on every particle that keeps the balloon inflated (N)
+  double inflation;
 };
 
 struct Cloth {
-  Cloth() {}
+  Cloth() : clothMesh(nullptr), revision(0), num_asleep(0) {}
   Cloth(double width, double height, int num_width_points,
         int num_height_points, float thickness);
   ~Cloth();
@@ -51,11 +68,35 @@ struct Cloth {
 
   void simulate(double frames_per_sec, double simulation_steps, ClothParameters *cp,
                 vector<Vector3D> external_accelerations,
-                vector<CollisionObject *> *collision_objects);
+                vector<CollisionObject *> *collision_objects,
+                const WindField *wind = nullptr);
+
+  // Phases of simulate(), public so they can be benchmarked on their own.
+  // Both expect a cloth that has taken at least one step.
+  void integrate(const ClothParameters *cp, double mass, double delta_t);
+  void satisfy_constraints(double delta_t);
 
   void reset();
   void buildClothMesh();
 
+  // Bounds of the current particle positions; false if there are none
+  bool bounds(Vector3D &min, Vector3D &max) const;
+
+  void build_collision_blocks();
+
+  // Wakes every sleeping block
+  void wake();
+  // True when every block is asleep
+  bool asleep() const;
+
+  // Bumps the revision of every particle block that moved since it last
+  // changed, and refreshes the tracked bounds
+  void track_changes();
+
+  // Hash of the exact bits of every particle's position, the balloon's
+  // and its strings', continued from a previous hash
+  uint64_t state_hash(uint64_t h) const;
+
   void build_spatial_map();
   void self_collide(PointMass &pm, double simulation_steps);
   float hash_position(Vector3D pos);
@@ -67,15 +108,69 @@ struct Cloth {
   int num_height_points;
   double thickness;
   e_orientation orientation;
+  // Translation of the balloon from its default placement
+  Vector3D offset;
+  // Particle positions to start from, row by row, instead of the default
+  // placement; empty for the default
+  vector<Vector3D> initial_positions;
 
   // Cloth components
   vector<PointMass> point_masses;
-  vector<vector<int>> pinned;
+  // Whether each particle, row by row, is pinned; empty if none is
+  vector<bool> pinned;
   vector<Spring> springs;
   ClothMesh *clothMesh;
 
+  // Particle blocks handed to the batched collision kernels
+  vector<PointMassBlock> collision_blocks;
+  Broadphase broadphase;
+
+  // Air drag and lift, when the scene has wind
+  Aerodynamics aerodynamics;
+
+  // Strings hanging from the balloon
+  vector<Tether> tethers;
+
+  // Change tracking for derived data such as render buffers. Particles are
+  // grouped into the same blocks as for collisions; a block's revision is
+  // bumped when any of its particles has moved more than CHANGE_EPSILON
+  // since the block last changed, so consumers can refresh only the blocks
+  // whose revision they have not seen. Nothing is bumped while the cloth is
+  // still.
+  unsigned int revision;
+  vector<unsigned int> block_revisions;
+  // Bounds of the particles as of the last track_changes()
+  Vector3D tracked_min;
+  Vector3D tracked_max;
+
   // Spatial hashing
   unordered_map<float, vector<PointMass *> *> map;
+
+private:
+  void prepare_sleep(const ClothParameters *cp, const Vector3D &external_force, bool windy);
+  void update_sleep(double delta_t);
+  void wake_block(size_t b);
+
+  // Sleeping. Blocks that settled as described at SLEEP_SPEED are not
+  // integrated, constrained or collided until something wakes them: a
+  // violated spring reaching into the block, another cloth moving one of its
+  // particles, a moving collider overlapping it, or any change in parameters
+  // or external forces. Strings hang from a sleeping particle as from a
+  // pinned one and do not wake it. Nothing sleeps in wind, whose gusts keep
+  // changing the forces.
+  vector<unsigned char> block_asleep;
+  vector<int> block_calm_substeps;
+  size_t num_asleep;
+  // Particle positions at the start of each awake block's current window
+  vector<Vector3D> sleep_reference;
+  // Parameters and external force the sleeping blocks settled under
+  ClothParameters sleep_parameters;
+  Vector3D sleep_external_force;
+
+  // Particle positions and block bounds when each block last changed
+  vector<Vector3D> tracked_positions;
+  vector<Vector3D> block_min;
+  vector<Vector3D> block_max;
 };
 
 #endif /* CLOTH_H */
@@ -0,0 +1,317 @@
+#include "clothBatch.h"
+
+// Layout of one vertex in the static buffer: uv, tangent
+#define STATIC_UV_OFFSET 0
+#define STATIC_TANGENT_OFFSET 2
+#define STATIC_VERTEX_SIZE 6
+
+// Layout of one vertex in the streamed buffer: position, normal
+#define DYNAMIC_POSITION_OFFSET 0
+#define DYNAMIC_NORMAL_OFFSET 4
+#define DYNAMIC_VERTEX_SIZE 8
+
+// Most levels of detail per cloth, the finest being the full grid
+#define CLOTH_LOD_LEVELS 4
+
+ClothBatch::~ClothBatch() {
+  for (auto &entry : vertex_arrays) {
+    glDeleteVertexArrays(1, &entry.second);
+  }
+  if (static_buffer) glDeleteBuffers(1, &static_buffer);
+  if (index_buffer) glDeleteBuffers(1, &index_buffer);
+  if (dynamic_buffer) glDeleteBuffers(1, &dynamic_buffer);
+}
+
+void ClothBatch::add_grid_indices(const Cloth *cloth, unsigned int base, int stride,
+                                  vector<unsigned int> &indices) {
+  int w = cloth->num_width_points;
+  int h = cloth->num_height_points;
+
+  // Same triangulation as Cloth::buildClothMesh, over every stride-th row and
+  // column; the last cell in each direction is clipped to the grid edge
+  for (int y = 0; y < h - 1; y += stride) {
+    for (int x = 0; x < w - 1; x += stride) {
+      int x1 = min(x + stride, w - 1);
+      int y1 = min(y + stride, h - 1);
+
+      unsigned int a = base + y * w + x;
+      unsigned int b = base + y * w + x1;
+      unsigned int c = base + y1 * w + x;
+      unsigned int d = base + y1 * w + x1;
+
+      indices.push_back(a);
+      indices.push_back(c);
+      indices.push_back(b);
+      indices.push_back(b);
+      indices.push_back(c);
+      indices.push_back(d);
+    }
+  }
+}
+
+void ClothBatch::upload_topology(const vector<Cloth *> &cloths) {
+  vector<float> static_data;
+  vector<unsigned int> indices;
+  unsigned int base = 0;
+
+  lods.assign(cloths.size(), vector<Range>());
+  spring_ranges.assign(cloths.size(), vector<Range>());
+  vertex_bases.clear();
+  seen_revisions.assign(cloths.size(), vector<unsigned int>());
+
+  for (size_t c = 0; c < cloths.size(); c++) {
+    Cloth *cloth = cloths[c];
+    size_t num_vertices = cloth->point_masses.size();
+    size_t first = static_data.size();
+    vertex_bases.push_back(base);
+    static_data.resize(first + STATIC_VERTEX_SIZE * num_vertices, 0.0f);
+
+    if (num_vertices == 0 || !cloth->clothMesh) continue;
+    PointMass *pms = &cloth->point_masses[0];
+
+    // Grid uvs agree between every triangle sharing a vertex
+    for (Triangle *tri : cloth->clothMesh->triangles) {
+      PointMass *corners[3] = {tri->pm1, tri->pm2, tri->pm3};
+      const Vector3D *uvs[3] = {&tri->uv1, &tri->uv2, &tri->uv3};
+
+      for (int k = 0; k < 3; k++) {
+        float *sPtr = &static_data[first + STATIC_VERTEX_SIZE * (corners[k] - pms)];
+        sPtr[STATIC_UV_OFFSET + 0] = uvs[k]->x;
+        sPtr[STATIC_UV_OFFSET + 1] = uvs[k]->y;
+        sPtr[STATIC_TANGENT_OFFSET + 0] = 1.0;
+        sPtr[STATIC_TANGENT_OFFSET + 1] = 0.0;
+        sPtr[STATIC_TANGENT_OFFSET + 2] = 0.0;
+        sPtr[STATIC_TANGENT_OFFSET + 3] = 1.0;
+      }
+    }
+
+    // Coarser levels until a cell would span the whole grid
+    int cells = max(cloth->num_width_points, cloth->num_height_points) - 1;
+    for (int level = 0, stride = 1; level < CLOTH_LOD_LEVELS && (level == 0 || stride < cells);
+         level++, stride *= 2) {
+      Range range;
+      range.first = indices.size();
+      add_grid_indices(cloth, base, stride, indices);
+      range.count = indices.size() - range.first;
+      lods[c].push_back(range);
+    }
+
+    // Springs of each type as lines, for the wireframe
+    for (int type = STRUCTURAL; type <= BENDING; type++) {
+      Range range;
+      range.first = indices.size();
+      for (const Spring &spring : cloth->springs) {
+        if (spring.spring_type != type) continue;
+        indices.push_back(base + (spring.pm_a - pms));
+        indices.push_back(base + (spring.pm_b - pms));
+      }
+      range.count = indices.size() - range.first;
+      spring_ranges[c].push_back(range);
+    }
+    base += num_vertices;
+  }
+
+  if (!static_buffer) {
+    glGenBuffers(1, &static_buffer);
+    glGenBuffers(1, &index_buffer);
+    glGenBuffers(1, &dynamic_buffer);
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, static_buffer);
+  glBufferData(GL_ARRAY_BUFFER, static_data.size() * sizeof(float), static_data.data(), GL_STATIC_DRAW);
+
+  // The element buffer binding belongs to whichever vertex array is bound,
+  // so fill the index buffer through a target that is not
+  glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+
+  num_indices = indices.size();
+  vertex_data.resize(DYNAMIC_VERTEX_SIZE * base);
+
+  // Filled block by block as cloths come into view
+  glBindBuffer(GL_ARRAY_BUFFER, dynamic_buffer);
+  glBufferData(GL_ARRAY_BUFFER, vertex_data.size() * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+}
+
+GLuint ClothBatch::vertex_array(GLShader &shader) {
+  GLint program;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+
+  GLuint &vao = vertex_arrays[program];
+  if (vao) return vao;
+
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+
+  struct { const char *name; GLuint buffer; int size; int stride; int offset; } attribs[] = {
+    {"in_position", dynamic_buffer, 4, DYNAMIC_VERTEX_SIZE, DYNAMIC_POSITION_OFFSET},
+    {"in_normal", dynamic_buffer, 4, DYNAMIC_VERTEX_SIZE, DYNAMIC_NORMAL_OFFSET},
+    {"in_uv", static_buffer, 2, STATIC_VERTEX_SIZE, STATIC_UV_OFFSET},
+    {"in_tangent", static_buffer, 4, STATIC_VERTEX_SIZE, STATIC_TANGENT_OFFSET},
+  };
+
+  for (const auto &attrib : attribs) {
+    GLint id = shader.attrib(attrib.name, false);
+    if (id == -1) continue;
+    glBindBuffer(GL_ARRAY_BUFFER, attrib.buffer);
+    glEnableVertexAttribArray(id);
+    glVertexAttribPointer(id, attrib.size, GL_FLOAT, GL_FALSE, attrib.stride * sizeof(float),
+                          (const void *)(attrib.offset * sizeof(float)));
+  }
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+  return vao;
+}
+
+void ClothBatch::release_program(GLuint program) {
+  auto entry = vertex_arrays.find(program);
+  if (entry == vertex_arrays.end()) return;
+  glDeleteVertexArrays(1, &entry->second);
+  vertex_arrays.erase(entry);
+}
+
+void ClothBatch::refresh_range(size_t c, int first, int last) {
+  Cloth *cloth = batched[c];
+  float *data = vertex_data.data() + DYNAMIC_VERTEX_SIZE * vertex_bases[c];
+
+  #pragma omp parallel for schedule(static)
+  for (int i = first; i < last; i++) {
+    PointMass &pm = cloth->point_masses[i];
+    Vector3D n = pm.normal();
+    float *dPtr = &data[DYNAMIC_VERTEX_SIZE * i];
+
+    dPtr[DYNAMIC_POSITION_OFFSET + 0] = pm.position.x;
+    dPtr[DYNAMIC_POSITION_OFFSET + 1] = pm.position.y;
+    dPtr[DYNAMIC_POSITION_OFFSET + 2] = pm.position.z;
+    dPtr[DYNAMIC_POSITION_OFFSET + 3] = 1.0;
+    dPtr[DYNAMIC_NORMAL_OFFSET + 0] = n.x;
+    dPtr[DYNAMIC_NORMAL_OFFSET + 1] = n.y;
+    dPtr[DYNAMIC_NORMAL_OFFSET + 2] = n.z;
+    dPtr[DYNAMIC_NORMAL_OFFSET + 3] = 0.0;
+  }
+
+  size_t offset = DYNAMIC_VERTEX_SIZE * (vertex_bases[c] + first);
+  glBindBuffer(GL_ARRAY_BUFFER, dynamic_buffer);
+  glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(float), DYNAMIC_VERTEX_SIZE * (last - first) * sizeof(float),
+                  vertex_data.data() + offset);
+}
+
+void ClothBatch::refresh_vertices(size_t c) {
+  Cloth *cloth = batched[c];
+  const vector<unsigned int> &revisions = cloth->block_revisions;
+  vector<unsigned int> &seen = seen_revisions[c];
+  if (seen.size() != revisions.size()) {
+    // Revisions start at 1, so every block is refreshed
+    seen.assign(revisions.size(), 0);
+  }
+
+  // A vertex normal depends on its neighbours up to one grid row away, so a
+  // changed block also refreshes a row on either side. Overlapping ranges
+  // are merged into one upload.
+  int num_vertices = cloth->point_masses.size();
+  int margin = cloth->num_width_points + 1;
+  int first = -1, last = -1;
+  for (size_t b = 0; b < revisions.size(); b++) {
+    if (revisions[b] == seen[b]) continue;
+    seen[b] = revisions[b];
+
+    int begin = max(0, (int)(b * COLLISION_BLOCK_SIZE) - margin);
+    int end = min(num_vertices, (int)((b + 1) * COLLISION_BLOCK_SIZE) + margin);
+    if (first >= 0 && begin <= last) {
+      last = max(last, end);
+      continue;
+    }
+    if (first >= 0) refresh_range(c, first, last);
+    first = begin;
+    last = end;
+  }
+  if (first >= 0) refresh_range(c, first, last);
+}
+
+bool ClothBatch::update(const vector<Cloth *> &cloths, const CGL::Misc::Frustum &frustum) {
+  bool changed = cloths != batched || !static_buffer;
+  for (size_t i = 0; !changed && i < cloths.size(); i++) {
+    changed = cloths[i]->point_masses.size() != batched_sizes[i];
+  }
+  if (changed) {
+    batched = cloths;
+    batched_sizes.clear();
+    for (Cloth *cloth : cloths) {
+      batched_sizes.push_back(cloth->point_masses.size());
+    }
+    upload_topology(cloths);
+  }
+  if (num_indices == 0) return false;
+
+  visible.clear();
+  for (size_t c = 0; c < cloths.size(); c++) {
+    Cloth *cloth = cloths[c];
+    if (lods[c].empty() || cloth->block_revisions.empty()) continue;
+    if (!frustum.visible(cloth->tracked_min, cloth->tracked_max)) continue;
+    visible.push_back(c);
+    refresh_vertices(c);
+  }
+  return !visible.empty();
+}
+
+void ClothBatch::draw(GLShader &shader, const vector<Cloth *> &cloths,
+                      const CGL::Misc::Frustum &frustum) {
+  if (!update(cloths, frustum)) return;
+
+  draw_counts.clear();
+  draw_offsets.clear();
+
+  for (size_t c : visible) {
+    Cloth *cloth = cloths[c];
+    const Vector3D &min = cloth->tracked_min, &max = cloth->tracked_max;
+
+    // Pick the coarsest level whose cells stay under the target size. Cell
+    // size is estimated from the bounds, which overestimates it for flat
+    // cloths and so errs toward detail.
+    Vector3D center = (min + max) / 2;
+    double radius = (max - min).norm() / 2;
+    int cells = std::max(1, std::min(cloth->num_width_points, cloth->num_height_points) - 1);
+    double cell_pixels = frustum.pixels(2 * radius / cells, center, radius);
+    size_t level = 0;
+    while (level + 1 < lods[c].size() && cell_pixels * (2 << level) <= LOD_TARGET_PIXELS) {
+      level++;
+    }
+    draw_counts.push_back(lods[c][level].count);
+    draw_offsets.push_back((const void *)(lods[c][level].first * sizeof(unsigned int)));
+  }
+
+  glBindVertexArray(vertex_array(shader));
+  glMultiDrawElements(GL_TRIANGLES, draw_counts.data(), GL_UNSIGNED_INT, draw_offsets.data(),
+                      draw_counts.size());
+
+  // Restore the shader's own vertex array for the draws that follow
+  shader.bind();
+}
+
+void ClothBatch::draw_springs(GLShader &shader, const vector<Cloth *> &cloths,
+                              const ClothParameters &cp, const CGL::Misc::Frustum &frustum) {
+  if (!update(cloths, frustum)) return;
+
+  bool enabled[3];
+  enabled[STRUCTURAL] = cp.enable_structural_constraints;
+  enabled[SHEARING] = cp.enable_shearing_constraints;
+  enabled[BENDING] = cp.enable_bending_constraints;
+
+  draw_counts.clear();
+  draw_offsets.clear();
+
+  for (size_t c : visible) {
+    for (int type = STRUCTURAL; type <= BENDING; type++) {
+      const Range &range = spring_ranges[c][type];
+      if (!enabled[type] || range.count == 0) continue;
+      draw_counts.push_back(range.count);
+      draw_offsets.push_back((const void *)(range.first * sizeof(unsigned int)));
+    }
+  }
+  if (draw_counts.empty()) return;
+
+  glBindVertexArray(vertex_array(shader));
+  glMultiDrawElements(GL_LINES, draw_counts.data(), GL_UNSIGNED_INT, draw_offsets.data(),
+                      draw_counts.size());
+  shader.bind();
+}
@@ -0,0 +1,95 @@
+#ifndef CLOTH_BATCH_H
+#define CLOTH_BATCH_H
+
+#include <map>
+#include <vector>
+
+#include <nanogui/nanogui.h>
+
+#include "cloth.h"
+#include "misc/frustum.h"
+
+using namespace nanogui;
+using namespace std;
+
+/**
+ * Draws the triangles, or the springs, of every cloth in the scene with one
+ * indexed draw call.
+ *
+ * Balloons never change topology, so their indices, uvs and tangents are
+ * uploaded once into static buffers and reused until the set of cloths
+ * changes. Per-vertex positions and normals are kept in one dynamic buffer,
+ * and only the particle blocks whose Cloth::block_revisions changed since
+ * they were last drawn are recomputed and re-uploaded, along with the
+ * neighbouring row whose normals they affect. A still scene uploads nothing.
+ *
+ * Cloths outside the view frustum are skipped entirely. The rest are drawn
+ * from one of several index buffers over the same vertices, each skipping
+ * twice as many grid rows and columns as the last, picked so that grid cells
+ * stay about LOD_TARGET_PIXELS across on screen.
+ */
+class ClothBatch {
+public:
+  ClothBatch() : static_buffer(0), index_buffer(0), dynamic_buffer(0), num_indices(0) {}
+  ~ClothBatch();
+
+  void draw(GLShader &shader, const vector<Cloth *> &cloths,
+            const CGL::Misc::Frustum &frustum = CGL::Misc::Frustum());
+
+  // Springs of the kinds enabled in cp, as lines
+  void draw_springs(GLShader &shader, const vector<Cloth *> &cloths, const ClothParameters &cp,
+                    const CGL::Misc::Frustum &frustum = CGL::Misc::Frustum());
+
+  // Drops the vertex array object of a program about to be deleted, whose
+  // name the driver may hand out again
+  void release_program(GLuint program);
+
+private:
+  // Culls the cloths and brings the visible ones' vertices up to date;
+  // false if none is visible
+  bool update(const vector<Cloth *> &cloths, const CGL::Misc::Frustum &frustum);
+  void refresh_vertices(size_t c);
+  void refresh_range(size_t c, int first, int last);
+  void upload_topology(const vector<Cloth *> &cloths);
+  void add_grid_indices(const Cloth *cloth, unsigned int base, int stride, vector<unsigned int> &indices);
+  GLuint vertex_array(GLShader &shader);
+
+  // Cloths, and their sizes, the static buffers were built for
+  vector<Cloth *> batched;
+  vector<size_t> batched_sizes;
+
+  GLuint static_buffer;
+  GLuint index_buffer;
+  GLuint dynamic_buffer;
+  int num_indices;
+
+  // Index range of each level of detail, per cloth
+  struct Range {
+    int first;
+    int count;
+  };
+  vector<vector<Range> > lods;
+  // Index range of each spring type, per cloth
+  vector<vector<Range> > spring_ranges;
+
+  // First vertex of each cloth, and the block revisions its vertices were
+  // last computed from
+  vector<size_t> vertex_bases;
+  vector<vector<unsigned int> > seen_revisions;
+
+  // Cloths in view this frame
+  vector<size_t> visible;
+
+  // Ranges drawn this frame
+  vector<GLsizei> draw_counts;
+  vector<const void *> draw_offsets;
+
+  // Positions and normals of every vertex
+  vector<float> vertex_data;
+
+  // Attribute locations differ between programs, so each program that draws
+  // the batch gets its own vertex array object
+  map<GLint, GLuint> vertex_arrays;
+};
+
+#endif /* CLOTH_BATCH_H */
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cmath>
+
+#include "clothContact.h"
+
+using namespace std;
+using namespace CGL;
+
+void ClothContact::collide(vector<Cloth *> &cloths, double simulation_steps) {
+  int num_cloths = cloths.size();
+  if (num_cloths < 2) return;
+
+  // Bounds of each cloth, grown by its thickness
+  vector<Vector3D> lo(num_cloths), hi(num_cloths);
+  for (int c = 0; c < num_cloths; c++) {
+    if (!cloths[c]->bounds(lo[c], hi[c])) continue;
+    double t = cloths[c]->thickness;
+    lo[c] -= Vector3D(t, t, t);
+    hi[c] += Vector3D(t, t, t);
+  }
+
+  // Only cloths within contact range of another cloth need the grid
+  vector<char> active(num_cloths, 0);
+  for (int a = 0; a < num_cloths; a++) {
+    for (int b = a + 1; b < num_cloths; b++) {
+      // Two sleeping cloths settled against each other already
+      if (cloths[a]->asleep() && cloths[b]->asleep()) continue;
+      if (lo[a].x > hi[b].x || lo[a].y > hi[b].y || lo[a].z > hi[b].z ||
+          hi[a].x < lo[b].x || hi[a].y < lo[b].y || hi[a].z < lo[b].z) {
+        continue;
+      }
+      active[a] = active[b] = 1;
+    }
+  }
+
+  particles.clear();
+  owners.clear();
+  radii.clear();
+  double max_thickness = 0;
+  for (int c = 0; c < num_cloths; c++) {
+    if (!active[c]) continue;
+    for (PointMass &pm : cloths[c]->point_masses) {
+      particles.push_back(&pm);
+      owners.push_back(c);
+      radii.push_back(cloths[c]->thickness);
+    }
+    max_thickness = max(max_thickness, cloths[c]->thickness);
+  }
+  if (particles.empty() || max_thickness <= 0) return;
+
+  build_grid(2 * max_thickness);
+
+  int num_particles = particles.size();
+  corrections.resize(num_particles);
+
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < num_particles; i++) {
+    const Vector3D &p = particles[i]->position;
+    int cx = (int)floor(p.x / cell_size);
+    int cy = (int)floor(p.y / cell_size);
+    int cz = (int)floor(p.z / cell_size);
+
+    int num_collisions = 0;
+    Vector3D correction_vector(0, 0, 0);
+
+    // Distinct neighboring cells can share a hash bucket; visit each once
+    unsigned int visited[27];
+    int num_visited = 0;
+
+    for (int dz = -1; dz <= 1; dz++) {
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          unsigned int h = cell_hash(cx + dx, cy + dy, cz + dz);
+          if (find(visited, visited + num_visited, h) != visited + num_visited) continue;
+          visited[num_visited++] = h;
+
+          for (int k = cell_start[h]; k < cell_start[h + 1]; k++) {
+            int j = sorted[k];
+            if (owners[j] == owners[i]) continue;
+
+            Vector3D direction = p - particles[j]->position;
+            double distance = direction.norm();
+            double contact = radii[i] + radii[j];
+            if (distance < contact && distance > 0) {
+              correction_vector += direction / distance * (contact - distance);
+              num_collisions++;
+            }
+          }
+        }
+      }
+    }
+
+    if (num_collisions) {
+      corrections[i] = correction_vector / (double)num_collisions / simulation_steps;
+    } else {
+      corrections[i] = Vector3D(0, 0, 0);
+    }
+  }
+
+  for (int i = 0; i < num_particles; i++) {
+    if (particles[i]->pinned) continue;
+    particles[i]->position += corrections[i];
+  }
+}
+
+unsigned int ClothContact::cell_hash(int x, int y, int z) const {
+  return ((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^
+          (unsigned int)z * 83492791u) & table_mask;
+}
+
+void ClothContact::build_grid(double cell_size) {
+  this->cell_size = cell_size;
+
+  int num_particles = particles.size();
+  unsigned int table_size = 1;
+  while (table_size < 2 * (unsigned int)num_particles) table_size <<= 1;
+  table_mask = table_size - 1;
+
+  cell_of.resize(num_particles);
+  cell_start.assign(table_size + 1, 0);
+  for (int i = 0; i < num_particles; i++) {
+    const Vector3D &p = particles[i]->position;
+    cell_of[i] = cell_hash((int)floor(p.x / cell_size), (int)floor(p.y / cell_size),
+                           (int)floor(p.z / cell_size));
+    cell_start[cell_of[i] + 1]++;
+  }
+
+  for (unsigned int h = 0; h < table_size; h++) {
+    cell_start[h + 1] += cell_start[h];
+  }
+
+  // Stable fill keeps each bucket in particle order
+  sorted.resize(num_particles);
+  vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+  for (int i = 0; i < num_particles; i++) {
+    sorted[fill[cell_of[i]]++] = i;
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef CLOTH_CONTACT_H
+#define CLOTH_CONTACT_H
+
+#include <vector>
+
+#include "CGL/CGL.h"
+#include "cloth.h"
+
+using namespace CGL;
+using namespace std;
+
+/**
+ * Contact between different cloths (balloons) in the same scene.
+ *
+ * Every substep, the particles of all cloths whose bounds come within contact
+ * range of another cloth are binned into one shared spatial hash grid. Any
+ * pair from different cloths closer than the sum of their thicknesses is
+ * pushed apart, with the same averaged correction as Cloth::self_collide.
+ * Corrections are gathered before any are applied, so the result does not
+ * depend on cloth or particle order.
+ */
+class ClothContact {
+public:
+  void collide(vector<Cloth *> &cloths, double simulation_steps);
+
+private:
+  void build_grid(double cell_size);
+  unsigned int cell_hash(int x, int y, int z) const;
+
+  // Flattened particles taking part in this substep
+  vector<PointMass *> particles;
+  vector<int> owners;
+  vector<double> radii;
+  vector<Vector3D> corrections;
+
+  // Counting-sorted hash grid: particles of cell c are
+  // sorted[cell_start[c] .. cell_start[c + 1])
+  double cell_size;
+  unsigned int table_mask;
+  vector<unsigned int> cell_of;
+  vector<int> cell_start;
+  vector<int> sorted;
+};
+
+#endif /* CLOTH_CONTACT_H */
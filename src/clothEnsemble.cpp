@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cmath>
+
+#include "clothEnsemble.h"
+
+ClothEnsemble::ClothEnsemble(const Cloth &cloth)
+    : sim_time(0), num_members(0), num_groups(0) {
+  num_particles = cloth.point_masses.size();
+  area = cloth.width * cloth.height;
+  num_width_points = cloth.num_width_points;
+  num_height_points = cloth.num_height_points;
+  center = Vector3D(cloth.width / 2.0, cloth.height / 2.0, 0.0) + cloth.offset;
+
+  const PointMass *base = num_particles ? &cloth.point_masses[0] : nullptr;
+  for (const PointMass &pm : cloth.point_masses) {
+    start_positions.push_back(pm.start_position);
+    pinned.push_back(pm.pinned);
+  }
+  for (const Spring &s : cloth.springs) {
+    EnsembleSpring spring;
+    spring.a = s.pm_a - base;
+    spring.b = s.pm_b - base;
+    spring.rest_length = s.rest_length;
+    springs.push_back(spring);
+  }
+
+  block_particles.assign(COLLISION_BLOCK_SIZE, PointMass(Vector3D(), false));
+}
+
+bool ClothEnsemble::supports(const vector<Cloth *> &cloths, const WindField *wind) {
+  return cloths.size() == 1 && cloths[0]->tethers.empty() && !wind;
+}
+
+void ClothEnsemble::reset(const vector<ClothParameters> &members) {
+  sim_time = 0;
+  num_members = members.size();
+  num_groups = (num_members + ENSEMBLE_LANES - 1) / ENSEMBLE_LANES;
+
+  parameters.resize(num_groups);
+  for (size_t g = 0; g < num_groups; g++) {
+    for (size_t l = 0; l < ENSEMBLE_LANES; l++) {
+      const ClothParameters &cp = members[min(g * ENSEMBLE_LANES + l, num_members - 1)];
+      // As in Cloth::simulate
+      parameters[g].mass[l] = area * cp.density / num_width_points / num_height_points;
+      parameters[g].damping[l] = cp.damping;
+      parameters[g].inflation[l] = cp.inflation;
+    }
+  }
+
+  positions.resize(num_groups * num_particles);
+  for (size_t g = 0; g < num_groups; g++) {
+    for (size_t i = 0; i < num_particles; i++) {
+      Lanes &p = positions[g * num_particles + i];
+      for (size_t l = 0; l < ENSEMBLE_LANES; l++) {
+        p.x[l] = start_positions[i].x;
+        p.y[l] = start_positions[i].y;
+        p.z[l] = start_positions[i].z;
+      }
+    }
+  }
+  last_positions = positions;
+}
+
+void ClothEnsemble::step(int frames_per_sec, int simulation_steps, const Vector3D &gravity,
+                         const vector<CollisionObject *> &objects) {
+  // Cloth::simulate divides in double precision
+  double delta_t = 1.0f / (double)frames_per_sec / (double)simulation_steps;
+
+  for (int s = 0; s < simulation_steps; s++) {
+    sim_time += 1.0 / frames_per_sec / simulation_steps;
+    for (CollisionObject *co : objects) {
+      co->advance(sim_time);
+    }
+    if (!objects.empty()) {
+      broadphase.update(objects);
+    }
+
+    for (size_t g = 0; g < num_groups; g++) {
+      integrate(g, gravity, delta_t);
+      if (!objects.empty()) {
+        collide(g, objects);
+      }
+      satisfy_constraints(g);
+    }
+  }
+}
+
+void ClothEnsemble::integrate(size_t group, const Vector3D &gravity, double delta_t) {
+  const GroupParameters &p = parameters[group];
+  double external_x[ENSEMBLE_LANES], external_y[ENSEMBLE_LANES], external_z[ENSEMBLE_LANES];
+  double keep[ENSEMBLE_LANES], inverse_mass[ENSEMBLE_LANES];
+  for (size_t l = 0; l < ENSEMBLE_LANES; l++) {
+    external_x[l] = gravity.x * p.mass[l];
+    external_y[l] = gravity.y * p.mass[l];
+    external_z[l] = gravity.z * p.mass[l];
+    keep[l] = 1 - p.damping[l] / 100.0;
+    inverse_mass[l] = 1.0 / p.mass[l];
+  }
+
+  Lanes *pos = &positions[group * num_particles];
+  Lanes *last = &last_positions[group * num_particles];
+  for (size_t i = 0; i < num_particles; i++) {
+    if (pinned[i]) continue;
+    Lanes &q = pos[i];
+    Lanes &r = last[i];
+    // Inflation pushes outward from the balloon's center, then Verlet
+    // integration, in the same order of operations as Cloth::simulate
+    #pragma omp simd
+    for (size_t l = 0; l < ENSEMBLE_LANES; l++) {
+      double nx = q.x[l] - center.x, ny = q.y[l] - center.y, nz = q.z[l] - center.z;
+      double scale = 1. / sqrt(nx * nx + ny * ny + nz * nz);
+      nx *= scale;
+      ny *= scale;
+      nz *= scale;
+      double ax = inverse_mass[l] * (external_x[l] + nx * p.inflation[l]);
+      double ay = inverse_mass[l] * (external_y[l] + ny * p.inflation[l]);
+      double az = inverse_mass[l] * (external_z[l] + nz * p.inflation[l]);
+      double x = q.x[l] + keep[l] * (q.x[l] - r.x[l]) + ax * delta_t * delta_t;
+      double y = q.y[l] + keep[l] * (q.y[l] - r.y[l]) + ay * delta_t * delta_t;
+      double z = q.z[l] + keep[l] * (q.z[l] - r.z[l]) + az * delta_t * delta_t;
+      r.x[l] = q.x[l];
+      r.y[l] = q.y[l];
+      r.z[l] = q.z[l];
+      q.x[l] = x;
+      q.y[l] = y;
+      q.z[l] = z;
+    }
+  }
+}
+
+void ClothEnsemble::collide(size_t group, const vector<CollisionObject *> &objects) {
+  Lanes *pos = &positions[group * num_particles];
+  Lanes *last = &last_positions[group * num_particles];
+  size_t lanes = min((size_t)ENSEMBLE_LANES, num_members - group * ENSEMBLE_LANES);
+
+  for (size_t l = 0; l < lanes; l++) {
+    for (size_t first = 0; first < num_particles; first += COLLISION_BLOCK_SIZE) {
+      size_t count = min((size_t)COLLISION_BLOCK_SIZE, num_particles - first);
+
+      // Most blocks are nowhere near a collider, and are never copied out
+      PointMassBlock block;
+      block.min = block.max = Vector3D(pos[first].x[l], pos[first].y[l], pos[first].z[l]);
+      for (size_t i = first; i < first + count; i++) {
+        block.extend(Vector3D(pos[i].x[l], pos[i].y[l], pos[i].z[l]));
+        block.extend(Vector3D(last[i].x[l], last[i].y[l], last[i].z[l]));
+      }
+      if (broadphase.query(block.min, block.max).empty()) continue;
+
+      for (size_t i = 0; i < count; i++) {
+        PointMass &pm = block_particles[i];
+        pm.pinned = pinned[first + i];
+        pm.position = Vector3D(pos[first + i].x[l], pos[first + i].y[l], pos[first + i].z[l]);
+        pm.last_position = Vector3D(last[first + i].x[l], last[first + i].y[l], last[first + i].z[l]);
+      }
+      block.begin = &block_particles[0];
+      block.count = count;
+      broadphase.for_each_near(block, [&](int idx) { objects[idx]->collide(block); });
+      for (size_t i = 0; i < count; i++) {
+        const PointMass &pm = block_particles[i];
+        pos[first + i].x[l] = pm.position.x;
+        pos[first + i].y[l] = pm.position.y;
+        pos[first + i].z[l] = pm.position.z;
+        last[first + i].x[l] = pm.last_position.x;
+        last[first + i].y[l] = pm.last_position.y;
+        last[first + i].z[l] = pm.last_position.z;
+      }
+    }
+  }
+}
+
+void ClothEnsemble::satisfy_constraints(size_t group) {
+  Lanes *pos = &positions[group * num_particles];
+
+  // Springs are relaxed in order, as in Cloth::satisfy_constraints, and each
+  // member only moves when its own spring is over-stretched
+  for (const EnsembleSpring &s : springs) {
+    bool a_fixed = pinned[s.a];
+    bool b_fixed = pinned[s.b];
+    if (a_fixed && b_fixed) continue;
+    double limit = s.rest_length * 1.1;
+    Lanes &a = pos[s.a];
+    Lanes &b = pos[s.b];
+
+    #pragma omp simd
+    for (size_t l = 0; l < ENSEMBLE_LANES; l++) {
+      double dx = b.x[l] - a.x[l], dy = b.y[l] - a.y[l], dz = b.z[l] - a.z[l];
+      double length = sqrt(dx * dx + dy * dy + dz * dz);
+      double scale = 1. / length;
+      bool stretched = length > limit;
+      double excess = length - limit;
+      double ux = dx * scale, uy = dy * scale, uz = dz * scale;
+      // Cloth::satisfy_constraints halves the excess for two free ends
+      double a_move = a_fixed ? 0 : (b_fixed ? excess : excess / 2);
+      double b_move = b_fixed ? 0 : (a_fixed ? excess : excess / 2);
+      if (!a_fixed) {
+        a.x[l] = stretched ? a.x[l] + ux * a_move : a.x[l];
+        a.y[l] = stretched ? a.y[l] + uy * a_move : a.y[l];
+        a.z[l] = stretched ? a.z[l] + uz * a_move : a.z[l];
+      }
+      if (!b_fixed) {
+        b.x[l] = stretched ? b.x[l] - ux * b_move : b.x[l];
+        b.y[l] = stretched ? b.y[l] - uy * b_move : b.y[l];
+        b.z[l] = stretched ? b.z[l] - uz * b_move : b.z[l];
+      }
+    }
+  }
+}
+
+void ClothEnsemble::get_member(size_t member, vector<PointMass> &point_masses) const {
+  size_t group = member / ENSEMBLE_LANES;
+  size_t l = member % ENSEMBLE_LANES;
+  const Lanes *pos = &positions[group * num_particles];
+  const Lanes *last = &last_positions[group * num_particles];
+  for (size_t i = 0; i < num_particles && i < point_masses.size(); i++) {
+    point_masses[i].position = Vector3D(pos[i].x[l], pos[i].y[l], pos[i].z[l]);
+    point_masses[i].last_position = Vector3D(last[i].x[l], last[i].y[l], last[i].z[l]);
+  }
+}
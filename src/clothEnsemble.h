@@ -0,0 +1,105 @@
+#ifndef CLOTH_ENSEMBLE_H
+#define CLOTH_ENSEMBLE_H
+
+#include <vector>
+
+#include "cloth.h"
+#include "collision/broadphase.h"
+#include "collision/collisionObject.h"
+
+using namespace CGL;
+using namespace std;
+
+// Members advanced together by one pass; four doubles fill an AVX register
+#define ENSEMBLE_LANES 4
+
+/**
+ * Copies of one balloon that differ only in their material parameters,
+ * simulated together for parameter sweeps.
+ *
+ * Members are grouped ENSEMBLE_LANES at a time, and each group stores every
+ * particle's coordinates member-interleaved (x of every member, then y,
+ * then z), so the integration and constraint passes walk the particles and
+ * springs once per group and update all of its members in SIMD lanes. The
+ * grid, springs and pins are read once for all of them. A partly filled
+ * group repeats its last member in the spare lanes.
+ *
+ * Each substep does what Cloth::simulate does for a lone cloth without wind
+ * or strings, with the same arithmetic: inflation and gravity, Verlet
+ * integration, collisions, then the spring constraints. Collisions are
+ * resolved member by member through the colliders' block kernels. Members
+ * never sleep, so they follow a Cloth stepped alone exactly until its first
+ * block falls asleep, and stay close after.
+ */
+class ClothEnsemble {
+public:
+  // Takes the cloth's grid, springs, pins and start positions, which every
+  // member shares
+  ClothEnsemble(const Cloth &cloth);
+
+  // Whether a scene's cloths can be simulated as ensemble members: a single
+  // cloth without strings, and no wind
+  static bool supports(const vector<Cloth *> &cloths, const WindField *wind);
+
+  // Starts one member per set of parameters from the cloth's start
+  // positions, at time 0
+  void reset(const vector<ClothParameters> &members);
+
+  // Advances every member by one frame, moving kinematic colliders along
+  // like Simulation::step
+  void step(int frames_per_sec, int simulation_steps, const Vector3D &gravity,
+            const vector<CollisionObject *> &objects);
+
+  size_t size() const { return num_members; }
+
+  // Writes a member's positions into point masses laid out like the cloth's
+  void get_member(size_t member, vector<PointMass> &point_masses) const;
+
+  double sim_time;
+
+private:
+  // One particle's coordinates in every lane of a group
+  struct Lanes {
+    double x[ENSEMBLE_LANES];
+    double y[ENSEMBLE_LANES];
+    double z[ENSEMBLE_LANES];
+  };
+
+  struct GroupParameters {
+    double mass[ENSEMBLE_LANES];
+    double damping[ENSEMBLE_LANES];
+    double inflation[ENSEMBLE_LANES];
+  };
+
+  struct EnsembleSpring {
+    unsigned int a, b;
+    double rest_length;
+  };
+
+  void integrate(size_t group, const Vector3D &gravity, double delta_t);
+  void collide(size_t group, const vector<CollisionObject *> &objects);
+  void satisfy_constraints(size_t group);
+
+  // Shared by every member
+  size_t num_particles;
+  double area;
+  int num_width_points;
+  int num_height_points;
+  Vector3D center;
+  vector<Vector3D> start_positions;
+  vector<unsigned char> pinned;
+  vector<EnsembleSpring> springs;
+
+  size_t num_members;
+  size_t num_groups;
+  vector<GroupParameters> parameters;
+  // Particle i of group g is at g * num_particles + i
+  vector<Lanes> positions;
+  vector<Lanes> last_positions;
+
+  // One member's block of particles, handed to the colliders
+  vector<PointMass> block_particles;
+  Broadphase broadphase;
+};
+
+#endif /* CLOTH_ENSEMBLE_H */
@@ -38,3 +38,16 @@ Vector3D PointMass::normal() {
 
   return n.unit();
 }
+
+ClothMesh::~ClothMesh() {
+  for (Triangle *t : triangles) {
+    Halfedge *h = t->halfedge;
+    for (int k = 0; k < 3; k++) {
+      Halfedge *next = h->next;
+      delete h->edge;
+      delete h;
+      h = next;
+    }
+    delete t;
+  }
+}
@@ -45,7 +45,8 @@ public:
 
 class ClothMesh {
 public:
-  ~ClothMesh() {}
+  // Frees the triangles along with their halfedges and edges
+  ~ClothMesh();
 
   vector<Triangle *> triangles;
 }; // struct ClothMesh
@@ -12,6 +12,7 @@
 #include "collision/sphere.h"
 #include "misc/camera_info.h"
 #include "misc/file_utils.h"
+#include "misc/image_loader.h"
 // Needed to generate stb_image binaries. Should only define in exactly one source file importing stb_image.h.
 #define STB_IMAGE_IMPLEMENTATION
 #include "misc/stb_image.h"
@@ -19,24 +20,42 @@
 using namespace nanogui;
 using namespace std;
 
-Vector3D load_texture(int frame_idx, GLuint handle, const char* where) {
-  Vector3D size_retval;
-  
-  if (strlen(where) == 0) return size_retval;
-  
+// Texture files in the order load_textures() uploads them: the four 2D
+// textures, then the six cubemap faces
+static std::vector<std::string> texture_paths(const std::string &project_root) {
+  return {
+    project_root + "/textures/texture_1.png",
+    project_root + "/textures/texture_2.png",
+    project_root + "/textures/texture_3.png",
+    project_root + "/textures/texture_4.png",
+    project_root + "/textures/cube/posx.jpg",
+    project_root + "/textures/cube/negx.jpg",
+    project_root + "/textures/cube/posy.jpg",
+    project_root + "/textures/cube/negy.jpg",
+    project_root + "/textures/cube/posz.jpg",
+    project_root + "/textures/cube/negz.jpg"
+  };
+}
+
+// Decodes outlive any one simulator, since they start before it exists
+static Misc::ImageLoader &texture_loader() {
+  static Misc::ImageLoader loader;
+  return loader;
+}
+
+void ClothSimulator::prefetch_textures(const std::string &project_root) {
+  texture_loader().start(texture_paths(project_root), 3);
+}
+
+Vector3D upload_texture(int frame_idx, GLuint handle, const Misc::DecodedImage &image, bool mipmaps) {
+  Vector3D size_retval(image.width, image.height, image.channels);
+
   glActiveTexture(GL_TEXTURE0 + frame_idx);
   glBindTexture(GL_TEXTURE_2D, handle);
-  
-  
-  int img_x, img_y, img_n;
-  unsigned char* img_data = stbi_load(where, &img_x, &img_y, &img_n, 3);
-  size_retval.x = img_x;
-  size_retval.y = img_y;
-  size_retval.z = img_n;
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, img_x, img_y, 0, GL_RGB, GL_UNSIGNED_BYTE, img_data);
-  stbi_image_free(img_data);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.pixels);
+  if (mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -44,23 +63,22 @@ Vector3D load_texture(int frame_idx, GLuint handle, const char* where) {
   return size_retval;
 }
 
-void load_cubemap(int frame_idx, GLuint handle, const std::vector<std::string>& file_locs) {
+void upload_cubemap(int frame_idx, GLuint handle, const Misc::DecodedImage *faces, bool mipmaps) {
   glActiveTexture(GL_TEXTURE0 + frame_idx);
   glBindTexture(GL_TEXTURE_CUBE_MAP, handle);
   for (int side_idx = 0; side_idx < 6; ++side_idx) {
-    
-    int img_x, img_y, img_n;
-    unsigned char* img_data = stbi_load(file_locs[side_idx].c_str(), &img_x, &img_y, &img_n, 3);
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + side_idx, 0, GL_RGB, img_x, img_y, 0, GL_RGB, GL_UNSIGNED_BYTE, img_data);
-    stbi_image_free(img_data);
-    std::cout << "Side " << side_idx << " has dimensions " << img_x << ", " << img_y << std::endl;
-
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    const Misc::DecodedImage &face = faces[side_idx];
+    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + side_idx, 0, GL_RGB, face.width, face.height, 0, GL_RGB, GL_UNSIGNED_BYTE, face.pixels);
+    std::cout << "Side " << side_idx << " has dimensions " << face.width << ", " << face.height << std::endl;
   }
+  if (mipmaps) glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+  // Parameters belong to the texture, not to each face
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 }
 
 void ClothSimulator::load_textures() {
@@ -69,28 +87,29 @@ void ClothSimulator::load_textures() {
   glGenTextures(1, &m_gl_texture_3);
   glGenTextures(1, &m_gl_texture_4);
   glGenTextures(1, &m_gl_cubemap_tex);
+
+  // Every image was decoding in the background since the constructor
+  // started it; upload them all at once
+  const std::vector<Misc::DecodedImage> &images = texture_loader().wait();
+  for (const Misc::DecodedImage &image : images) {
+    if (!image.pixels) std::cout << "Warn: Could not load texture " << image.path << std::endl;
+  }
   
-  m_gl_texture_1_size = load_texture(1, m_gl_texture_1, (m_project_root + "/textures/texture_1.png").c_str());
-  m_gl_texture_2_size = load_texture(2, m_gl_texture_2, (m_project_root + "/textures/texture_2.png").c_str());
-  m_gl_texture_3_size = load_texture(3, m_gl_texture_3, (m_project_root + "/textures/texture_3.png").c_str());
-  m_gl_texture_4_size = load_texture(4, m_gl_texture_4, (m_project_root + "/textures/texture_4.png").c_str());
+  m_gl_texture_1_size = upload_texture(1, m_gl_texture_1, images[0], m_generate_mipmaps);
+  m_gl_texture_2_size = upload_texture(2, m_gl_texture_2, images[1], m_generate_mipmaps);
+  m_gl_texture_3_size = upload_texture(3, m_gl_texture_3, images[2], m_generate_mipmaps);
+  m_gl_texture_4_size = upload_texture(4, m_gl_texture_4, images[3], m_generate_mipmaps);
   
   std::cout << "Texture 1 loaded with size: " << m_gl_texture_1_size << std::endl;
   std::cout << "Texture 2 loaded with size: " << m_gl_texture_2_size << std::endl;
   std::cout << "Texture 3 loaded with size: " << m_gl_texture_3_size << std::endl;
   std::cout << "Texture 4 loaded with size: " << m_gl_texture_4_size << std::endl;
   
-  std::vector<std::string> cubemap_fnames = {
-    m_project_root + "/textures/cube/posx.jpg",
-    m_project_root + "/textures/cube/negx.jpg",
-    m_project_root + "/textures/cube/posy.jpg",
-    m_project_root + "/textures/cube/negy.jpg",
-    m_project_root + "/textures/cube/posz.jpg",
-    m_project_root + "/textures/cube/negz.jpg"
-  };
-  
-  load_cubemap(5, m_gl_cubemap_tex, cubemap_fnames);
+  upload_cubemap(5, m_gl_cubemap_tex, &images[4], m_generate_mipmaps);
   std::cout << "Loaded cubemap texture" << std::endl;
+
+  // The pixels live on the GPU now
+  texture_loader().clear();
 }
 
 void ClothSimulator::load_shaders() {
@@ -122,10 +141,6 @@ void ClothSimulator::load_shaders() {
       vert_shader = associated_vert_shader_path;
     }
     
-    std::shared_ptr<GLShader> nanogui_shader = make_shared<GLShader>();
-    nanogui_shader->initFromFiles(shader_name, vert_shader,
-                                  m_project_root + "/shaders/" + shader_fname);
-    
     // Special filenames are treated a bit differently
     ShaderTypeHint hint;
     if (shader_name == "Wireframe") {
@@ -139,7 +154,7 @@ void ClothSimulator::load_shaders() {
       std::cout << "Type: Custom" << std::endl;
     }
     
-    UserShader user_shader(shader_name, nanogui_shader, hint);
+    UserShader user_shader(shader_name, vert_shader, m_project_root + "/shaders/" + shader_fname, hint);
     
     shaders.push_back(user_shader);
     shaders_combobox_names.push_back(shader_name);
@@ -154,11 +169,55 @@ void ClothSimulator::load_shaders() {
   }
 }
 
-ClothSimulator::ClothSimulator(std::string project_root, Screen *screen)
-: m_project_root(project_root) {
+void ClothSimulator::ensure_loaded(UserShader &shader) {
+  if (shader.nanogui_shader->is_loaded()) return;
+  shader.nanogui_shader->load(shader.display_name, shader.vert_path, shader.frag_path,
+                              m_project_root + "/.shader_cache");
+}
+
+void ClothSimulator::reload_changed_shaders() {
+  std::set<std::string> changed = shader_watcher.changed();
+  if (changed.empty()) return;
+
+  std::string shader_dir = m_project_root + "/shaders/";
+  for (UserShader &shader : shaders) {
+    // Shaders not built yet read the new sources when first selected
+    if (!shader.nanogui_shader->is_loaded()) continue;
+    if (!changed.count(shader.vert_path.substr(shader_dir.size())) &&
+        !changed.count(shader.frag_path.substr(shader_dir.size()))) {
+      continue;
+    }
+
+    // The old program keeps drawing unless the new one builds
+    std::shared_ptr<CachedShader> rebuilt = make_shared<CachedShader>();
+    try {
+      if (!rebuilt->load(shader.display_name, shader.vert_path, shader.frag_path,
+                         m_project_root + "/.shader_cache")) {
+        throw std::runtime_error("could not read the sources");
+      }
+    } catch (const std::exception &e) {
+      std::cout << "Keeping the previous " << shader.display_name << " shader: " << e.what() << std::endl;
+      rebuilt->free();
+      continue;
+    }
+
+    cloth_batch.release_program(shader.nanogui_shader->program());
+    Misc::SphereMesh::release_program(shader.nanogui_shader->program());
+    shader.nanogui_shader->free();
+    shader.nanogui_shader = rebuilt;
+    std::cout << "Reloaded shader " << shader.display_name << std::endl;
+  }
+}
+
+ClothSimulator::ClothSimulator(std::string project_root, Screen *screen, bool generate_mipmaps)
+: m_project_root(project_root), m_generate_mipmaps(generate_mipmaps) {
   this->screen = screen;
   
+  // Textures decode while the first shader compiles
+  prefetch_textures(m_project_root);
   this->load_shaders();
+  ensure_loaded(shaders[active_shader_idx]);
+  shader_watcher.start(m_project_root + "/shaders");
   this->load_textures();
 
   glEnable(GL_PROGRAM_POINT_SIZE);
@@ -167,24 +226,27 @@ ClothSimulator::ClothSimulator(std::string project_root, Screen *screen)
 
 ClothSimulator::~ClothSimulator() {
   for (auto shader : shaders) {
-    shader.nanogui_shader->free();
+    if (shader.nanogui_shader->is_loaded()) shader.nanogui_shader->free();
   }
   glDeleteTextures(1, &m_gl_texture_1);
   glDeleteTextures(1, &m_gl_texture_2);
   glDeleteTextures(1, &m_gl_texture_3);
   glDeleteTextures(1, &m_gl_texture_4);
   glDeleteTextures(1, &m_gl_cubemap_tex);
+}
 
-  if (cloth) delete cloth;
-  if (cp) delete cp;
-  if (collision_objects) delete collision_objects;
+void ClothSimulator::loadSimulation(Simulation *simulation) {
+  this->simulation = simulation;
+  cloths = &simulation->cloths;
+  cp = &simulation->cp;
+  collision_objects = &simulation->objects;
 }
 
-void ClothSimulator::loadCloth(Cloth *cloth) { this->cloth = cloth; }
+void ClothSimulator::exportMeshes(MeshSequenceWriter *writer) { mesh_export = writer; }
 
-void ClothSimulator::loadClothParameters(ClothParameters *cp) { this->cp = cp; }
+void ClothSimulator::captureFrames(FrameCapture *capture) { frame_capture = capture; }
 
-void ClothSimulator::loadCollisionObjects(vector<CollisionObject *> *objects) { this->collision_objects = objects; }
+void ClothSimulator::setPaused(bool paused) { is_paused = paused; }
 
 /**
  * Initializes the cloth simulation and spawns a new thread to separate
@@ -207,15 +269,24 @@ void ClothSimulator::init() {
   // Try to intelligently figure out the camera target
 
   Vector3D avg_pm_position(0, 0, 0);
+  size_t num_point_masses = 0;
+  double max_extent = 0;
 
-  for (auto &pm : cloth->point_masses) {
-    avg_pm_position += pm.position / cloth->point_masses.size();
+  for (Cloth *cloth : *cloths) {
+    cloth->track_changes();
+    num_point_masses += cloth->point_masses.size();
+    max_extent = max(max_extent, max(cloth->width, cloth->height));
+  }
+  for (Cloth *cloth : *cloths) {
+    for (auto &pm : cloth->point_masses) {
+      avg_pm_position += pm.position / num_point_masses;
+    }
   }
 
   CGL::Vector3D target(avg_pm_position.x, avg_pm_position.y / 2,
                        avg_pm_position.z);
   CGL::Vector3D c_dir(0., 0., 0.);
-  canonical_view_distance = max(cloth->width, cloth->height) * 0.9;
+  canonical_view_distance = max_extent * 0.9;
   scroll_rate = canonical_view_distance / 10;
 
   view_distance = canonical_view_distance * 2;
@@ -238,20 +309,29 @@ void ClothSimulator::init() {
 
 bool ClothSimulator::isAlive() { return is_alive; }
 
+bool ClothSimulator::needsRedraw() { return !is_paused || shader_watcher.has_changes(); }
+
 void ClothSimulator::drawContents() {
   glEnable(GL_DEPTH_TEST);
 
-  if (!is_paused) {
-    vector<Vector3D> external_accelerations = {gravity};
+  bool stepped = !is_paused;
+  if (stepped) {
+    simulation->step(frames_per_sec, simulation_steps, gravity);
+    if (mesh_export) {
+      mesh_export->write_frame(*cloths, simulation->sim_time);
+    }
 
-    for (int i = 0; i < simulation_steps; i++) {
-      cloth->simulate(frames_per_sec, simulation_steps, cp, external_accelerations, collision_objects);
+    // Render data is refreshed only where particles moved
+    for (Cloth *cloth : *cloths) {
+      cloth->track_changes();
     }
   }
 
   // Bind the active shader
 
-  const UserShader& active_shader = shaders[active_shader_idx];
+  reload_changed_shaders();
+  UserShader& active_shader = shaders[active_shader_idx];
+  ensure_loaded(active_shader);
 
   GLShader &shader = *active_shader.nanogui_shader;
   shader.bind();
@@ -269,13 +349,16 @@ void ClothSimulator::drawContents() {
   shader.setUniform("u_model", model);
   shader.setUniform("u_view_projection", viewProjection);
 
+  // Objects outside the view are skipped; the rest pick a level of detail
+  Misc::Frustum frustum(viewProjection, camera.position(), screen_h);
+
   switch (active_shader.type_hint) {
   case WIREFRAME:
     shader.setUniform("u_color", color, false);
-    drawWireframe(shader);
+    cloth_batch.draw_springs(shader, *cloths, *cp, frustum);
     break;
   case NORMALS:
-    drawNormals(shader);
+    cloth_batch.draw(shader, *cloths, frustum);
     break;
   case PHONG:
   
@@ -299,142 +382,69 @@ void ClothSimulator::drawContents() {
     shader.setUniform("u_height_scaling", m_height_scaling, false);
     
     shader.setUniform("u_texture_cubemap", 5, false);
-    drawPhong(shader);
+    cloth_batch.draw(shader, *cloths, frustum);
     break;
   }
 
   for (CollisionObject *co : *collision_objects) {
+    Vector3D min, max;
+    if (co->bounds(min, max) && !frustum.visible(min, max)) continue;
     co->render(shader);
   }
-}
-
-void ClothSimulator::drawWireframe(GLShader &shader) {
-  int num_structural_springs =
-      2 * cloth->num_width_points * cloth->num_height_points -
-      cloth->num_width_points - cloth->num_height_points;
-  int num_shear_springs =
-      2 * (cloth->num_width_points - 1) * (cloth->num_height_points - 1);
-  int num_bending_springs = num_structural_springs - cloth->num_width_points -
-                            cloth->num_height_points;
-
-  int num_springs = cp->enable_structural_constraints * num_structural_springs +
-                    cp->enable_shearing_constraints * num_shear_springs +
-                    cp->enable_bending_constraints * num_bending_springs;
-
-  MatrixXf positions(4, num_springs * 2);
-  MatrixXf normals(4, num_springs * 2);
-
-  // Draw springs as lines
-
-  int si = 0;
-
-  for (int i = 0; i < cloth->springs.size(); i++) {
-    Spring s = cloth->springs[i];
-
-    if ((s.spring_type == STRUCTURAL && !cp->enable_structural_constraints) ||
-        (s.spring_type == SHEARING && !cp->enable_shearing_constraints) ||
-        (s.spring_type == BENDING && !cp->enable_bending_constraints)) {
-      continue;
-    }
+  Misc::SphereMesh::draw_all_instances(shader, frustum);
+  drawTethers(shader, frustum);
 
-    Vector3D pa = s.pm_a->position;
-    Vector3D pb = s.pm_b->position;
-
-    Vector3D na = s.pm_a->normal();
-    Vector3D nb = s.pm_b->normal();
-
-    positions.col(si) << pa.x, pa.y, pa.z, 1.0;
-    positions.col(si + 1) << pb.x, pb.y, pb.z, 1.0;
-
-    normals.col(si) << na.x, na.y, na.z, 0.0;
-    normals.col(si + 1) << nb.x, nb.y, nb.z, 0.0;
-
-    si += 2;
+  // Recorded before the GUI is drawn over the scene
+  if (frame_capture && stepped) {
+    frame_capture->capture();
   }
-
-  //shader.setUniform("u_color", nanogui::Color(1.0f, 1.0f, 1.0f, 1.0f), false);
-  shader.uploadAttrib("in_position", positions, false);
-  // Commented out: the wireframe shader does not have this attribute
-  //shader.uploadAttrib("in_normal", normals);
-
-  shader.drawArray(GL_LINES, 0, num_springs * 2);
 }
 
-void ClothSimulator::drawNormals(GLShader &shader) {
-  int num_tris = cloth->clothMesh->triangles.size();
-
-  MatrixXf positions(4, num_tris * 3);
-  MatrixXf normals(4, num_tris * 3);
-
-  for (int i = 0; i < num_tris; i++) {
-    Triangle *tri = cloth->clothMesh->triangles[i];
-
-    Vector3D p1 = tri->pm1->position;
-    Vector3D p2 = tri->pm2->position;
-    Vector3D p3 = tri->pm3->position;
-
-    Vector3D n1 = tri->pm1->normal();
-    Vector3D n2 = tri->pm2->normal();
-    Vector3D n3 = tri->pm3->normal();
-
-    positions.col(i * 3) << p1.x, p1.y, p1.z, 1.0;
-    positions.col(i * 3 + 1) << p2.x, p2.y, p2.z, 1.0;
-    positions.col(i * 3 + 2) << p3.x, p3.y, p3.z, 1.0;
-
-    normals.col(i * 3) << n1.x, n1.y, n1.z, 0.0;
-    normals.col(i * 3 + 1) << n2.x, n2.y, n2.z, 0.0;
-    normals.col(i * 3 + 2) << n3.x, n3.y, n3.z, 0.0;
+void ClothSimulator::drawTethers(GLShader &shader, const Misc::Frustum &frustum) {
+  vector<const Tether *> visible;
+  int num_points = 0;
+
+  for (Cloth *cloth : *cloths) {
+    for (const Tether &tether : cloth->tethers) {
+      Vector3D min = tether.particles[0].position, max = min;
+      for (const PointMass &pm : tether.particles) {
+        const Vector3D &p = pm.position;
+        min = Vector3D(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max = Vector3D(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+      }
+      if (!frustum.visible(min, max)) continue;
+      visible.push_back(&tether);
+      num_points += tether.particles.size();
+    }
   }
-
-  shader.uploadAttrib("in_position", positions, false);
-  shader.uploadAttrib("in_normal", normals, false);
-
-  shader.drawArray(GL_TRIANGLES, 0, num_tris * 3);
-}
-
-void ClothSimulator::drawPhong(GLShader &shader) {
-  int num_tris = cloth->clothMesh->triangles.size();
-
-  MatrixXf positions(4, num_tris * 3);
-  MatrixXf normals(4, num_tris * 3);
-  MatrixXf uvs(2, num_tris * 3);
-  MatrixXf tangents(4, num_tris * 3);
-
-  for (int i = 0; i < num_tris; i++) {
-    Triangle *tri = cloth->clothMesh->triangles[i];
-
-    Vector3D p1 = tri->pm1->position;
-    Vector3D p2 = tri->pm2->position;
-    Vector3D p3 = tri->pm3->position;
-
-    Vector3D n1 = tri->pm1->normal();
-    Vector3D n2 = tri->pm2->normal();
-    Vector3D n3 = tri->pm3->normal();
-
-    positions.col(i * 3    ) << p1.x, p1.y, p1.z, 1.0;
-    positions.col(i * 3 + 1) << p2.x, p2.y, p2.z, 1.0;
-    positions.col(i * 3 + 2) << p3.x, p3.y, p3.z, 1.0;
-
-    normals.col(i * 3    ) << n1.x, n1.y, n1.z, 0.0;
-    normals.col(i * 3 + 1) << n2.x, n2.y, n2.z, 0.0;
-    normals.col(i * 3 + 2) << n3.x, n3.y, n3.z, 0.0;
-    
-    uvs.col(i * 3    ) << tri->uv1.x, tri->uv1.y;
-    uvs.col(i * 3 + 1) << tri->uv2.x, tri->uv2.y;
-    uvs.col(i * 3 + 2) << tri->uv3.x, tri->uv3.y;
-    
-    tangents.col(i * 3    ) << 1.0, 0.0, 0.0, 1.0;
-    tangents.col(i * 3 + 1) << 1.0, 0.0, 0.0, 1.0;
-    tangents.col(i * 3 + 2) << 1.0, 0.0, 0.0, 1.0;
+  if (visible.empty()) return;
+
+  MatrixXf positions(4, num_points);
+  MatrixXf normals(4, num_points);
+  vector<GLint> firsts;
+  vector<GLsizei> counts;
+
+  // Every visible string as its own line strip, in a single draw call
+  int pi = 0;
+  for (const Tether *tether : visible) {
+    firsts.push_back(pi);
+    counts.push_back(tether->particles.size());
+    for (const PointMass &pm : tether->particles) {
+      positions.col(pi) << pm.position.x, pm.position.y, pm.position.z, 1.0;
+      normals.col(pi) << 0.0, 1.0, 0.0, 0.0;
+      pi++;
+    }
   }
 
+  if (shader.uniform("u_color", false) != -1) {
+    shader.setUniform("u_color", nanogui::Color(0.2f, 0.2f, 0.2f, 1.0f));
+  }
+  shader.uploadAttrib("in_position", positions);
+  if (shader.attrib("in_normal", false) != -1) {
+    shader.uploadAttrib("in_normal", normals);
+  }
 
-  shader.uploadAttrib("in_position", positions, false);
-  shader.uploadAttrib("in_normal", normals, false);
-  shader.uploadAttrib("in_uv", uvs, false);
-  shader.uploadAttrib("in_tangent", tangents, false);
-
-  shader.drawArray(GL_TRIANGLES, 0, num_tris * 3);
+  glMultiDrawArrays(GL_LINE_STRIP, firsts.data(), counts.data(), visible.size());
 }
 
 // ----------------------------------------------------------------------------
@@ -577,7 +587,7 @@ bool ClothSimulator::keyCallbackEvent(int key, int scancode, int action,
       break;
     case 'r':
     case 'R':
-      cloth->reset();
+      simulation->reset();
       break;
     case ' ':
       resetCamera();
@@ -6,7 +6,14 @@
 
 #include "camera.h"
 #include "cloth.h"
+#include "clothBatch.h"
+#include "frameCapture.h"
 #include "collision/collisionObject.h"
+#include "meshExport.h"
+#include "misc/file_watcher.h"
+#include "misc/frustum.h"
+#include "shaderCache.h"
+#include "simulation.h"
 
 using namespace nanogui;
 
@@ -15,15 +22,26 @@ enum ShaderTypeHint { WIREFRAME = 0, NORMALS = 1, PHONG = 2 };
 
 class ClothSimulator {
 public:
-  ClothSimulator(std::string project_root, Screen *screen);
+  ClothSimulator(std::string project_root, Screen *screen, bool generate_mipmaps = false);
   ~ClothSimulator();
 
+  // Starts decoding the textures on worker threads. Call it as early as the
+  // project root is known; the constructor waits for the decodes and uploads
+  // them, and starts them itself if this was never called.
+  static void prefetch_textures(const std::string &project_root);
+
   void init();
 
-  void loadCloth(Cloth *cloth);
-  void loadClothParameters(ClothParameters *cp);
-  void loadCollisionObjects(vector<CollisionObject *> *objects);
+  void loadSimulation(Simulation *simulation);
+  // Hands every simulated frame to the writer
+  void exportMeshes(MeshSequenceWriter *writer);
+  // Records the scene of every simulated frame, without the GUI
+  void captureFrames(FrameCapture *capture);
+  void setPaused(bool paused);
   virtual bool isAlive();
+  // Whether the next frame differs from the last one drawn, for reasons
+  // other than input events: the simulation is running or shaders changed
+  bool needsRedraw();
   virtual void drawContents();
 
   // Screen events
@@ -37,16 +55,19 @@ public:
 
 private:
   virtual void initGUI(Screen *screen);
-  void drawWireframe(GLShader &shader);
-  void drawNormals(GLShader &shader);
-  void drawPhong(GLShader &shader);
+  void drawTethers(GLShader &shader, const Misc::Frustum &frustum);
   
   void load_shaders();
   void load_textures();
+  // Compiles, or loads from the shader cache, a shader not used before
+  void ensure_loaded(UserShader &shader);
+  // Rebuilds the loaded shaders whose sources were saved since last frame
+  void reload_changed_shaders();
   
   // File management
   
   std::string m_project_root;
+  Misc::FileWatcher shader_watcher;
 
   // Camera methods
 
@@ -62,10 +83,20 @@ private:
   CGL::Vector3D gravity = CGL::Vector3D(0, -9.8, 0);
   nanogui::Color color = nanogui::Color(1.0f, 1.0f, 1.0f, 1.0f);
 
-  Cloth *cloth;
+  Simulation *simulation;
+  // The simulation's scene
+  vector<Cloth *> *cloths;
   ClothParameters *cp;
   vector<CollisionObject *> *collision_objects;
 
+  // Null unless the meshes are exported
+  MeshSequenceWriter *mesh_export = nullptr;
+  // Null unless frames are recorded
+  FrameCapture *frame_capture = nullptr;
+
+  // Static topology and incrementally updated vertices for drawing cloths
+  ClothBatch cloth_batch;
+
   // OpenGL attributes
 
   int active_shader_idx = 0;
@@ -84,6 +115,7 @@ private:
   GLuint m_gl_texture_3;
   GLuint m_gl_texture_4;
   GLuint m_gl_cubemap_tex;
+  bool m_generate_mipmaps;
   
   // OpenGL customizable inputs
   
@@ -137,14 +169,19 @@ private:
 };
 
 struct UserShader {
-  UserShader(std::string display_name, std::shared_ptr<GLShader> nanogui_shader, ShaderTypeHint type_hint)
+  UserShader(std::string display_name, std::string vert_path, std::string frag_path, ShaderTypeHint type_hint)
   : display_name(display_name)
-  , nanogui_shader(nanogui_shader)
+  , vert_path(vert_path)
+  , frag_path(frag_path)
+  , nanogui_shader(std::make_shared<CachedShader>())
   , type_hint(type_hint) {
   }
   
-  std::shared_ptr<GLShader> nanogui_shader;
   std::string display_name;
+  // Sources, compiled the first time the shader is selected
+  std::string vert_path;
+  std::string frag_path;
+  std::shared_ptr<CachedShader> nanogui_shader;
   ShaderTypeHint type_hint;
   
 };
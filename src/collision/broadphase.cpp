@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cmath>
+
+#include "broadphase.h"
+
+using namespace std;
+using namespace CGL;
+
+// Upper bound on grid cells per axis
+#define BROADPHASE_MAX_CELLS 32
+
+void Broadphase::update(const vector<CollisionObject *> &objects) {
+  if (objects != this->objects) {
+    this->objects = objects;
+    rebuild();
+    return;
+  }
+
+  for (size_t i = 0; i < objects.size(); i++) {
+    Vector3D min, max;
+    bool has_bounds = objects[i]->bounds(min, max);
+    if (has_bounds != (bool)bounded[i]) {
+      rebuild();
+      return;
+    }
+    if (!has_bounds || (min == object_min[i] && max == object_max[i])) continue;
+
+    // Objects leaving the grid force a refit; otherwise only re-bin this one
+    if (!inside_grid(min, max)) {
+      rebuild();
+      return;
+    }
+    remove(i);
+    object_min[i] = min;
+    object_max[i] = max;
+    insert(i);
+  }
+}
+
+bool Broadphase::inside_grid(const Vector3D &min, const Vector3D &max) const {
+  Vector3D grid_max = grid_min + Vector3D(nx, ny, nz) * cell_size;
+  return min.x >= grid_min.x && min.y >= grid_min.y && min.z >= grid_min.z &&
+         max.x <= grid_max.x && max.y <= grid_max.y && max.z <= grid_max.z;
+}
+
+void Broadphase::insert(int i) {
+  int *range = &object_cells[6 * i];
+  range[0] = min(nx - 1, (int)((object_min[i].x - grid_min.x) / cell_size));
+  range[1] = min(ny - 1, (int)((object_min[i].y - grid_min.y) / cell_size));
+  range[2] = min(nz - 1, (int)((object_min[i].z - grid_min.z) / cell_size));
+  range[3] = min(nx - 1, (int)((object_max[i].x - grid_min.x) / cell_size));
+  range[4] = min(ny - 1, (int)((object_max[i].y - grid_min.y) / cell_size));
+  range[5] = min(nz - 1, (int)((object_max[i].z - grid_min.z) / cell_size));
+
+  for (int z = range[2]; z <= range[5]; z++) {
+    for (int y = range[1]; y <= range[4]; y++) {
+      for (int x = range[0]; x <= range[3]; x++) {
+        cells[cell_index(x, y, z)].push_back(i);
+      }
+    }
+  }
+}
+
+void Broadphase::remove(int i) {
+  const int *range = &object_cells[6 * i];
+  for (int z = range[2]; z <= range[5]; z++) {
+    for (int y = range[1]; y <= range[4]; y++) {
+      for (int x = range[0]; x <= range[3]; x++) {
+        vector<int> &cell = cells[cell_index(x, y, z)];
+        vector<int>::iterator entry = std::find(cell.begin(), cell.end(), i);
+        if (entry != cell.end()) cell.erase(entry);
+      }
+    }
+  }
+}
+
+void Broadphase::rebuild() {
+  size_t num_objects = objects.size();
+  bounded.assign(num_objects, 0);
+  object_min.assign(num_objects, Vector3D());
+  object_max.assign(num_objects, Vector3D());
+  unbounded.clear();
+  stamps.assign(num_objects, 0);
+  stamp = 0;
+
+  Vector3D scene_min, scene_max;
+  double total_extent = 0;
+  int num_bounded = 0;
+
+  for (size_t i = 0; i < num_objects; i++) {
+    if (!objects[i]->bounds(object_min[i], object_max[i])) {
+      unbounded.push_back(i);
+      continue;
+    }
+    bounded[i] = 1;
+
+    const Vector3D &lo = object_min[i];
+    const Vector3D &hi = object_max[i];
+    if (num_bounded == 0) {
+      scene_min = lo;
+      scene_max = hi;
+    } else {
+      scene_min = Vector3D(min(scene_min.x, lo.x), min(scene_min.y, lo.y), min(scene_min.z, lo.z));
+      scene_max = Vector3D(max(scene_max.x, hi.x), max(scene_max.y, hi.y), max(scene_max.z, hi.z));
+    }
+    Vector3D extent = hi - lo;
+    total_extent += max(extent.x, max(extent.y, extent.z));
+    num_bounded++;
+  }
+
+  cells.clear();
+  nx = ny = nz = 0;
+  if (num_bounded == 0) return;
+
+  // Cells about the size of an average collider, capped in count
+  Vector3D scene_extent = scene_max - scene_min;
+  double largest = max(scene_extent.x, max(scene_extent.y, scene_extent.z));
+  cell_size = max(total_extent / num_bounded, largest / BROADPHASE_MAX_CELLS);
+  if (cell_size <= 0) cell_size = 1;
+
+  grid_min = scene_min;
+  nx = min(BROADPHASE_MAX_CELLS, (int)floor(scene_extent.x / cell_size) + 1);
+  ny = min(BROADPHASE_MAX_CELLS, (int)floor(scene_extent.y / cell_size) + 1);
+  nz = min(BROADPHASE_MAX_CELLS, (int)floor(scene_extent.z / cell_size) + 1);
+  cells.resize(nx * ny * nz);
+  object_cells.assign(6 * num_objects, 0);
+
+  for (size_t i = 0; i < num_objects; i++) {
+    if (bounded[i]) insert(i);
+  }
+}
+
+const vector<int> &Broadphase::query(const Vector3D &min, const Vector3D &max) {
+  candidates = unbounded;
+  if (cells.empty()) return candidates;
+
+  // Reject queries that miss the grid entirely
+  Vector3D lo = (min - grid_min) / cell_size;
+  Vector3D hi = (max - grid_min) / cell_size;
+  if (hi.x < 0 || hi.y < 0 || hi.z < 0 || lo.x > nx || lo.y > ny || lo.z > nz) {
+    return candidates;
+  }
+
+  if (++stamp == 0) {
+    std::fill(stamps.begin(), stamps.end(), 0);
+    stamp = 1;
+  }
+
+  int x0 = std::min(nx - 1, std::max(0, (int)lo.x)), x1 = std::min(nx - 1, (int)hi.x);
+  int y0 = std::min(ny - 1, std::max(0, (int)lo.y)), y1 = std::min(ny - 1, (int)hi.y);
+  int z0 = std::min(nz - 1, std::max(0, (int)lo.z)), z1 = std::min(nz - 1, (int)hi.z);
+
+  size_t num_unbounded = candidates.size();
+  for (int z = z0; z <= z1; z++) {
+    for (int y = y0; y <= y1; y++) {
+      for (int x = x0; x <= x1; x++) {
+        for (int i : cells[cell_index(x, y, z)]) {
+          if (stamps[i] == stamp) continue;
+          stamps[i] = stamp;
+
+          const Vector3D &omin = object_min[i];
+          const Vector3D &omax = object_max[i];
+          if (omin.x > max.x || omin.y > max.y || omin.z > max.z ||
+              omax.x < min.x || omax.y < min.y || omax.z < min.z) {
+            continue;
+          }
+          candidates.push_back(i);
+        }
+      }
+    }
+  }
+
+  // Keep scene order so results match testing every object in turn
+  if (candidates.size() > num_unbounded) {
+    std::sort(candidates.begin(), candidates.end());
+  }
+  return candidates;
+}
@@ -0,0 +1,84 @@
+#ifndef COLLISIONOBJECT_BROADPHASE_H
+#define COLLISIONOBJECT_BROADPHASE_H
+
+#include <vector>
+
+#include "CGL/CGL.h"
+#include "collisionObject.h"
+
+using namespace CGL;
+using namespace std;
+
+/**
+ * Uniform grid over the bounds of the scene's collision objects, so a particle
+ * block only runs the narrowphase against colliders near it. Unbounded
+ * colliders (planes) are returned by every query.
+ *
+ * The grid is rebuilt only when the collider set changes or a collider leaves
+ * the grid. Colliders that move within it are re-binned individually, so
+ * kinematic objects cost O(cells they touch) per substep, and static scenes
+ * pay one bounds comparison per object.
+ */
+class Broadphase {
+public:
+  Broadphase() : nx(0), ny(0), nz(0), cell_size(0), stamp(0) {}
+
+  void update(const vector<CollisionObject *> &objects);
+
+  // Indices into the object list passed to update(), in scene order, of every
+  // collider whose bounds may overlap [min, max]. Valid until the next query.
+  const vector<int> &query(const Vector3D &min, const Vector3D &max);
+
+  // Calls visit(index) for every collider near a block, in scene order.
+  // Colliders grow the block's bounds as they push its particles, so when
+  // the bounds grow the grid is asked again, and colliders later in the
+  // scene that the block was pushed into still see it. The result is the
+  // same as visiting every object.
+  template <typename Visit>
+  void for_each_near(const PointMassBlock &block, Visit visit) {
+    Vector3D min = block.min, max = block.max;
+    int last = -1;
+    bool grew;
+    do {
+      grew = false;
+      const vector<int> &nearby = query(min, max);
+      for (size_t k = 0; k < nearby.size() && !grew; k++) {
+        if (nearby[k] <= last) continue;
+        last = nearby[k];
+        visit(last);
+        grew = block.min.x < min.x || block.min.y < min.y || block.min.z < min.z ||
+               block.max.x > max.x || block.max.y > max.y || block.max.z > max.z;
+      }
+      min = block.min;
+      max = block.max;
+    } while (grew);
+  }
+
+private:
+  void rebuild();
+  void insert(int i);
+  void remove(int i);
+  bool inside_grid(const Vector3D &min, const Vector3D &max) const;
+  int cell_index(int x, int y, int z) const { return (z * ny + y) * nx + x; }
+
+  vector<CollisionObject *> objects;
+  vector<char> bounded;
+  vector<Vector3D> object_min;
+  vector<Vector3D> object_max;
+  vector<int> unbounded;
+
+  // Grid over the union of the bounded colliders
+  int nx, ny, nz;
+  Vector3D grid_min;
+  double cell_size;
+  vector<vector<int> > cells;
+  // Inclusive cell range (x0, y0, z0, x1, y1, z1) each object is binned in
+  vector<int> object_cells;
+
+  // Per-object stamps used to dedupe objects spanning several cells
+  vector<unsigned int> stamps;
+  unsigned int stamp;
+  vector<int> candidates;
+};
+
+#endif /* COLLISIONOBJECT_BROADPHASE_H */
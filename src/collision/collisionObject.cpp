@@ -0,0 +1,46 @@
+#include <cmath>
+
+#include "collisionObject.h"
+
+using namespace std;
+using namespace CGL;
+
+Vector3D CollisionObject::translation_at(double t) const {
+  if (keyframes.empty()) return Vector3D(0, 0, 0);
+
+  double start = keyframes.front().time;
+  double end = keyframes.back().time;
+  if (loop_keyframes && end > start) {
+    t = start + fmod(t - start, end - start);
+    if (t < start) t += end - start;
+  }
+
+  if (t <= start) return keyframes.front().translation;
+  if (t >= end) return keyframes.back().translation;
+
+  // Linear interpolation between the surrounding keys
+  size_t i = 1;
+  while (keyframes[i].time < t) i++;
+  const Keyframe &a = keyframes[i - 1];
+  const Keyframe &b = keyframes[i];
+  double span = b.time - a.time;
+  double alpha = span > 0 ? (t - a.time) / span : 1.0;
+  return a.translation + (b.translation - a.translation) * alpha;
+}
+
+void CollisionObject::advance(double t) {
+  if (keyframes.empty()) return;
+
+  Vector3D next = translation_at(t);
+  displacement = next - translation;
+  translation = next;
+  moved();
+}
+
+void CollisionObject::reset_motion() {
+  if (keyframes.empty()) return;
+
+  translation = translation_at(keyframes.front().time);
+  displacement = Vector3D(0, 0, 0);
+  moved();
+}
@@ -1,6 +1,9 @@
 #ifndef COLLISIONOBJECT
 #define COLLISIONOBJECT
 
+#include <algorithm>
+#include <vector>
+
 #include <nanogui/nanogui.h>
 
 #include "../clothMesh.h"
@@ -9,12 +12,80 @@ using namespace CGL;
 using namespace std;
 using namespace nanogui;
 
+#define COLLISION_BLOCK_SIZE 64
+
+/**
+ * A contiguous run of at most COLLISION_BLOCK_SIZE point masses, together with
+ * the bounds of both their current and last positions. Colliders use the
+ * bounds to reject the whole block before looking at any particle, and grow
+ * them whenever they move a particle so later colliders stay conservative.
+ */
+struct PointMassBlock {
+  PointMass *begin;
+  size_t count;
+
+  Vector3D min;
+  Vector3D max;
+
+  void extend(const Vector3D &p) {
+    min = Vector3D(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+    max = Vector3D(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+  }
+};
+
+// Translation of a kinematic collider, relative to its scene pose, at a time
+struct Keyframe {
+  Keyframe(double time, const Vector3D &translation)
+      : time(time), translation(translation) {}
+
+  double time;
+  Vector3D translation;
+};
+
 class CollisionObject {
 public:
+  CollisionObject() : loop_keyframes(false) {}
+  virtual ~CollisionObject() {}
+
   virtual void render(GLShader &shader) = 0;
   virtual void collide(PointMass &pm) = 0;
 
+  // World-space bounds of everything this object can push particles out of.
+  // Returns false for unbounded objects, which the broadphase always tests.
+  virtual bool bounds(Vector3D &min, Vector3D &max) const { return false; }
+
+  // Batched entry point, called once per block instead of once per particle.
+  // Subclasses override this with kernels that test the block bounds first.
+  virtual void collide(PointMassBlock &block) {
+    for (size_t i = 0; i < block.count; i++) {
+      collide(block.begin[i]);
+      block.extend(block.begin[i].position);
+    }
+  }
+
+  // Kinematic motion. advance() moves the object to its keyframed pose at
+  // time t; the displacement since the previous call is what contacts see as
+  // the collider's velocity. reset_motion() jumps to the pose at t = 0.
+  void advance(double t);
+  void reset_motion();
+  bool kinematic() const { return !keyframes.empty(); }
+  // Whether the last advance() moved the object; false once a kinematic
+  // object has stopped at its last keyframe
+  bool moving() const { return !(displacement == Vector3D(0, 0, 0)); }
+
+  vector<Keyframe> keyframes;
+  bool loop_keyframes;
+
+protected:
+  // Called after the translation changes; subclasses move their geometry.
+  virtual void moved() {}
+
+  Vector3D translation;
+  Vector3D displacement;
+
 private:
+  Vector3D translation_at(double t) const;
+
   double friction;
 };
 
@@ -1,4 +1,5 @@
 #include "iostream"
+#include <cmath>
 #include <nanogui/nanogui.h>
 
 #include "../clothMesh.h"
@@ -12,26 +13,69 @@ using namespace CGL;
 
 
 void Plane::collide(PointMass &pm) {
+	// last_position is compared against where the plane was a substep ago
 	Vector3D vector_new = pm.position - point;
-	Vector3D vector_last = pm.last_position - point;
+	Vector3D vector_last = pm.last_position - (point - displacement);
 	// if the point is on the other side of the plane
 	if (dot(vector_new, normal) * dot(vector_last, normal) <= 0) {
-		// project the point onto the plane
-		Vector3D unit = normal.unit();
-		Vector3D tangent = pm.position - dot(unit, vector_new) * unit;
-		Vector3D vector;
-		// if the point is moving towards the plane, move it to the surface
-		// otherwise, move it away from the surface
-		if (dot(vector_last, normal) < 0) {
-			vector = tangent - normal * SURFACE_OFFSET - pm.last_position;
-		} else {
-			vector = tangent + normal * SURFACE_OFFSET - pm.last_position;
+		resolve(pm);
+	}
+}
+
+void Plane::collide(PointMassBlock &block) {
+	// Signed distance range of the block bounds against the current and the
+	// previous plane; if every position and last position is strictly on one
+	// side of both, nothing in the block can cross
+	Vector3D last_point = point - displacement;
+	Vector3D center = (block.min + block.max) / 2.0;
+	Vector3D half = (block.max - block.min) / 2.0;
+	double radius = half.x * fabs(normal.x) + half.y * fabs(normal.y) + half.z * fabs(normal.z);
+	double center_dist = dot(center - point, normal);
+	double last_center_dist = dot(center - last_point, normal);
+	if ((center_dist - radius > 0 && last_center_dist - radius > 0) ||
+	    (center_dist + radius < 0 && last_center_dist + radius < 0)) {
+		return;
+	}
+
+	PointMass *pms = block.begin;
+	double side[COLLISION_BLOCK_SIZE];
+	#pragma omp simd
+	for (size_t i = 0; i < block.count; i++) {
+		double d_new = (pms[i].position.x - point.x) * normal.x +
+		               (pms[i].position.y - point.y) * normal.y +
+		               (pms[i].position.z - point.z) * normal.z;
+		double d_last = (pms[i].last_position.x - last_point.x) * normal.x +
+		                (pms[i].last_position.y - last_point.y) * normal.y +
+		                (pms[i].last_position.z - last_point.z) * normal.z;
+		side[i] = d_new * d_last;
+	}
+
+	for (size_t i = 0; i < block.count; i++) {
+		if (side[i] <= 0) {
+			resolve(pms[i]);
+			block.extend(pms[i].position);
 		}
-		// apply friction and update the position
-		pm.position = pm.last_position + (1.0 - friction) * vector;
 	}
 }
 
+void Plane::resolve(PointMass &pm) {
+	Vector3D vector_new = pm.position - point;
+	Vector3D vector_last = pm.last_position - (point - displacement);
+	// project the point onto the plane
+	Vector3D unit = normal.unit();
+	Vector3D tangent = pm.position - dot(unit, vector_new) * unit;
+	Vector3D vector;
+	// if the point is moving towards the plane, move it to the surface
+	// otherwise, move it away from the surface
+	if (dot(vector_last, normal) < 0) {
+		vector = tangent - normal * SURFACE_OFFSET - pm.last_position - displacement;
+	} else {
+		vector = tangent + normal * SURFACE_OFFSET - pm.last_position - displacement;
+	}
+	// apply friction relative to the plane's motion and update the position
+	pm.position = pm.last_position + displacement + (1.0 - friction) * vector;
+}
+
 void Plane::render(GLShader &shader) {
   nanogui::Color color(0.7f, 0.7f, 0.7f, 1.0f);
 
@@ -13,15 +13,23 @@ using namespace std;
 struct Plane : public CollisionObject {
 public:
   Plane(const Vector3D &point, const Vector3D &normal, double friction)
-      : point(point), normal(normal.unit()), friction(friction) {}
+      : point(point), normal(normal.unit()), friction(friction),
+        base_point(point) {}
 
   void render(GLShader &shader);
   void collide(PointMass &pm);
+  void collide(PointMassBlock &block);
 
   Vector3D point;
   Vector3D normal;
 
   double friction;
+
+private:
+  void resolve(PointMass &pm);
+  void moved() { point = base_point + translation; }
+
+  Vector3D base_point;
 };
 
 #endif /* COLLISIONOBJECT_PLANE_H */
@@ -0,0 +1,475 @@
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+#include <nanogui/nanogui.h>
+
+#include "../clothMesh.h"
+#include "../misc/hash.h"
+#include "sdfCollider.h"
+
+using namespace std;
+using namespace CGL;
+
+#define SURFACE_OFFSET 0.0001
+
+#define SDF_CACHE_MAGIC 0x31464453 // "SDF1"
+#define SDF_CACHE_VERSION 1
+
+namespace {
+
+// Closest-point feature of a triangle, used to pick the pseudonormal that
+// decides the sign of the distance.
+enum e_feature { FACE = 0, VERTEX_A, VERTEX_B, VERTEX_C, EDGE_AB, EDGE_BC, EDGE_CA };
+
+// Real-Time Collision Detection (Ericson), 5.1.5
+Vector3D closest_point_on_triangle(const Vector3D &p, const Vector3D &a,
+                                   const Vector3D &b, const Vector3D &c,
+                                   e_feature &feature) {
+  Vector3D ab = b - a;
+  Vector3D ac = c - a;
+  Vector3D ap = p - a;
+  double d1 = dot(ab, ap);
+  double d2 = dot(ac, ap);
+  if (d1 <= 0 && d2 <= 0) { feature = VERTEX_A; return a; }
+
+  Vector3D bp = p - b;
+  double d3 = dot(ab, bp);
+  double d4 = dot(ac, bp);
+  if (d3 >= 0 && d4 <= d3) { feature = VERTEX_B; return b; }
+
+  double vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+    feature = EDGE_AB;
+    return a + ab * (d1 / (d1 - d3));
+  }
+
+  Vector3D cp = p - c;
+  double d5 = dot(ab, cp);
+  double d6 = dot(ac, cp);
+  if (d6 >= 0 && d5 <= d6) { feature = VERTEX_C; return c; }
+
+  double vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+    feature = EDGE_CA;
+    return a + ac * (d2 / (d2 - d6));
+  }
+
+  double va = d3 * d6 - d5 * d4;
+  if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) {
+    feature = EDGE_BC;
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  }
+
+  double denom = 1.0 / (va + vb + vc);
+  feature = FACE;
+  return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+unsigned long long edge_key(int a, int b) {
+  if (a > b) swap(a, b);
+  return ((unsigned long long)a << 32) | (unsigned int)b;
+}
+
+} // namespace
+
+SDFCollider::SDFCollider(const string &obj_path, double friction,
+                         int resolution, int band)
+    : friction(friction), resolution(max(resolution, 4)), band(max(band, 1)),
+      nx(0), ny(0), nz(0), cell_size(0), band_width(0) {
+  ifstream file(obj_path.c_str(), ios::binary);
+  if (!file.good()) {
+    cout << "Error: Could not open SDF collider mesh: " << obj_path << endl;
+    return;
+  }
+  stringstream contents;
+  contents << file.rdbuf();
+  string obj = contents.str();
+
+  // The cache is only valid for the exact mesh and build parameters
+  unsigned long long key = Misc::fnv1a(obj.data(), obj.size());
+  key = Misc::fnv1a(&this->resolution, sizeof(int), key);
+  key = Misc::fnv1a(&this->band, sizeof(int), key);
+
+  if (!load_obj(obj)) {
+    cout << "Error: No triangles found in SDF collider mesh: " << obj_path << endl;
+    return;
+  }
+
+  string cache_path = obj_path + ".sdf";
+  if (!load_cache(cache_path, key)) {
+    build_grid();
+    if (!save_cache(cache_path, key)) {
+      cout << "Warn: Could not write SDF cache: " << cache_path << endl;
+    }
+  }
+
+  build_render_data();
+}
+
+bool SDFCollider::load_obj(const string &obj) {
+  istringstream in(obj);
+  string line;
+
+  while (getline(in, line)) {
+    istringstream ls(line);
+    string tag;
+    ls >> tag;
+
+    if (tag == "v") {
+      double x, y, z;
+      ls >> x >> y >> z;
+      vertices.push_back(Vector3D(x, y, z));
+    } else if (tag == "f") {
+      // Faces may be "i", "i/t", "i//n" or "i/t/n"; polygons are fanned
+      vector<int> face;
+      string vert;
+      while (ls >> vert) {
+        int idx = atoi(vert.c_str());
+        idx = idx < 0 ? (int)vertices.size() + idx : idx - 1;
+        face.push_back(idx);
+      }
+      for (size_t k = 2; k < face.size(); k++) {
+        indices.push_back(face[0]);
+        indices.push_back(face[k - 1]);
+        indices.push_back(face[k]);
+      }
+    }
+  }
+
+  for (int idx : indices) {
+    if (idx < 0 || idx >= (int)vertices.size()) {
+      indices.clear();
+      break;
+    }
+  }
+
+  return !indices.empty();
+}
+
+void SDFCollider::build_grid() {
+  int num_tris = indices.size() / 3;
+
+  Vector3D bmin = vertices[indices[0]];
+  Vector3D bmax = bmin;
+  for (int idx : indices) {
+    const Vector3D &v = vertices[idx];
+    bmin = Vector3D(min(bmin.x, v.x), min(bmin.y, v.y), min(bmin.z, v.z));
+    bmax = Vector3D(max(bmax.x, v.x), max(bmax.y, v.y), max(bmax.z, v.z));
+  }
+
+  Vector3D extent = bmax - bmin;
+  cell_size = max(extent.x, max(extent.y, extent.z)) / resolution;
+  band_width = band * cell_size;
+
+  // Pad by the band plus one cell so the boundary voxels are always outside
+  double pad = band_width + cell_size;
+  grid_min = bmin - Vector3D(pad, pad, pad);
+  nx = (int)ceil((extent.x + 2 * pad) / cell_size) + 1;
+  ny = (int)ceil((extent.y + 2 * pad) / cell_size) + 1;
+  nz = (int)ceil((extent.z + 2 * pad) / cell_size) + 1;
+
+  // Angle-weighted pseudonormals (Baerentzen & Aanaes) give a robust sign
+  // when the closest point lies on an edge or vertex.
+  vector<Vector3D> face_normals(num_tris);
+  vector<Vector3D> vertex_normals(vertices.size(), Vector3D(0, 0, 0));
+  unordered_map<unsigned long long, Vector3D> edge_sums;
+
+  for (int t = 0; t < num_tris; t++) {
+    const int *tri = &indices[3 * t];
+    Vector3D n = cross(vertices[tri[1]] - vertices[tri[0]],
+                       vertices[tri[2]] - vertices[tri[0]]);
+    if (n.norm2() > 0) n.normalize();
+    face_normals[t] = n;
+
+    for (int k = 0; k < 3; k++) {
+      const Vector3D &p = vertices[tri[k]];
+      Vector3D e1 = (vertices[tri[(k + 1) % 3]] - p);
+      Vector3D e2 = (vertices[tri[(k + 2) % 3]] - p);
+      double cosine = dot(e1, e2) / max(e1.norm() * e2.norm(), 1e-30);
+      double angle = acos(max(-1.0, min(1.0, cosine)));
+      vertex_normals[tri[k]] += angle * n;
+      edge_sums[edge_key(tri[k], tri[(k + 1) % 3])] += n;
+    }
+  }
+
+  vector<Vector3D> edge_normals(3 * num_tris);
+  for (int t = 0; t < num_tris; t++) {
+    const int *tri = &indices[3 * t];
+    for (int k = 0; k < 3; k++) {
+      edge_normals[3 * t + k] = edge_sums[edge_key(tri[k], tri[(k + 1) % 3])];
+    }
+  }
+
+  // Voxel-space bounds of each triangle, grown by the band
+  vector<int> tri_lo(3 * num_tris), tri_hi(3 * num_tris);
+  for (int t = 0; t < num_tris; t++) {
+    const int *tri = &indices[3 * t];
+    for (int axis = 0; axis < 3; axis++) {
+      double lo = min(vertices[tri[0]][axis], min(vertices[tri[1]][axis], vertices[tri[2]][axis]));
+      double hi = max(vertices[tri[0]][axis], max(vertices[tri[1]][axis], vertices[tri[2]][axis]));
+      int n = axis == 0 ? nx : (axis == 1 ? ny : nz);
+      tri_lo[3 * t + axis] = max(0, (int)floor((lo - band_width - grid_min[axis]) / cell_size));
+      tri_hi[3 * t + axis] = min(n - 1, (int)ceil((hi + band_width - grid_min[axis]) / cell_size));
+    }
+  }
+
+  distances.assign((size_t)nx * ny * nz, (float)band_width);
+  vector<char> in_band(distances.size(), 0);
+
+  // Each slice is written by exactly one thread
+  #pragma omp parallel for schedule(dynamic)
+  for (int z = 0; z < nz; z++) {
+    for (int t = 0; t < num_tris; t++) {
+      if (z < tri_lo[3 * t + 2] || z > tri_hi[3 * t + 2]) continue;
+
+      const int *tri = &indices[3 * t];
+      const Vector3D &a = vertices[tri[0]];
+      const Vector3D &b = vertices[tri[1]];
+      const Vector3D &c = vertices[tri[2]];
+
+      for (int y = tri_lo[3 * t + 1]; y <= tri_hi[3 * t + 1]; y++) {
+        for (int x = tri_lo[3 * t]; x <= tri_hi[3 * t]; x++) {
+          Vector3D p = grid_min + Vector3D(x, y, z) * cell_size;
+
+          e_feature feature;
+          Vector3D q = closest_point_on_triangle(p, a, b, c, feature);
+          double d = (p - q).norm();
+
+          size_t idx = ((size_t)z * ny + y) * nx + x;
+          if (d > band_width || (in_band[idx] && d >= fabs(distances[idx]))) continue;
+
+          Vector3D pseudonormal;
+          switch (feature) {
+          case FACE:     pseudonormal = face_normals[t]; break;
+          case VERTEX_A: pseudonormal = vertex_normals[tri[0]]; break;
+          case VERTEX_B: pseudonormal = vertex_normals[tri[1]]; break;
+          case VERTEX_C: pseudonormal = vertex_normals[tri[2]]; break;
+          case EDGE_AB:  pseudonormal = edge_normals[3 * t]; break;
+          case EDGE_BC:  pseudonormal = edge_normals[3 * t + 1]; break;
+          case EDGE_CA:  pseudonormal = edge_normals[3 * t + 2]; break;
+          }
+
+          distances[idx] = (float)(dot(p - q, pseudonormal) < 0 ? -d : d);
+          in_band[idx] = 1;
+        }
+      }
+    }
+  }
+
+  // Voxels outside the band take the sign of their region: anything reachable
+  // from the grid boundary without crossing the band is outside.
+  vector<char> outside(distances.size(), 0);
+  deque<size_t> queue;
+  for (int z = 0; z < nz; z++) {
+    for (int y = 0; y < ny; y++) {
+      for (int x = 0; x < nx; x++) {
+        if (x != 0 && y != 0 && z != 0 && x != nx - 1 && y != ny - 1 && z != nz - 1) continue;
+        size_t idx = ((size_t)z * ny + y) * nx + x;
+        if (!in_band[idx] && !outside[idx]) {
+          outside[idx] = 1;
+          queue.push_back(idx);
+        }
+      }
+    }
+  }
+
+  while (!queue.empty()) {
+    size_t idx = queue.front();
+    queue.pop_front();
+    int x = idx % nx;
+    int y = (idx / nx) % ny;
+    int z = idx / ((size_t)nx * ny);
+
+    const int offsets[6][3] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0},
+                               {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+    for (int k = 0; k < 6; k++) {
+      int x2 = x + offsets[k][0], y2 = y + offsets[k][1], z2 = z + offsets[k][2];
+      if (x2 < 0 || y2 < 0 || z2 < 0 || x2 >= nx || y2 >= ny || z2 >= nz) continue;
+      size_t idx2 = ((size_t)z2 * ny + y2) * nx + x2;
+      if (in_band[idx2] || outside[idx2]) continue;
+      outside[idx2] = 1;
+      queue.push_back(idx2);
+    }
+  }
+
+  for (size_t i = 0; i < distances.size(); i++) {
+    if (!in_band[i] && !outside[i]) {
+      distances[i] = (float)-band_width;
+    }
+  }
+}
+
+bool SDFCollider::load_cache(const string &cache_path, unsigned long long key) {
+  ifstream in(cache_path.c_str(), ios::binary);
+  if (!in.good()) return false;
+
+  uint32_t magic, version;
+  unsigned long long stored_key;
+  in.read((char *)&magic, sizeof(magic));
+  in.read((char *)&version, sizeof(version));
+  in.read((char *)&stored_key, sizeof(stored_key));
+  if (!in || magic != SDF_CACHE_MAGIC || version != SDF_CACHE_VERSION || stored_key != key) {
+    return false;
+  }
+
+  int dims[3];
+  double header[5];
+  in.read((char *)dims, sizeof(dims));
+  in.read((char *)header, sizeof(header));
+  if (!in || dims[0] < 2 || dims[1] < 2 || dims[2] < 2) return false;
+
+  vector<float> grid((size_t)dims[0] * dims[1] * dims[2]);
+  in.read((char *)grid.data(), grid.size() * sizeof(float));
+  if (!in) return false;
+
+  nx = dims[0];
+  ny = dims[1];
+  nz = dims[2];
+  grid_min = Vector3D(header[0], header[1], header[2]);
+  cell_size = header[3];
+  band_width = header[4];
+  distances.swap(grid);
+  return true;
+}
+
+bool SDFCollider::save_cache(const string &cache_path, unsigned long long key) const {
+  ofstream out(cache_path.c_str(), ios::binary | ios::trunc);
+  if (!out.good()) return false;
+
+  uint32_t magic = SDF_CACHE_MAGIC, version = SDF_CACHE_VERSION;
+  int dims[3] = {nx, ny, nz};
+  double header[5] = {grid_min.x, grid_min.y, grid_min.z, cell_size, band_width};
+
+  out.write((const char *)&magic, sizeof(magic));
+  out.write((const char *)&version, sizeof(version));
+  out.write((const char *)&key, sizeof(key));
+  out.write((const char *)dims, sizeof(dims));
+  out.write((const char *)header, sizeof(header));
+  out.write((const char *)distances.data(), distances.size() * sizeof(float));
+  return out.good();
+}
+
+double SDFCollider::distance(const Vector3D &p, Vector3D &gradient) const {
+  gradient = Vector3D(0, 0, 0);
+  if (distances.empty()) return band_width;
+
+  Vector3D g = (p - translation - grid_min) / cell_size;
+  if (g.x < 0 || g.y < 0 || g.z < 0 ||
+      g.x > nx - 1 || g.y > ny - 1 || g.z > nz - 1) {
+    return band_width;
+  }
+
+  int x = min((int)g.x, nx - 2);
+  int y = min((int)g.y, ny - 2);
+  int z = min((int)g.z, nz - 2);
+  double fx = g.x - x, fy = g.y - y, fz = g.z - z;
+
+  double c000 = at(x, y, z),         c100 = at(x + 1, y, z);
+  double c010 = at(x, y + 1, z),     c110 = at(x + 1, y + 1, z);
+  double c001 = at(x, y, z + 1),     c101 = at(x + 1, y, z + 1);
+  double c011 = at(x, y + 1, z + 1), c111 = at(x + 1, y + 1, z + 1);
+
+  // Interpolate along x, then y, then z
+  double c00 = c000 + (c100 - c000) * fx;
+  double c10 = c010 + (c110 - c010) * fx;
+  double c01 = c001 + (c101 - c001) * fx;
+  double c11 = c011 + (c111 - c011) * fx;
+  double c0 = c00 + (c10 - c00) * fy;
+  double c1 = c01 + (c11 - c01) * fy;
+
+  // Analytic derivative of the trilinear interpolant
+  gradient.x = ((c100 - c000) * (1 - fy) * (1 - fz) + (c110 - c010) * fy * (1 - fz) +
+                (c101 - c001) * (1 - fy) * fz + (c111 - c011) * fy * fz) / cell_size;
+  gradient.y = ((c10 - c00) * (1 - fz) + (c11 - c01) * fz) / cell_size;
+  gradient.z = (c1 - c0) / cell_size;
+
+  return c0 + (c1 - c0) * fz;
+}
+
+void SDFCollider::collide(PointMass &pm) {
+  Vector3D gradient;
+  double d = distance(pm.position, gradient);
+  if (d >= 0) return;
+
+  // Deep inside the clamped interior there is no direction to push along
+  if (gradient.norm2() == 0) return;
+
+  // Friction acts on the motion relative to the (possibly moving) mesh
+  Vector3D collision = pm.position - gradient.unit() * (d - SURFACE_OFFSET);
+  Vector3D corrected_point = collision - pm.last_position - displacement;
+  pm.position = pm.last_position + displacement + (1 - friction) * corrected_point;
+}
+
+bool SDFCollider::bounds(Vector3D &min, Vector3D &max) const {
+  // Nothing outside the grid is ever pushed
+  min = grid_min + translation;
+  max = grid_min + translation + Vector3D(nx - 1, ny - 1, nz - 1) * cell_size;
+  return true;
+}
+
+void SDFCollider::build_render_data() {
+  int num_verts = indices.size();
+
+  positions = MatrixXf(4, num_verts);
+  normals = MatrixXf(4, num_verts);
+  uvs = MatrixXf::Zero(2, num_verts);
+  tangents = MatrixXf(4, num_verts);
+
+  for (int i = 0; i < num_verts; i += 3) {
+    const Vector3D &p1 = vertices[indices[i]];
+    const Vector3D &p2 = vertices[indices[i + 1]];
+    const Vector3D &p3 = vertices[indices[i + 2]];
+    Vector3D n = cross(p2 - p1, p3 - p1);
+    if (n.norm2() > 0) n.normalize();
+
+    positions.col(i    ) << p1.x, p1.y, p1.z, 1.0;
+    positions.col(i + 1) << p2.x, p2.y, p2.z, 1.0;
+    positions.col(i + 2) << p3.x, p3.y, p3.z, 1.0;
+
+    normals.col(i    ) << n.x, n.y, n.z, 0.0;
+    normals.col(i + 1) << n.x, n.y, n.z, 0.0;
+    normals.col(i + 2) << n.x, n.y, n.z, 0.0;
+
+    tangents.col(i    ) << 1.0, 0.0, 0.0, 0.0;
+    tangents.col(i + 1) << 1.0, 0.0, 0.0, 0.0;
+    tangents.col(i + 2) << 1.0, 0.0, 0.0, 0.0;
+  }
+}
+
+void SDFCollider::render(GLShader &shader) {
+  if (positions.cols() == 0) return;
+
+  nanogui::Color color(0.7f, 0.7f, 0.7f, 1.0f);
+
+  Matrix4f model;
+  model.setIdentity();
+  model(0, 3) = translation.x;
+  model(1, 3) = translation.y;
+  model(2, 3) = translation.z;
+  shader.setUniform("u_model", model);
+
+  if (shader.uniform("u_color", false) != -1) {
+    shader.setUniform("u_color", color);
+  }
+  shader.uploadAttrib("in_position", positions);
+  if (shader.attrib("in_normal", false) != -1) {
+    shader.uploadAttrib("in_normal", normals);
+  }
+  if (shader.attrib("in_uv", false) != -1) {
+    shader.uploadAttrib("in_uv", uvs);
+  }
+  if (shader.attrib("in_tangent", false) != -1) {
+    shader.uploadAttrib("in_tangent", tangents, false);
+  }
+
+  shader.drawArray(GL_TRIANGLES, 0, positions.cols());
+
+  // Everything drawn after the mesh is in world space
+  model.setIdentity();
+  shader.setUniform("u_model", model);
+}
@@ -0,0 +1,71 @@
+#ifndef COLLISIONOBJECT_SDF_H
+#define COLLISIONOBJECT_SDF_H
+
+#include <string>
+#include <vector>
+
+#include <nanogui/nanogui.h>
+
+#include "../clothMesh.h"
+#include "collisionObject.h"
+
+using namespace nanogui;
+using namespace CGL;
+using namespace std;
+
+/**
+ * Collides against an arbitrary static triangle mesh loaded from an OBJ file.
+ *
+ * At load time the mesh is voxelized into a narrow-band signed distance grid
+ * (negative inside). Voxels outside the band are clamped to +/- band width,
+ * with their sign recovered by flood-filling from the grid boundary. The grid
+ * is cached next to the OBJ file as "<obj>.sdf" and reused as long as the
+ * mesh contents and build parameters are unchanged.
+ */
+struct SDFCollider : public CollisionObject {
+public:
+  SDFCollider(const string &obj_path, double friction, int resolution = 64,
+              int band = 3);
+
+  void render(GLShader &shader);
+  void collide(PointMass &pm);
+  bool bounds(Vector3D &min, Vector3D &max) const;
+
+  // Trilinear signed distance at p and its gradient. Points outside the grid
+  // report the band width (i.e. "far outside").
+  double distance(const Vector3D &p, Vector3D &gradient) const;
+
+  bool loaded() const { return !distances.empty(); }
+
+  double friction;
+
+private:
+  bool load_obj(const string &obj_path);
+  void build_grid();
+  bool load_cache(const string &cache_path, unsigned long long key);
+  bool save_cache(const string &cache_path, unsigned long long key) const;
+  void build_render_data();
+
+  float &at(int x, int y, int z) { return distances[(z * ny + y) * nx + x]; }
+  float at(int x, int y, int z) const { return distances[(z * ny + y) * nx + x]; }
+
+  // Source mesh
+  vector<Vector3D> vertices;
+  vector<int> indices;
+
+  // Distance grid
+  int resolution;
+  int band;
+  int nx, ny, nz;
+  Vector3D grid_min;
+  double cell_size;
+  double band_width;
+  vector<float> distances;
+
+  MatrixXf positions;
+  MatrixXf normals;
+  MatrixXf uvs;
+  MatrixXf tangents;
+};
+
+#endif /* COLLISIONOBJECT_SDF_H */
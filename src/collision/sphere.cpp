@@ -9,16 +9,55 @@ using namespace CGL;
 
 void Sphere::collide(PointMass &pm) {
 	Vector3D direction = (pm.position - this->origin);
-	if(direction.norm() <= this->radius)
+	if(direction.norm2() <= this->radius2)
 	{
-		Vector3D collision = this->origin + direction.unit() * this->radius;
-		Vector3D corrected_point = collision - pm.last_position;
-		pm.position = pm.last_position + (1-this->friction) * corrected_point;
+		resolve(pm);
 	}
 }
 
+void Sphere::collide(PointMassBlock &block) {
+	// Reject the block if its bounds are entirely outside the sphere
+	double dx = max(0.0, max(block.min.x - origin.x, origin.x - block.max.x));
+	double dy = max(0.0, max(block.min.y - origin.y, origin.y - block.max.y));
+	double dz = max(0.0, max(block.min.z - origin.z, origin.z - block.max.z));
+	if (dx * dx + dy * dy + dz * dz > radius2) return;
+
+	// Branch-free distance pass, then resolve the (few) contacts
+	PointMass *pms = block.begin;
+	double dist2[COLLISION_BLOCK_SIZE];
+	#pragma omp simd
+	for (size_t i = 0; i < block.count; i++) {
+		double px = pms[i].position.x - origin.x;
+		double py = pms[i].position.y - origin.y;
+		double pz = pms[i].position.z - origin.z;
+		dist2[i] = px * px + py * py + pz * pz;
+	}
+
+	for (size_t i = 0; i < block.count; i++) {
+		if (dist2[i] <= radius2) {
+			resolve(pms[i]);
+			block.extend(pms[i].position);
+		}
+	}
+}
+
+void Sphere::resolve(PointMass &pm) {
+	Vector3D direction = (pm.position - this->origin);
+	Vector3D collision = this->origin + direction.unit() * this->radius;
+	// Friction acts on the motion relative to the (possibly moving) sphere
+	Vector3D corrected_point = collision - pm.last_position - displacement;
+	pm.position = pm.last_position + displacement + (1-this->friction) * corrected_point;
+}
+
+bool Sphere::bounds(Vector3D &min, Vector3D &max) const {
+	min = origin - Vector3D(radius, radius, radius);
+	max = origin + Vector3D(radius, radius, radius);
+	return true;
+}
+
 void Sphere::render(GLShader &shader) {
   // We decrease the radius here so flat triangles don't behave strangely
-  // and intersect with the sphere when rendered
-  m_sphere_mesh.draw_sphere(shader, origin, radius * 0.92);
+  // and intersect with the sphere when rendered. The sphere is drawn with
+  // the other instances of its mesh by SphereMesh::draw_all_instances.
+  m_sphere_mesh->add_instance(origin, radius * 0.92);
 }
@@ -11,20 +11,27 @@ using namespace std;
 struct Sphere : public CollisionObject {
 public:
   Sphere(const Vector3D &origin, double radius, double friction, int num_lat = 40, int num_lon = 40)
-      : origin(origin), radius(radius), radius2(radius * radius),
-        friction(friction), m_sphere_mesh(Misc::SphereMesh(num_lat, num_lon)) {}
+      : origin(origin), base_origin(origin), radius(radius), radius2(radius * radius),
+        friction(friction), m_sphere_mesh(Misc::SphereMesh::shared(num_lat, num_lon)) {}
 
   void render(GLShader &shader);
   void collide(PointMass &pm);
+  void collide(PointMassBlock &block);
+  bool bounds(Vector3D &min, Vector3D &max) const;
 
 private:
+  void resolve(PointMass &pm);
+  void moved() { origin = base_origin + translation; }
+
   Vector3D origin;
+  Vector3D base_origin;
   double radius;
   double radius2;
 
   double friction;
   
-  Misc::SphereMesh m_sphere_mesh;
+  // Shared with every sphere of the same resolution, so they draw as instances
+  Misc::SphereMesh *m_sphere_mesh;
 };
 
 #endif /* COLLISIONOBJECT_SPHERE_H */
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "frameCapture.h"
+
+// Frames read back at once; a frame is mapped this many captures later
+#define FRAME_CAPTURE_READBACKS 3
+
+// Images that may wait for an encoder, per encoder
+#define FRAME_CAPTURE_QUEUE_PER_THREAD 2
+
+FrameCapture::FrameCapture(int num_threads)
+    : num_frames(0), framebuffer(0), color_buffer(0), depth_buffer(0), fb_width(0),
+      fb_height(0), next_readback(0), running(false), failed(false) {
+  if (num_threads <= 0) num_threads = thread::hardware_concurrency();
+  this->num_threads = max(1, num_threads);
+}
+
+FrameCapture::~FrameCapture() {
+  close();
+  if (framebuffer) glDeleteFramebuffers(1, &framebuffer);
+  if (color_buffer) glDeleteRenderbuffers(1, &color_buffer);
+  if (depth_buffer) glDeleteRenderbuffers(1, &depth_buffer);
+}
+
+bool FrameCapture::open(const string &filename) {
+  if (running) return false;
+
+  // Fail now rather than on the first frame if its file cannot be written.
+  // The probe leaves an existing file as it was, and removes one it created,
+  // so a capture that never gets a frame leaves nothing behind.
+  this->filename = filename;
+  string first_frame = frame_filename(1);
+  FILE *existing = fopen(first_frame.c_str(), "rb");
+  if (existing) fclose(existing);
+  FILE *first = fopen(first_frame.c_str(), existing ? "r+b" : "wb");
+  if (!first) {
+    cerr << "Error: Cannot write frame " << first_frame << endl;
+    return false;
+  }
+  fclose(first);
+  if (!existing) remove(first_frame.c_str());
+
+  num_frames = 0;
+  failed = false;
+  running = true;
+  for (size_t i = 0; i < num_threads; i++) {
+    encoders.push_back(thread(&FrameCapture::encode, this));
+  }
+  return true;
+}
+
+bool FrameCapture::create_framebuffer(int width, int height) {
+  GLint max_size = 0;
+  glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_size);
+  if (width < 1 || height < 1 || width > max_size || height > max_size) {
+    cerr << "Error: Cannot render offscreen at " << width << "x" << height << ", the limit is "
+         << max_size << endl;
+    return false;
+  }
+
+  glGenRenderbuffers(1, &color_buffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, color_buffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glGenRenderbuffers(1, &depth_buffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+                            depth_buffer);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    cerr << "Error: Offscreen framebuffer is incomplete (0x" << hex << status << dec << ")" << endl;
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &color_buffer);
+    glDeleteRenderbuffers(1, &depth_buffer);
+    framebuffer = color_buffer = depth_buffer = 0;
+    return false;
+  }
+  fb_width = width;
+  fb_height = height;
+  return true;
+}
+
+void FrameCapture::bind_framebuffer() {
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glViewport(0, 0, fb_width, fb_height);
+}
+
+void FrameCapture::capture() {
+  if (!running) return;
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  // A minimized window has nothing to record
+  if (viewport[2] <= 0 || viewport[3] <= 0) return;
+
+  if (readbacks.empty()) {
+    readbacks.resize(FRAME_CAPTURE_READBACKS);
+    for (Readback &readback : readbacks) {
+      memset(&readback, 0, sizeof(readback));
+      glGenBuffers(1, &readback.buffer);
+    }
+  }
+
+  // The oldest readback's slot is reused, so it is mapped first; with a few
+  // frames in between, the GPU has long finished it
+  Readback &readback = readbacks[next_readback];
+  if (readback.fence) finish_readback(readback);
+  next_readback = (next_readback + 1) % readbacks.size();
+
+  readback.index = ++num_frames;
+  readback.width = viewport[2];
+  readback.height = viewport[3];
+
+  size_t size = (size_t)readback.width * readback.height * 4;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+  if (readback.capacity < size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    readback.capacity = size;
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(viewport[0], viewport[1], readback.width, readback.height, GL_RGBA,
+               GL_UNSIGNED_BYTE, nullptr);
+  readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void FrameCapture::finish_readback(Readback &readback) {
+  while (glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) ==
+         GL_TIMEOUT_EXPIRED) {
+  }
+  glDeleteSync(readback.fence);
+  readback.fence = 0;
+
+  Image image;
+  {
+    unique_lock<mutex> lock(queue_mutex);
+    image_done.wait(lock, [this] {
+      return queue.size() < num_threads * FRAME_CAPTURE_QUEUE_PER_THREAD || failed;
+    });
+    if (failed) return;
+    if (!free_images.empty()) {
+      image = move(free_images.back());
+      free_images.pop_back();
+    }
+  }
+
+  image.index = readback.index;
+  image.png.width = readback.width;
+  image.png.height = readback.height;
+  size_t stride = (size_t)readback.width * 4;
+  image.png.pixels.resize(stride * readback.height);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+  const unsigned char *pixels = (const unsigned char *)glMapBufferRange(
+      GL_PIXEL_PACK_BUFFER, 0, stride * readback.height, GL_MAP_READ_BIT);
+  if (pixels) {
+    // GL rows start at the bottom, PNG rows at the top; the scene's alpha
+    // is not coverage, so frames are written opaque
+    for (int y = 0; y < readback.height; y++) {
+      unsigned char *row = &image.png.pixels[(readback.height - 1 - y) * stride];
+      memcpy(row, pixels + y * stride, stride);
+      for (size_t i = 3; i < stride; i += 4) row[i] = 255;
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    if (!pixels) {
+      cerr << "Error: Cannot read back frame " << image.index << endl;
+      failed = true;
+      return;
+    }
+    queue.push_back(move(image));
+  }
+  image_queued.notify_one();
+}
+
+bool FrameCapture::close() {
+  if (!running) return !failed;
+
+  for (size_t i = 0; i < readbacks.size(); i++) {
+    Readback &readback = readbacks[(next_readback + i) % readbacks.size()];
+    if (readback.fence) finish_readback(readback);
+  }
+  for (Readback &readback : readbacks) {
+    glDeleteBuffers(1, &readback.buffer);
+  }
+  readbacks.clear();
+  next_readback = 0;
+
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    running = false;
+  }
+  image_queued.notify_all();
+  for (thread &encoder : encoders) {
+    encoder.join();
+  }
+  encoders.clear();
+  queue.clear();
+  free_images.clear();
+  return !failed;
+}
+
+void FrameCapture::encode() {
+  while (true) {
+    Image image;
+    // Once a frame has failed, the rest are only recycled
+    bool skip;
+    {
+      unique_lock<mutex> lock(queue_mutex);
+      image_queued.wait(lock, [this] { return !queue.empty() || !running; });
+      if (queue.empty()) return;
+      image = move(queue.front());
+      queue.pop_front();
+      skip = failed;
+    }
+
+    string name = frame_filename(image.index);
+    bool ok = skip || CGL::PNGParser::save(name.c_str(), image.png) == 0;
+
+    {
+      lock_guard<mutex> lock(queue_mutex);
+      if (!ok && !failed) {
+        cerr << "Error: Cannot write frame " << name << endl;
+        failed = true;
+      }
+      free_images.push_back(move(image));
+    }
+    image_done.notify_one();
+  }
+}
+
+string FrameCapture::frame_filename(int index) const {
+  size_t slash = filename.find_last_of("/\\");
+  size_t dot = filename.rfind('.');
+  if (dot == string::npos || (slash != string::npos && dot < slash)) dot = filename.size();
+  char number[16];
+  snprintf(number, sizeof(number), "_%05d", index);
+  string extension = dot < filename.size() ? filename.substr(dot) : ".png";
+  return filename.substr(0, dot) + number + extension;
+}
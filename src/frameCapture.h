@@ -0,0 +1,111 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nanogui/opengl.h>
+
+#include "png.h"
+
+using namespace std;
+
+/**
+ * Records rendered frames as a numbered PNG sequence, name_00001.png and so
+ * on, without stalling the render loop.
+ *
+ * Each capture() starts an asynchronous glReadPixels into one of a ring of
+ * pixel buffer objects and returns at once; a frame's pixels are only mapped
+ * a couple of frames later, once its fence says the GPU is done with it.
+ * The mapped pixels are copied into a pooled image and encoded and written
+ * by a pool of threads, several frames at a time. The render loop only
+ * waits when encoding falls behind by more frames than the pool queues;
+ * frames are never dropped.
+ *
+ * Frames can also be rendered into an offscreen framebuffer of any size
+ * instead of the window, for rendering previews on machines without a
+ * display, e.g. with Mesa's llvmpipe under a virtual X server.
+ *
+ * Every GL call must come from the thread that owns the context.
+ */
+class FrameCapture {
+public:
+  // num_threads encoders, or one per core if 0
+  FrameCapture(int num_threads = 0);
+  ~FrameCapture();
+
+  // Starts a sequence of files named after filename, and the encoders.
+  // False if the first file cannot be created.
+  bool open(const string &filename);
+
+  // Creates the offscreen framebuffer to draw and read frames in. False if
+  // the GL implementation cannot make one of this size.
+  bool create_framebuffer(int width, int height);
+  bool has_framebuffer() const { return framebuffer != 0; }
+  int framebuffer_width() const { return fb_width; }
+  int framebuffer_height() const { return fb_height; }
+  // Binds the offscreen framebuffer and sets the viewport to cover it
+  void bind_framebuffer();
+
+  // Starts reading back the viewport of the framebuffer bound for reading,
+  // as the next frame
+  void capture();
+
+  // Reads back and writes out every captured frame, and stops the encoders.
+  // False if any frame could not be written.
+  bool close();
+
+  bool is_open() const { return running; }
+  // Frames captured since the sequence opened
+  int frame_count() const { return num_frames; }
+
+private:
+  // A frame being read back into a pixel buffer object
+  struct Readback {
+    GLuint buffer;
+    size_t capacity;
+    GLsync fence;
+    int index;
+    int width;
+    int height;
+  };
+
+  struct Image {
+    int index;
+    CGL::PNG png;
+  };
+
+  void finish_readback(Readback &readback);
+  void encode();
+  string frame_filename(int index) const;
+
+  string filename;
+  int num_frames;
+
+  GLuint framebuffer;
+  GLuint color_buffer;
+  GLuint depth_buffer;
+  int fb_width;
+  int fb_height;
+
+  // Pending readbacks in capture order, oldest at next_readback
+  vector<Readback> readbacks;
+  size_t next_readback;
+
+  // Images waiting for an encoder, and written ones to reuse
+  size_t num_threads;
+  deque<Image> queue;
+  vector<Image> free_images;
+  mutex queue_mutex;
+  condition_variable image_queued;
+  condition_variable image_done;
+  bool running;
+  bool failed;
+  vector<thread> encoders;
+};
+
+#endif /* FRAME_CAPTURE_H */
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <nanogui/nanogui.h>
@@ -9,41 +10,54 @@
 #include <getopt.h>
 #include <unistd.h>
 #endif
-#include <unordered_set>
 #include <stdlib.h> // atoi for getopt inputs
 
 #include "CGL/CGL.h"
 #include "collision/plane.h"
+#include "collision/sdfCollider.h"
 #include "collision/sphere.h"
 #include "cloth.h"
 #include "clothSimulator.h"
-#include "json.hpp"
+#include "frameCapture.h"
+#include "meshExport.h"
 #include "misc/file_utils.h"
+#include "sceneLoader.h"
+#include "simulation.h"
 
 typedef uint32_t gid_t;
 
 using namespace std;
 using namespace nanogui;
 
-using json = nlohmann::json;
-
 #define msg(s) cerr << "[ClothSim] " << s << endl;
 
-const string SPHERE = "sphere";
-const string PLANE = "plane";
-const string CLOTH = "cloth";
-
-const unordered_set<string> VALID_KEYS = {SPHERE, PLANE, CLOTH};
+// Longest an idle window sleeps before checking for changes that come
+// without an input event, such as edited shaders
+#define IDLE_WAIT_SECONDS 0.25
+// nanogui shows a tooltip once the pointer has rested for half a second, so
+// the window is drawn again a little after the last event
+#define TOOLTIP_REDRAW_SECONDS 0.6
 
 ClothSimulator *app = nullptr;
 GLFWwindow *window = nullptr;
 Screen *screen = nullptr;
 
+// Set by every input and window event; the window is otherwise only redrawn
+// while the simulation runs
+bool redraw_requested = true;
+double tooltip_redraw_time = 0;
+
+void requestRedraw() {
+  redraw_requested = true;
+  tooltip_redraw_time = glfwGetTime() + TOOLTIP_REDRAW_SECONDS;
+}
+
 void error_callback(int error, const char* description) {
   puts(description);
 }
 
-void createGLContexts() {
+// A hidden window still provides the GL context for offscreen rendering
+void createGLContexts(bool visible = true) {
   if (!glfwInit()) {
     return;
   }
@@ -63,6 +77,7 @@ void createGLContexts() {
   glfwWindowHint(GLFW_STENCIL_BITS, 8);
   glfwWindowHint(GLFW_DEPTH_BITS, 24);
   glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
+  glfwWindowHint(GLFW_VISIBLE, visible ? GL_TRUE : GL_FALSE);
 
   // Create a GLFWwindow object
   window = glfwCreateWindow(800, 800, "Cloth Simulator", nullptr, nullptr);
@@ -94,6 +109,7 @@ void createGLContexts() {
 
 void setGLFWCallbacks() {
   glfwSetCursorPosCallback(window, [](GLFWwindow *, double x, double y) {
+    requestRedraw();
     if (!screen->cursorPosCallbackEvent(x, y)) {
       app->cursorPosCallbackEvent(x / screen->pixelRatio(),
                                   y / screen->pixelRatio());
@@ -102,6 +118,7 @@ void setGLFWCallbacks() {
 
   glfwSetMouseButtonCallback(
       window, [](GLFWwindow *, int button, int action, int modifiers) {
+        requestRedraw();
         if (!screen->mouseButtonCallbackEvent(button, action, modifiers) ||
             action == GLFW_RELEASE) {
           app->mouseButtonCallbackEvent(button, action, modifiers);
@@ -110,22 +127,26 @@ void setGLFWCallbacks() {
 
   glfwSetKeyCallback(
       window, [](GLFWwindow *, int key, int scancode, int action, int mods) {
+        requestRedraw();
         if (!screen->keyCallbackEvent(key, scancode, action, mods)) {
           app->keyCallbackEvent(key, scancode, action, mods);
         }
       });
 
   glfwSetCharCallback(window, [](GLFWwindow *, unsigned int codepoint) {
+    requestRedraw();
     screen->charCallbackEvent(codepoint);
   });
 
   glfwSetDropCallback(window,
                       [](GLFWwindow *, int count, const char **filenames) {
+                        requestRedraw();
                         screen->dropCallbackEvent(count, filenames);
                         app->dropCallbackEvent(count, filenames);
                       });
 
   glfwSetScrollCallback(window, [](GLFWwindow *, double x, double y) {
+    requestRedraw();
     if (!screen->scrollCallbackEvent(x, y)) {
       app->scrollCallbackEvent(x, y);
     }
@@ -133,9 +154,13 @@ void setGLFWCallbacks() {
 
   glfwSetFramebufferSizeCallback(window,
                                  [](GLFWwindow *, int width, int height) {
+                                   requestRedraw();
                                    screen->resizeCallbackEvent(width, height);
                                    app->resizeCallbackEvent(width, height);
                                  });
+
+  // Uncovered or restored windows need their contents again
+  glfwSetWindowRefreshCallback(window, [](GLFWwindow *) { requestRedraw(); });
 }
 
 void usageError(const char *binaryName) {
@@ -147,223 +172,20 @@ void usageError(const char *binaryName) {
   printf("                     Automatically searched for by default.\n");
   printf("  -a     <INT>       Sphere vertices latitude direction.\n");
   printf("  -o     <INT>       Sphere vertices longitude direction.\n");
+  printf("  -m                 Generate texture mipmaps.\n");
+  printf("  -b     <STRING>    Write the scene to a binary scene file and exit.\n");
+  printf("                     Binary scenes load with -f like JSON ones.\n");
+  printf("  -e     <STRING>    Export the balloon meshes of every simulated frame.\n");
+  printf("                     Names ending in .obj or .ply write a file per frame;\n");
+  printf("                     others one binary mesh sequence (see meshExport.h).\n");
+  printf("  -c     <STRING>    Record every simulated frame as name_00001.png and on.\n");
+  printf("  -s     <INT>x<INT> Render offscreen at this size in a hidden window and\n");
+  printf("                     record from the start; needs -c and -n.\n");
+  printf("  -n     <INT>       Exit after recording this many frames.\n");
   printf("\n");
   exit(-1);
 }
 
-void incompleteObjectError(const char *object, const char *attribute) {
-  cout << "Incomplete " << object << " definition, missing " << attribute << endl;
-  exit(-1);
-}
-
-bool loadObjectsFromFile(string filename, Cloth *cloth, ClothParameters *cp, vector<CollisionObject *>* objects, int sphere_num_lat, int sphere_num_lon) {
-  // Read JSON from file
-  ifstream i(filename);
-  if (!i.good()) {
-    return false;
-  }
-  json j;
-  i >> j;
-
-  // Loop over objects in scene
-  for (json::iterator it = j.begin(); it != j.end(); ++it) {
-    string key = it.key();
-
-    // Check that object is valid
-    unordered_set<string>::const_iterator query = VALID_KEYS.find(key);
-    if (query == VALID_KEYS.end()) {
-      cout << "Invalid scene object found: " << key << endl;
-      exit(-1);
-    }
-
-    // Retrieve object
-    json object = it.value();
-
-    // Parse object depending on type (cloth, sphere, or plane)
-    if (key == CLOTH) {
-      // Cloth
-      double width, height;
-      int num_width_points, num_height_points;
-      float thickness;
-      e_orientation orientation;
-      vector<vector<int>> pinned;
-
-      auto it_width = object.find("width");
-      if (it_width != object.end()) {
-        width = *it_width;
-      } else {
-        incompleteObjectError("cloth", "width");
-      }
-
-      auto it_height = object.find("height");
-      if (it_height != object.end()) {
-        height = *it_height;
-      } else {
-        incompleteObjectError("cloth", "height");
-      }
-
-      auto it_num_width_points = object.find("num_width_points");
-      if (it_num_width_points != object.end()) {
-        num_width_points = *it_num_width_points;
-      } else {
-        incompleteObjectError("cloth", "num_width_points");
-      }
-
-      auto it_num_height_points = object.find("num_height_points");
-      if (it_num_height_points != object.end()) {
-        num_height_points = *it_num_height_points;
-      } else {
-        incompleteObjectError("cloth", "num_height_points");
-      }
-
-      auto it_thickness = object.find("thickness");
-      if (it_thickness != object.end()) {
-        thickness = *it_thickness;
-      } else {
-        incompleteObjectError("cloth", "thickness");
-      }
-
-      auto it_orientation = object.find("orientation");
-      if (it_orientation != object.end()) {
-        orientation = *it_orientation;
-      } else {
-        incompleteObjectError("cloth", "orientation");
-      }
-
-      auto it_pinned = object.find("pinned");
-      if (it_pinned != object.end()) {
-        vector<json> points = *it_pinned;
-        for (auto pt : points) {
-          vector<int> point = pt;
-          pinned.push_back(point);
-        }
-      }
-
-      cloth->width = width;
-      cloth->height = height;
-      cloth->num_width_points = num_width_points;
-      cloth->num_height_points = num_height_points;
-      cloth->thickness = thickness;
-      cloth->orientation = orientation;
-      cloth->pinned = pinned;
-
-      // Cloth parameters
-      bool enable_structural_constraints, enable_shearing_constraints, enable_bending_constraints;
-      double damping, density, ks;
-
-      auto it_enable_structural = object.find("enable_structural");
-      if (it_enable_structural != object.end()) {
-        enable_structural_constraints = *it_enable_structural;
-      } else {
-        incompleteObjectError("cloth", "enable_structural");
-      }
-
-      auto it_enable_shearing = object.find("enable_shearing");
-      if (it_enable_shearing != object.end()) {
-        enable_shearing_constraints = *it_enable_shearing;
-      } else {
-        incompleteObjectError("cloth", "it_enable_shearing");
-      }
-
-      auto it_enable_bending = object.find("enable_bending");
-      if (it_enable_bending != object.end()) {
-        enable_bending_constraints = *it_enable_bending;
-      } else {
-        incompleteObjectError("cloth", "it_enable_bending");
-      }
-
-      auto it_damping = object.find("damping");
-      if (it_damping != object.end()) {
-        damping = *it_damping;
-      } else {
-        incompleteObjectError("cloth", "damping");
-      }
-
-      auto it_density = object.find("density");
-      if (it_density != object.end()) {
-        density = *it_density;
-      } else {
-        incompleteObjectError("cloth", "density");
-      }
-
-      auto it_ks = object.find("ks");
-      if (it_ks != object.end()) {
-        ks = *it_ks;
-      } else {
-        incompleteObjectError("cloth", "ks");
-      }
-
-      cp->enable_structural_constraints = enable_structural_constraints;
-      cp->enable_shearing_constraints = enable_shearing_constraints;
-      cp->enable_bending_constraints = enable_bending_constraints;
-      cp->density = density;
-      cp->damping = damping;
-      cp->ks = ks;
-    } else if (key == SPHERE) {
-      Vector3D origin;
-      double radius, friction;
-
-      auto it_origin = object.find("origin");
-      if (it_origin != object.end()) {
-        vector<double> vec_origin = *it_origin;
-        origin = Vector3D(vec_origin[0], vec_origin[1], vec_origin[2]);
-      } else {
-        incompleteObjectError("sphere", "origin");
-      }
-
-      auto it_radius = object.find("radius");
-      if (it_radius != object.end()) {
-        radius = *it_radius;
-      } else {
-        incompleteObjectError("sphere", "radius");
-      }
-
-      auto it_friction = object.find("friction");
-      if (it_friction != object.end()) {
-        friction = *it_friction;
-      } else {
-        incompleteObjectError("sphere", "friction");
-      }
-
-      Sphere *s = new Sphere(origin, radius, friction, sphere_num_lat, sphere_num_lon);
-      objects->push_back(s);
-    } else { // PLANE
-      Vector3D point, normal;
-      double friction;
-
-      auto it_point = object.find("point");
-      if (it_point != object.end()) {
-        vector<double> vec_point = *it_point;
-        point = Vector3D(vec_point[0], vec_point[1], vec_point[2]);
-      } else {
-        incompleteObjectError("plane", "point");
-      }
-
-      auto it_normal = object.find("normal");
-      if (it_normal != object.end()) {
-        vector<double> vec_normal = *it_normal;
-        normal = Vector3D(vec_normal[0], vec_normal[1], vec_normal[2]);
-      } else {
-        incompleteObjectError("plane", "normal");
-      }
-
-      auto it_friction = object.find("friction");
-      if (it_friction != object.end()) {
-        friction = *it_friction;
-      } else {
-        incompleteObjectError("plane", "friction");
-      }
-
-      Plane *p = new Plane(point, normal, friction);
-      objects->push_back(p);
-    }
-  }
-
-  i.close();
-  
-  return true;
-}
-
 bool is_valid_project_root(const std::string& search_path) {
     std::stringstream ss;
     ss << search_path;
@@ -396,9 +218,7 @@ int main(int argc, char **argv) {
   std::string project_root;
   bool found_project_root = find_project_root(search_paths, project_root);
   
-  Cloth cloth;
-  ClothParameters cp;
-  vector<CollisionObject *> objects;
+  Simulation simulation;
   
   int c;
   
@@ -408,7 +228,17 @@ int main(int argc, char **argv) {
   std::string file_to_load_from;
   bool file_specified = false;
   
-  while ((c = getopt (argc, argv, "f:r:a:o:")) != -1) {
+  bool generate_mipmaps = false;
+
+  std::string binary_file_to_write;
+  std::string mesh_export_file;
+
+  std::string capture_file;
+  int offscreen_width = 0;
+  int offscreen_height = 0;
+  int frames_to_capture = 0;
+  
+  while ((c = getopt (argc, argv, "f:r:a:o:mb:e:c:s:n:")) != -1) {
     switch (c) {
       case 'f': {
         file_to_load_from = optarg;
@@ -439,6 +269,33 @@ int main(int argc, char **argv) {
         sphere_num_lon = arg_int;
         break;
       }
+      case 'm': {
+        generate_mipmaps = true;
+        break;
+      }
+      case 'b': {
+        binary_file_to_write = optarg;
+        break;
+      }
+      case 'e': {
+        mesh_export_file = optarg;
+        break;
+      }
+      case 'c': {
+        capture_file = optarg;
+        break;
+      }
+      case 's': {
+        if (sscanf(optarg, "%dx%d", &offscreen_width, &offscreen_height) != 2 ||
+            offscreen_width < 1 || offscreen_height < 1) {
+          usageError(argv[0]);
+        }
+        break;
+      }
+      case 'n': {
+        frames_to_capture = std::max(atoi(optarg), 0);
+        break;
+      }
       default: {
         usageError(argv[0]);
         break;
@@ -446,6 +303,11 @@ int main(int argc, char **argv) {
     }
   }
   
+  bool offscreen = offscreen_width > 0;
+  if (offscreen && (capture_file.empty() || frames_to_capture == 0)) {
+    usageError(argv[0]);
+  }
+
   if (!found_project_root) {
     std::cout << "Error: Could not find required file \"shaders/Default.vert\" anywhere!" << std::endl;
     return -1;
@@ -460,29 +322,60 @@ int main(int argc, char **argv) {
     file_to_load_from = def_fname.str();
   }
   
-  bool success = loadObjectsFromFile(file_to_load_from, &cloth, &cp, &objects, sphere_num_lat, sphere_num_lon);
+  if (!binary_file_to_write.empty()) {
+    if (!convertScene(file_to_load_from, binary_file_to_write)) {
+      std::cout << "Error: Unable to convert " << file_to_load_from << " to " << binary_file_to_write << std::endl;
+      return -1;
+    }
+    std::cout << "Wrote binary scene " << binary_file_to_write << std::endl;
+    return 0;
+  }
+
+  // Decode textures in the background while the scene loads and the window
+  // and GL context are created
+  ClothSimulator::prefetch_textures(project_root);
+
+  bool success = simulation.load(file_to_load_from, sphere_num_lat, sphere_num_lon);
   if (!success) {
     std::cout << "Warn: Unable to load from file: " << file_to_load_from << std::endl;
   }
 
   glfwSetErrorCallback(error_callback);
 
-  createGLContexts();
-
-  // Initialize the Cloth object
-  cloth.buildGrid();
-  cloth.buildClothMesh();
+  createGLContexts(!offscreen);
 
   // Initialize the ClothSimulator object
-  app = new ClothSimulator(project_root, screen);
-  app->loadCloth(&cloth);
-  app->loadClothParameters(&cp);
-  app->loadCollisionObjects(&objects);
+  app = new ClothSimulator(project_root, screen, generate_mipmaps);
+  app->loadSimulation(&simulation);
+  MeshSequenceWriter mesh_export;
+  if (!mesh_export_file.empty()) {
+    if (!mesh_export.open(mesh_export_file, simulation.cloths)) {
+      return -1;
+    }
+    app->exportMeshes(&mesh_export);
+  }
+  FrameCapture frame_capture;
+  if (!capture_file.empty()) {
+    if (!frame_capture.open(capture_file)) {
+      return -1;
+    }
+    app->captureFrames(&frame_capture);
+  }
   app->init();
 
+  if (offscreen) {
+    if (!frame_capture.create_framebuffer(offscreen_width, offscreen_height)) {
+      return -1;
+    }
+    app->resizeCallbackEvent(offscreen_width, offscreen_height);
+    app->setPaused(false);
+  }
+
   // Call this after all the widgets have been defined
 
-  screen->setVisible(true);
+  if (!offscreen) {
+    screen->setVisible(true);
+  }
   screen->performLayout();
 
   // Attach callbacks to the GLFW window
@@ -490,23 +383,65 @@ int main(int argc, char **argv) {
   setGLFWCallbacks();
 
   while (!glfwWindowShouldClose(window)) {
-    glfwPollEvents();
+    // Frames that would look like the last one are not drawn; an unchanged
+    // window sleeps until an event arrives
+    bool animating = offscreen || app->needsRedraw();
+    if (animating || redraw_requested) {
+      glfwPollEvents();
+    } else {
+      double wait = IDLE_WAIT_SECONDS;
+      if (tooltip_redraw_time > 0) {
+        wait = std::max(0.0, std::min(wait, tooltip_redraw_time - glfwGetTime()));
+      }
+      glfwWaitEventsTimeout(wait);
+    }
+
+    if (tooltip_redraw_time > 0 && glfwGetTime() >= tooltip_redraw_time) {
+      tooltip_redraw_time = 0;
+      redraw_requested = true;
+    }
+    if (!animating && !redraw_requested && !app->needsRedraw()) {
+      if (!app->isAlive()) {
+        glfwSetWindowShouldClose(window, 1);
+      }
+      continue;
+    }
+    redraw_requested = false;
+
+    if (offscreen) {
+      frame_capture.bind_framebuffer();
+    }
 
     glClearColor(0.25f, 0.25f, 0.25f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     app->drawContents();
 
-    // Draw nanogui
-    screen->drawContents();
-    screen->drawWidgets();
+    // Offscreen frames have no GUI and are never shown
+    if (!offscreen) {
+      // Draw nanogui
+      screen->drawContents();
+      screen->drawWidgets();
 
-    glfwSwapBuffers(window);
+      glfwSwapBuffers(window);
+    }
 
-    if (!app->isAlive()) {
+    if (!app->isAlive() ||
+        (frames_to_capture > 0 && frame_capture.frame_count() >= frames_to_capture)) {
       glfwSetWindowShouldClose(window, 1);
     }
   }
 
+  if (mesh_export.is_open()) {
+    bool written = mesh_export.close();
+    std::cout << (written ? "Exported " : "Error: Export failed after ") << mesh_export.frame_count()
+              << " frames to " << mesh_export_file << std::endl;
+  }
+  if (frame_capture.is_open()) {
+    bool written = frame_capture.close();
+    std::cout << (written ? "Recorded " : "Error: Recording failed after ") << frame_capture.frame_count()
+              << " frames to " << capture_file << std::endl;
+  }
+
   return 0;
 }
@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "meshExport.h"
+
+// Bytes gathered before each fwrite of formatted text
+#define MESH_EXPORT_CHUNK (1 << 16)
+
+MeshSequenceWriter::MeshSequenceWriter(int queue_frames)
+    : sequence(nullptr), num_vertices(0), queue_frames(max(1, queue_frames)),
+      running(false), failed(false), num_frames(0) {}
+
+MeshSequenceWriter::~MeshSequenceWriter() {
+  close();
+}
+
+static string lowercase_extension(const string &filename) {
+  size_t slash = filename.find_last_of("/\\");
+  size_t dot = filename.rfind('.');
+  if (dot == string::npos || (slash != string::npos && dot < slash)) return "";
+  string ext = filename.substr(dot + 1);
+  transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  return ext;
+}
+
+static bool little_endian() {
+  uint32_t one = 1;
+  return *(unsigned char *)&one == 1;
+}
+
+bool MeshSequenceWriter::open(const string &filename, const vector<Cloth *> &cloths) {
+  if (running) return false;
+
+  this->filename = filename;
+  string ext = lowercase_extension(filename);
+  format = ext == "obj" ? OBJ : ext == "ply" ? PLY : BINARY;
+
+  // Vertices are the particles of each cloth in turn
+  objects.clear();
+  indices.clear();
+  num_vertices = 0;
+  for (Cloth *cloth : cloths) {
+    MeshSequenceObject object;
+    object.first_vertex = num_vertices;
+    object.num_vertices = cloth->point_masses.size();
+    object.first_triangle = indices.size() / 3;
+    object.num_triangles = 0;
+    if (cloth->clothMesh && !cloth->point_masses.empty()) {
+      const PointMass *base = &cloth->point_masses[0];
+      for (const Triangle *t : cloth->clothMesh->triangles) {
+        indices.push_back(object.first_vertex + (t->pm1 - base));
+        indices.push_back(object.first_vertex + (t->pm2 - base));
+        indices.push_back(object.first_vertex + (t->pm3 - base));
+        object.num_triangles++;
+      }
+    }
+    objects.push_back(object);
+    num_vertices += object.num_vertices;
+  }
+
+  uvs.assign(2 * num_vertices, 0);
+  for (size_t c = 0; c < cloths.size(); c++) {
+    if (!cloths[c]->clothMesh || cloths[c]->point_masses.empty()) continue;
+    const PointMass *base = &cloths[c]->point_masses[0];
+    size_t first = objects[c].first_vertex;
+    for (const Triangle *t : cloths[c]->clothMesh->triangles) {
+      const PointMass *pms[3] = {t->pm1, t->pm2, t->pm3};
+      const Vector3D *uv[3] = {&t->uv1, &t->uv2, &t->uv3};
+      for (int k = 0; k < 3; k++) {
+        size_t v = first + (pms[k] - base);
+        uvs[2 * v] = uv[k]->x;
+        uvs[2 * v + 1] = uv[k]->y;
+      }
+    }
+  }
+
+  face_block.clear();
+  size_t num_triangles = indices.size() / 3;
+  if (format == OBJ) {
+    char line[128];
+    for (size_t c = 0; c < objects.size(); c++) {
+      snprintf(line, sizeof(line), "o balloon_%zu\n", c);
+      face_block += line;
+      const MeshSequenceObject &object = objects[c];
+      for (size_t i = object.first_triangle; i < object.first_triangle + object.num_triangles; i++) {
+        // OBJ counts from 1
+        uint32_t a = indices[3 * i] + 1, b = indices[3 * i + 1] + 1, d = indices[3 * i + 2] + 1;
+        snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, d, d, d);
+        face_block += line;
+      }
+    }
+  } else if (format == PLY) {
+    face_block.resize(num_triangles * (1 + 3 * sizeof(int32_t)));
+    char *out = &face_block[0];
+    for (size_t i = 0; i < num_triangles; i++) {
+      *out++ = 3;
+      for (int k = 0; k < 3; k++) {
+        int32_t index = indices[3 * i + k];
+        memcpy(out, &index, sizeof(index));
+        out += sizeof(index);
+      }
+    }
+  } else {
+    sequence = fopen(filename.c_str(), "wb");
+    if (!sequence) {
+      cerr << "Error: Cannot write mesh sequence " << filename << endl;
+      return false;
+    }
+    MeshSequenceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_SEQUENCE_MAGIC, sizeof(MESH_SEQUENCE_MAGIC));
+    header.version = MESH_SEQUENCE_VERSION;
+    header.byte_order = MESH_SEQUENCE_BYTE_ORDER;
+    header.num_vertices = num_vertices;
+    header.num_triangles = num_triangles;
+    header.num_objects = objects.size();
+    bool ok = fwrite(&header, sizeof(header), 1, sequence) == 1 &&
+              fwrite(objects.data(), sizeof(MeshSequenceObject), objects.size(), sequence) == objects.size() &&
+              fwrite(indices.data(), sizeof(uint32_t), indices.size(), sequence) == indices.size() &&
+              fwrite(uvs.data(), sizeof(float), uvs.size(), sequence) == uvs.size();
+    if (!ok) {
+      cerr << "Error: Cannot write mesh sequence " << filename << endl;
+      fclose(sequence);
+      sequence = nullptr;
+      return false;
+    }
+  }
+
+  num_frames = 0;
+  failed = false;
+  running = true;
+  worker = thread(&MeshSequenceWriter::run, this);
+  return true;
+}
+
+void MeshSequenceWriter::write_frame(const vector<Cloth *> &cloths, double time) {
+  if (!running) return;
+
+  Frame frame;
+  {
+    unique_lock<mutex> lock(queue_mutex);
+    frame_done.wait(lock, [this] { return queue.size() < queue_frames || failed; });
+    if (failed) return;
+    if (!free_frames.empty()) {
+      frame = move(free_frames.back());
+      free_frames.pop_back();
+    }
+  }
+
+  frame.index = ++num_frames;
+  frame.time = time;
+  frame.positions.resize(3 * num_vertices);
+  float *p = frame.positions.data();
+  float *end = p + frame.positions.size();
+  for (Cloth *cloth : cloths) {
+    for (const PointMass &pm : cloth->point_masses) {
+      // A cloth rebuilt with more particles than it opened with is cut off
+      if (p == end) break;
+      *p++ = pm.position.x;
+      *p++ = pm.position.y;
+      *p++ = pm.position.z;
+    }
+  }
+
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    queue.push_back(move(frame));
+  }
+  frame_queued.notify_one();
+}
+
+bool MeshSequenceWriter::close() {
+  if (!running) return !failed;
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    running = false;
+  }
+  frame_queued.notify_one();
+  worker.join();
+
+  if (sequence) {
+    if (fclose(sequence) != 0) failed = true;
+    sequence = nullptr;
+  }
+  queue.clear();
+  free_frames.clear();
+  return !failed;
+}
+
+void MeshSequenceWriter::run() {
+  while (true) {
+    Frame frame;
+    // Once a frame has failed, the rest are only recycled
+    bool skip;
+    {
+      unique_lock<mutex> lock(queue_mutex);
+      frame_queued.wait(lock, [this] { return !queue.empty() || !running; });
+      if (queue.empty()) return;
+      frame = move(queue.front());
+      queue.pop_front();
+      skip = failed;
+    }
+
+    bool ok = skip || write(frame);
+
+    {
+      lock_guard<mutex> lock(queue_mutex);
+      if (!ok && !failed) {
+        cerr << "Error: Cannot write mesh frame " << frame.index << " of " << filename << endl;
+        failed = true;
+      }
+      free_frames.push_back(move(frame));
+    }
+    frame_done.notify_one();
+  }
+}
+
+bool MeshSequenceWriter::write(Frame &frame) {
+  compute_normals(frame.positions);
+  switch (format) {
+  case OBJ:
+    return write_obj(frame);
+  case PLY:
+    return write_ply(frame);
+  default:
+    return write_binary(frame);
+  }
+}
+
+// Sums the unnormalized face normals around each vertex, which weighs them
+// by area like PointMass::normal
+void MeshSequenceWriter::compute_normals(const vector<float> &positions) {
+  vector<double> sums(3 * num_vertices, 0.0);
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    const float *a = &positions[3 * indices[i]];
+    const float *b = &positions[3 * indices[i + 1]];
+    const float *c = &positions[3 * indices[i + 2]];
+    double u[3] = {(double)b[0] - a[0], (double)b[1] - a[1], (double)b[2] - a[2]};
+    double v[3] = {(double)c[0] - a[0], (double)c[1] - a[1], (double)c[2] - a[2]};
+    double n[3] = {u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]};
+    for (int k = 0; k < 3; k++) {
+      double *sum = &sums[3 * indices[i + k]];
+      sum[0] += n[0];
+      sum[1] += n[1];
+      sum[2] += n[2];
+    }
+  }
+
+  normals.resize(3 * num_vertices);
+  for (size_t v = 0; v < num_vertices; v++) {
+    const double *sum = &sums[3 * v];
+    double length = sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+    double scale = length > 0 ? 1 / length : 0;
+    for (int k = 0; k < 3; k++) {
+      normals[3 * v + k] = sum[k] * scale;
+    }
+  }
+}
+
+bool MeshSequenceWriter::write_binary(const Frame &frame) {
+  MeshSequenceFrame header;
+  header.frame = frame.index;
+  header.padding = 0;
+  header.time = frame.time;
+  return fwrite(&header, sizeof(header), 1, sequence) == 1 &&
+         fwrite(frame.positions.data(), sizeof(float), frame.positions.size(), sequence) == frame.positions.size() &&
+         fwrite(normals.data(), sizeof(float), normals.size(), sequence) == normals.size();
+}
+
+string MeshSequenceWriter::frame_filename(int index) const {
+  size_t dot = filename.rfind('.');
+  char number[16];
+  snprintf(number, sizeof(number), "_%05d", index);
+  return filename.substr(0, dot) + number + filename.substr(dot);
+}
+
+bool MeshSequenceWriter::write_obj(const Frame &frame) {
+  FILE *out = fopen(frame_filename(frame.index).c_str(), "w");
+  if (!out) return false;
+
+  string text;
+  text.reserve(MESH_EXPORT_CHUNK + 256);
+  char line[256];
+  bool ok = true;
+  auto flush = [&](bool force) {
+    if (text.size() >= MESH_EXPORT_CHUNK || force) {
+      ok = ok && fwrite(text.data(), 1, text.size(), out) == text.size();
+      text.clear();
+    }
+  };
+
+  snprintf(line, sizeof(line), "# Frame %d, %.6f s\n", frame.index, frame.time);
+  text += line;
+  const float *p = frame.positions.data();
+  for (size_t v = 0; v < num_vertices; v++, p += 3) {
+    snprintf(line, sizeof(line), "v %.7g %.7g %.7g\n", p[0], p[1], p[2]);
+    text += line;
+    flush(false);
+  }
+  for (size_t v = 0; v < num_vertices; v++) {
+    snprintf(line, sizeof(line), "vt %.7g %.7g\n", uvs[2 * v], uvs[2 * v + 1]);
+    text += line;
+    flush(false);
+  }
+  const float *n = normals.data();
+  for (size_t v = 0; v < num_vertices; v++, n += 3) {
+    snprintf(line, sizeof(line), "vn %.7g %.7g %.7g\n", n[0], n[1], n[2]);
+    text += line;
+    flush(false);
+  }
+  flush(true);
+
+  ok = ok && fwrite(face_block.data(), 1, face_block.size(), out) == face_block.size();
+  return fclose(out) == 0 && ok;
+}
+
+bool MeshSequenceWriter::write_ply(const Frame &frame) {
+  FILE *out = fopen(frame_filename(frame.index).c_str(), "wb");
+  if (!out) return false;
+
+  char header[512];
+  snprintf(header, sizeof(header),
+           "ply\n"
+           "format %s 1.0\n"
+           "comment frame %d, %.6f s\n"
+           "element vertex %zu\n"
+           "property float x\nproperty float y\nproperty float z\n"
+           "property float nx\nproperty float ny\nproperty float nz\n"
+           "property float s\nproperty float t\n"
+           "element face %zu\n"
+           "property list uchar int vertex_indices\n"
+           "end_header\n",
+           little_endian() ? "binary_little_endian" : "binary_big_endian", frame.index,
+           frame.time, num_vertices, indices.size() / 3);
+  bool ok = fputs(header, out) >= 0;
+
+  // Interleaved x y z nx ny nz s t
+  vector<float> vertices(8 * num_vertices);
+  for (size_t v = 0; v < num_vertices; v++) {
+    float *out_vertex = &vertices[8 * v];
+    memcpy(out_vertex, &frame.positions[3 * v], 3 * sizeof(float));
+    memcpy(out_vertex + 3, &normals[3 * v], 3 * sizeof(float));
+    memcpy(out_vertex + 6, &uvs[2 * v], 2 * sizeof(float));
+  }
+  ok = ok && fwrite(vertices.data(), sizeof(float), vertices.size(), out) == vertices.size();
+  ok = ok && fwrite(face_block.data(), 1, face_block.size(), out) == face_block.size();
+  return fclose(out) == 0 && ok;
+}
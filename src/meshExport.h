@@ -0,0 +1,138 @@
+#ifndef MESH_EXPORT_H
+#define MESH_EXPORT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cloth.h"
+
+using namespace std;
+
+/**
+ * Writes the balloons' meshes, frame after frame, for an offline renderer.
+ *
+ * All cloths form one mesh whose vertices are the particles, shared between
+ * triangles. The topology is taken once, when the writer opens; each frame
+ * only copies the particle positions, on the calling thread, and hands them
+ * to a background thread that computes vertex normals and does all
+ * formatting and disk writes. Frames wait in a queue of a few frames, so
+ * the simulation only waits when the disk falls that far behind.
+ *
+ * Formats, chosen by the file name's extension:
+ *  - .obj and .ply write one file per frame, name_00001.obj and so on,
+ *    each a complete mesh; the faces are formatted once and the same bytes
+ *    written into every frame. PLY files are binary.
+ *  - Anything else is the binary mesh sequence below, one file for the
+ *    whole animation with the topology written once.
+ *
+ * Binary mesh sequence, in native byte order like the binary scene format:
+ *   MeshSequenceHeader
+ *   MeshSequenceObject[num_objects]    one per cloth
+ *   uint32 indices[3 * num_triangles]  counter-clockwise
+ *   float uvs[2 * num_vertices]
+ * then per frame:
+ *   MeshSequenceFrame
+ *   float positions[3 * num_vertices]
+ *   float normals[3 * num_vertices]
+ */
+
+#define MESH_SEQUENCE_VERSION 1
+#define MESH_SEQUENCE_MAGIC "CLTHSEQ"
+#define MESH_SEQUENCE_BYTE_ORDER 0x01020304u
+
+struct MeshSequenceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t num_vertices;
+  uint32_t num_triangles;
+  uint32_t num_objects;
+  uint32_t padding;
+};
+
+// A cloth's range of the vertices and triangles
+struct MeshSequenceObject {
+  uint32_t first_vertex, num_vertices;
+  uint32_t first_triangle, num_triangles;
+};
+
+struct MeshSequenceFrame {
+  uint32_t frame;
+  uint32_t padding;
+  double time;
+};
+
+class MeshSequenceWriter {
+public:
+  enum Format { OBJ, PLY, BINARY };
+
+  // queue_frames is how many frames may wait for the disk
+  MeshSequenceWriter(int queue_frames = 8);
+  ~MeshSequenceWriter();
+
+  // Takes the topology of the cloths, which must have their meshes built,
+  // and starts the writer thread. False if the output cannot be created.
+  bool open(const string &filename, const vector<Cloth *> &cloths);
+
+  // Queues the cloths' current positions as the next frame
+  void write_frame(const vector<Cloth *> &cloths, double time);
+
+  // Writes out the queued frames and stops the writer thread. False if any
+  // write failed.
+  bool close();
+
+  bool is_open() const { return running; }
+  // Frames queued since the writer opened
+  int frame_count() const { return num_frames; }
+
+private:
+  struct Frame {
+    int index;
+    double time;
+    vector<float> positions;
+  };
+
+  void run();
+  bool write(Frame &frame);
+  void compute_normals(const vector<float> &positions);
+
+  bool write_binary(const Frame &frame);
+  bool write_obj(const Frame &frame);
+  bool write_ply(const Frame &frame);
+  string frame_filename(int index) const;
+
+  Format format;
+  string filename;
+  FILE *sequence;
+
+  // Topology, fixed while open
+  vector<MeshSequenceObject> objects;
+  vector<uint32_t> indices;
+  vector<float> uvs;
+  size_t num_vertices;
+  // Faces of the OBJ and PLY files, as written
+  string face_block;
+
+  vector<float> normals;
+
+  // Frames waiting for the writer thread, and emptied ones to reuse
+  size_t queue_frames;
+  deque<Frame> queue;
+  vector<Frame> free_frames;
+  mutex queue_mutex;
+  condition_variable frame_queued;
+  condition_variable frame_done;
+  bool running;
+  bool failed;
+  thread worker;
+
+  int num_frames;
+};
+
+#endif /* MESH_EXPORT_H */
@@ -1,9 +1,14 @@
 #ifdef _WIN32
 #include "dirent.h"
+#include <direct.h>
 #else
 #include <dirent.h>
+#include <sys/stat.h>
 #endif // WIN32
 
+#include <cerrno>
+#include <cstdlib>
+
 #include <fstream>
 
 #include "file_utils.h"
@@ -60,4 +65,27 @@ bool file_exists(const std::string& test_filename) {
   return true;
 }
 
+bool make_directory(const std::string& dir_path) {
+#ifdef _WIN32
+  int status = _mkdir(dir_path.c_str());
+#else
+  int status = mkdir(dir_path.c_str(), 0755);
+#endif
+  return status == 0 || errno == EEXIST;
+}
+
+std::string absolute_path(const std::string& path) {
+#ifdef _WIN32
+  char* resolved = _fullpath(NULL, path.c_str(), 0);
+#else
+  char* resolved = realpath(path.c_str(), NULL);
+#endif
+  if (resolved == NULL) {
+    return path;
+  }
+  std::string result(resolved);
+  free(resolved);
+  return result;
+}
+
 }
@@ -9,6 +9,10 @@ namespace FileUtils {
 bool list_files_in_directory(const std::string& dir_path, std::set<std::string>& retval);
 bool split_filename(const std::string& filename, std::string& before_extension, std::string& extension);
 bool file_exists(const std::string& filename);
+// Creates the directory unless it already exists
+bool make_directory(const std::string& dir_path);
+// The path made absolute, or unchanged if it does not exist
+std::string absolute_path(const std::string& path);
 
 }
 
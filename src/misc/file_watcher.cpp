@@ -0,0 +1,111 @@
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+
+#include "file_utils.h"
+#include "file_watcher.h"
+
+namespace CGL {
+namespace Misc {
+
+// Longest the watcher thread goes without checking whether to stop
+#define WATCH_INTERVAL_MS 500
+
+FileWatcher::~FileWatcher() {
+  stop();
+}
+
+bool FileWatcher::start(const std::string &dir_path) {
+  if (running) return true;
+  this->dir_path = dir_path;
+
+#ifdef __linux__
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  // Editors either rewrite a file in place or write a new one over it
+  if (fd >= 0 && inotify_add_watch(fd, dir_path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    close(fd);
+    fd = -1;
+  }
+#endif
+  if (fd < 0 && !scan(false)) return false;
+
+  running = true;
+  worker = std::thread(&FileWatcher::watch, this);
+  return true;
+}
+
+void FileWatcher::stop() {
+  if (!running) return;
+  running = false;
+  worker.join();
+#ifdef __linux__
+  if (fd >= 0) close(fd);
+#endif
+  fd = -1;
+}
+
+std::set<std::string> FileWatcher::changed() {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::set<std::string> result;
+  result.swap(pending);
+  return result;
+}
+
+bool FileWatcher::has_changes() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return !pending.empty();
+}
+
+void FileWatcher::watch() {
+  while (running) {
+#ifdef __linux__
+    if (fd >= 0) {
+      pollfd request = {fd, POLLIN, 0};
+      if (poll(&request, 1, WATCH_INTERVAL_MS) <= 0) continue;
+
+      alignas(inotify_event) char buffer[4096];
+      ssize_t length;
+      while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (char *p = buffer; p < buffer + length; ) {
+          const inotify_event *event = (const inotify_event *)p;
+          if (event->len > 0) pending.insert(event->name);
+          p += sizeof(inotify_event) + event->len;
+        }
+      }
+      continue;
+    }
+#endif
+    std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_INTERVAL_MS));
+    scan(true);
+  }
+}
+
+bool FileWatcher::scan(bool record) {
+  std::set<std::string> files;
+  if (!FileUtils::list_files_in_directory(dir_path, files)) return false;
+
+  for (const std::string &file : files) {
+    struct stat info;
+    if (stat((dir_path + "/" + file).c_str(), &info) != 0) continue;
+
+    auto entry = mtimes.find(file);
+    if (entry != mtimes.end() && entry->second == info.st_mtime) continue;
+    mtimes[file] = info.st_mtime;
+    if (record) {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending.insert(file);
+    }
+  }
+  return true;
+}
+
+} // namespace Misc
+} // namespace CGL
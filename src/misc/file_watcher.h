@@ -0,0 +1,57 @@
+#ifndef CGL_UTIL_FILEWATCHER_H
+#define CGL_UTIL_FILEWATCHER_H
+
+#include <atomic>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace CGL {
+namespace Misc {
+
+/**
+ * Watches the files directly inside one directory from a background thread
+ * and collects the names of those written to, for the caller to pick up
+ * whenever it is ready, e.g. once per frame.
+ *
+ * Uses inotify on Linux, so an idle watcher costs nothing; elsewhere the
+ * directory's modification times are polled twice a second.
+ */
+class FileWatcher {
+public:
+  FileWatcher() : running(false), fd(-1) {}
+  ~FileWatcher();
+
+  // Starts watching dir_path; false if it cannot be watched
+  bool start(const std::string &dir_path);
+  void stop();
+
+  // Names of the files written since the last call, without the directory
+  std::set<std::string> changed();
+  // Whether changed() has anything to return, without taking it
+  bool has_changes();
+
+private:
+  void watch();
+  // Notes modification times, recording files that changed if asked
+  bool scan(bool record);
+
+  std::string dir_path;
+  std::atomic<bool> running;
+  std::thread worker;
+
+  std::mutex mutex;
+  std::set<std::string> pending;
+
+  // inotify instance, or -1 when polling
+  int fd;
+  std::map<std::string, time_t> mtimes;
+};
+
+} // namespace Misc
+} // namespace CGL
+
+#endif // CGL_UTIL_FILEWATCHER_H
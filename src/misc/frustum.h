@@ -0,0 +1,90 @@
+#ifndef CGL_UTIL_FRUSTUM_H
+#define CGL_UTIL_FRUSTUM_H
+
+#include <algorithm>
+#include <cmath>
+
+#include <nanogui/nanogui.h>
+
+#include "CGL/CGL.h"
+#include "CGL/vector3D.h"
+
+using namespace nanogui;
+
+// Target on-screen spacing, in pixels, between neighboring mesh vertices.
+// Levels of detail are chosen as coarse as possible while staying under it.
+#define LOD_TARGET_PIXELS 8.0
+
+namespace CGL {
+namespace Misc {
+
+/**
+ * The view frustum of a camera, for culling and level-of-detail decisions.
+ * Planes are extracted from the combined view-projection matrix, so anything
+ * the renderer would clip is rejected here first.
+ */
+struct Frustum {
+  // Sees everything, at full detail
+  Frustum() : pixel_scale(1e30) {
+    for (int i = 0; i < 6; i++) {
+      normals[i] = Vector3D(0, 0, 0);
+      offsets[i] = 1;
+    }
+  }
+
+  Frustum(const Matrix4f &view_projection, const Vector3D &eye, double screen_h)
+      : eye(eye) {
+    // Gribb-Hartmann: each plane is the last row plus or minus one of the others
+    for (int i = 0; i < 6; i++) {
+      int row = i / 2;
+      double sign = (i % 2) ? -1 : 1;
+      Vector3D n(view_projection(3, 0) + sign * view_projection(row, 0),
+                 view_projection(3, 1) + sign * view_projection(row, 1),
+                 view_projection(3, 2) + sign * view_projection(row, 2));
+      double d = view_projection(3, 3) + sign * view_projection(row, 3);
+      double length = n.norm();
+      normals[i] = n / length;
+      offsets[i] = d / length;
+    }
+
+    // For a symmetric perspective, entry (1, 1) is cot(fov_y / 2)
+    double cot_half_fov = view_projection.row(1).head<3>().norm();
+    pixel_scale = cot_half_fov * screen_h / 2;
+  }
+
+  bool visible(const Vector3D &center, double radius) const {
+    for (int i = 0; i < 6; i++) {
+      if (dot(normals[i], center) + offsets[i] < -radius) return false;
+    }
+    return true;
+  }
+
+  bool visible(const Vector3D &min, const Vector3D &max) const {
+    for (int i = 0; i < 6; i++) {
+      // Corner of the box furthest along the plane normal
+      Vector3D p(normals[i].x >= 0 ? max.x : min.x,
+                 normals[i].y >= 0 ? max.y : min.y,
+                 normals[i].z >= 0 ? max.z : min.z);
+      if (dot(normals[i], p) + offsets[i] < 0) return false;
+    }
+    return true;
+  }
+
+  // On-screen size in pixels of a length at the nearest point of the
+  // bounding sphere (center, radius) to the eye
+  double pixels(double length, const Vector3D &center, double radius) const {
+    double distance = std::max((center - eye).norm() - radius, 1e-6);
+    return length * pixel_scale / distance;
+  }
+
+  Vector3D normals[6];
+  double offsets[6];
+
+  Vector3D eye;
+  double pixel_scale;
+};
+
+} // namespace Misc
+} // namespace CGL
+
+#endif // CGL_UTIL_FRUSTUM_H
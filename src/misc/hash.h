@@ -0,0 +1,26 @@
+#ifndef CGL_UTIL_HASH_H
+#define CGL_UTIL_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace CGL {
+namespace Misc {
+
+#define FNV1A_OFFSET_BASIS 14695981039346656037ull
+#define FNV1A_PRIME 1099511628211ull
+
+// 64-bit FNV-1a over raw bytes, continued from a previous hash
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t h = FNV1A_OFFSET_BASIS) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; i++) {
+    h ^= bytes[i];
+    h *= FNV1A_PRIME;
+  }
+  return h;
+}
+
+} // namespace Misc
+} // namespace CGL
+
+#endif // CGL_UTIL_HASH_H
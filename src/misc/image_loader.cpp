@@ -0,0 +1,58 @@
+#include <algorithm>
+
+#include "image_loader.h"
+#include "stb_image.h"
+
+namespace CGL {
+namespace Misc {
+
+ImageLoader::~ImageLoader() {
+  clear();
+}
+
+void ImageLoader::start(const std::vector<std::string> &paths, int channels) {
+  if (started) return;
+  started = true;
+  this->channels = channels;
+  next = 0;
+
+  images.resize(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    images[i].path = paths[i];
+    images[i].width = images[i].height = images[i].channels = 0;
+    images[i].pixels = nullptr;
+  }
+
+  // Each worker claims the next undecoded image until none are left
+  size_t num_workers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), paths.size());
+  for (size_t i = 0; i < num_workers; i++) {
+    workers.emplace_back(&ImageLoader::work, this);
+  }
+}
+
+void ImageLoader::work() {
+  for (size_t i = next++; i < images.size(); i = next++) {
+    DecodedImage &image = images[i];
+    image.pixels = stbi_load(image.path.c_str(), &image.width, &image.height, &image.channels, channels);
+  }
+}
+
+const std::vector<DecodedImage> &ImageLoader::wait() {
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+  return images;
+}
+
+void ImageLoader::clear() {
+  wait();
+  for (DecodedImage &image : images) {
+    if (image.pixels) stbi_image_free(image.pixels);
+  }
+  images.clear();
+  started = false;
+}
+
+} // namespace Misc
+} // namespace CGL
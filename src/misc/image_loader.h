@@ -0,0 +1,60 @@
+#ifndef CGL_UTIL_IMAGELOADER_H
+#define CGL_UTIL_IMAGELOADER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace CGL {
+namespace Misc {
+
+// An 8-bit image decoded by stb_image; pixels is null if the file could not
+// be read
+struct DecodedImage {
+  std::string path;
+  int width;
+  int height;
+  // Channels in the file; pixels always hold the number requested
+  int channels;
+  unsigned char *pixels;
+};
+
+/**
+ * Decodes a set of image files on a pool of worker threads, so that large
+ * textures decode concurrently with each other and with whatever the caller
+ * does in the meantime, such as creating the GL context and compiling
+ * shaders. GL uploads stay with the caller, on the thread that owns the
+ * context, once wait() returns.
+ */
+class ImageLoader {
+public:
+  ImageLoader() : started(false), next(0) {}
+  ~ImageLoader();
+
+  // Starts decoding every path into the given number of channels. Does
+  // nothing if decoding has already started.
+  void start(const std::vector<std::string> &paths, int channels);
+  bool is_started() const { return started; }
+
+  // Blocks until every image is decoded; results are in request order
+  const std::vector<DecodedImage> &wait();
+
+  // Waits for the decodes and frees their pixels; the next start() decodes
+  // again
+  void clear();
+
+private:
+  void work();
+
+  bool started;
+  int channels;
+  std::atomic<size_t> next;
+  std::vector<DecodedImage> images;
+  std::vector<std::thread> workers;
+};
+
+} // namespace Misc
+} // namespace CGL
+
+#endif // CGL_UTIL_IMAGELOADER_H
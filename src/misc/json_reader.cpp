@@ -0,0 +1,287 @@
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "json_reader.h"
+
+namespace CGL {
+namespace Misc {
+
+JsonReader::JsonReader(const char *begin, const char *end)
+    : cursor(begin), end(end), line(1), line_start(begin), has_failed(false) {
+  error_at.line = error_at.column = 0;
+}
+
+void JsonReader::skip_whitespace() {
+  while (cursor < end) {
+    char c = *cursor;
+    if (c == '\n') {
+      line++;
+      line_start = cursor + 1;
+    } else if (c != ' ' && c != '\t' && c != '\r') {
+      break;
+    }
+    cursor++;
+  }
+}
+
+JsonReader::Location JsonReader::location() {
+  skip_whitespace();
+  Location at;
+  at.line = line;
+  at.column = (int)(cursor - line_start) + 1;
+  return at;
+}
+
+bool JsonReader::fail(const std::string &message) {
+  if (!has_failed) {
+    has_failed = true;
+    error_message = message;
+    error_at.line = line;
+    error_at.column = (int)(cursor - line_start) + 1;
+  }
+  return false;
+}
+
+bool JsonReader::expect(char c) {
+  skip_whitespace();
+  if (cursor >= end || *cursor != c) {
+    return fail(std::string("expected '") + c + "'");
+  }
+  cursor++;
+  return true;
+}
+
+bool JsonReader::read_literal(const char *literal) {
+  size_t length = strlen(literal);
+  if ((size_t)(end - cursor) < length || strncmp(cursor, literal, length) != 0) {
+    return fail("expected a value");
+  }
+  cursor += length;
+  return true;
+}
+
+JsonReader::Type JsonReader::peek() {
+  skip_whitespace();
+  if (has_failed || cursor >= end) return INVALID;
+
+  switch (*cursor) {
+  case '{':
+    return OBJECT;
+  case '[':
+    return ARRAY;
+  case '"':
+    return STRING;
+  case 't':
+  case 'f':
+    return BOOLEAN;
+  case 'n':
+    return NONE;
+  case '-':
+    return (cursor + 1 < end && isdigit((unsigned char)cursor[1])) ? NUMBER : INVALID;
+  default:
+    return isdigit((unsigned char)*cursor) ? NUMBER : INVALID;
+  }
+}
+
+bool JsonReader::begin_object() {
+  if (peek() != OBJECT) return false;
+  cursor++;
+  open_first.push_back(true);
+  return true;
+}
+
+bool JsonReader::next_key(std::string &key) {
+  if (has_failed || open_first.empty()) return false;
+
+  skip_whitespace();
+  if (cursor < end && *cursor == '}') {
+    cursor++;
+    open_first.pop_back();
+    return false;
+  }
+  if (!open_first.back() && !expect(',')) return false;
+  open_first.back() = false;
+
+  if (peek() != STRING) return fail("expected a key");
+  return read(key) && expect(':');
+}
+
+bool JsonReader::begin_array() {
+  if (peek() != ARRAY) return false;
+  cursor++;
+  open_first.push_back(true);
+  return true;
+}
+
+bool JsonReader::next_element() {
+  if (has_failed || open_first.empty()) return false;
+
+  skip_whitespace();
+  if (cursor < end && *cursor == ']') {
+    cursor++;
+    open_first.pop_back();
+    return false;
+  }
+  if (!open_first.back() && !expect(',')) return false;
+  open_first.back() = false;
+  return true;
+}
+
+bool JsonReader::read(double &value) {
+  if (peek() != NUMBER) return false;
+
+  char *stop;
+  value = strtod(cursor, &stop);
+  if (stop == cursor || stop > end) return fail("malformed number");
+  cursor = stop;
+  return true;
+}
+
+bool JsonReader::read(int &value) {
+  const char *start = cursor;
+  double number;
+  if (!read(number)) return false;
+  if (number != std::floor(number) || number < INT_MIN || number > INT_MAX) {
+    cursor = start;
+    return false;
+  }
+  value = (int)number;
+  return true;
+}
+
+bool JsonReader::read(unsigned int &value) {
+  const char *start = cursor;
+  double number;
+  if (!read(number)) return false;
+  if (number != std::floor(number) || number < 0 || number > UINT_MAX) {
+    cursor = start;
+    return false;
+  }
+  value = (unsigned int)number;
+  return true;
+}
+
+bool JsonReader::read(bool &value) {
+  if (peek() != BOOLEAN) return false;
+  value = *cursor == 't';
+  return read_literal(value ? "true" : "false");
+}
+
+// Appends a code point as UTF-8
+static void append_utf8(std::string &s, unsigned long c) {
+  if (c < 0x80) {
+    s += (char)c;
+  } else if (c < 0x800) {
+    s += (char)(0xc0 | (c >> 6));
+    s += (char)(0x80 | (c & 0x3f));
+  } else if (c < 0x10000) {
+    s += (char)(0xe0 | (c >> 12));
+    s += (char)(0x80 | ((c >> 6) & 0x3f));
+    s += (char)(0x80 | (c & 0x3f));
+  } else {
+    s += (char)(0xf0 | (c >> 18));
+    s += (char)(0x80 | ((c >> 12) & 0x3f));
+    s += (char)(0x80 | ((c >> 6) & 0x3f));
+    s += (char)(0x80 | (c & 0x3f));
+  }
+}
+
+bool JsonReader::read(std::string &value) {
+  if (peek() != STRING) return false;
+  cursor++;
+
+  value.clear();
+  while (true) {
+    if (cursor >= end) return fail("unterminated string");
+    char c = *cursor++;
+    if (c == '"') return true;
+    if ((unsigned char)c < 0x20) return fail("control character in string");
+    if (c != '\\') {
+      value += c;
+      continue;
+    }
+
+    if (cursor >= end) return fail("unterminated string");
+    switch (*cursor++) {
+    case '"': value += '"'; break;
+    case '\\': value += '\\'; break;
+    case '/': value += '/'; break;
+    case 'b': value += '\b'; break;
+    case 'f': value += '\f'; break;
+    case 'n': value += '\n'; break;
+    case 'r': value += '\r'; break;
+    case 't': value += '\t'; break;
+    case 'u': {
+      if (end - cursor < 4) return fail("malformed \\u escape");
+      char hex[5] = {cursor[0], cursor[1], cursor[2], cursor[3], 0};
+      char *stop;
+      unsigned long code = strtoul(hex, &stop, 16);
+      if (stop != hex + 4) return fail("malformed \\u escape");
+      cursor += 4;
+
+      // Characters outside the basic plane come as a surrogate pair
+      if (code >= 0xd800 && code < 0xdc00 && end - cursor >= 6 && cursor[0] == '\\' && cursor[1] == 'u') {
+        char low_hex[5] = {cursor[2], cursor[3], cursor[4], cursor[5], 0};
+        unsigned long low = strtoul(low_hex, &stop, 16);
+        if (stop == low_hex + 4 && low >= 0xdc00 && low < 0xe000) {
+          code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+          cursor += 6;
+        }
+      }
+      append_utf8(value, code);
+      break;
+    }
+    default:
+      cursor--;
+      return fail("unknown escape in string");
+    }
+  }
+}
+
+void JsonReader::skip() {
+  switch (peek()) {
+  case OBJECT: {
+    begin_object();
+    std::string key;
+    while (next_key(key)) skip();
+    break;
+  }
+  case ARRAY:
+    begin_array();
+    while (next_element()) skip();
+    break;
+  case STRING: {
+    std::string value;
+    read(value);
+    break;
+  }
+  case NUMBER: {
+    double value;
+    read(value);
+    break;
+  }
+  case BOOLEAN: {
+    bool value;
+    read(value);
+    break;
+  }
+  case NONE:
+    read_literal("null");
+    break;
+  case INVALID:
+    fail(cursor >= end ? "unexpected end of file" : "expected a value");
+    break;
+  }
+}
+
+bool JsonReader::finish() {
+  skip_whitespace();
+  if (!has_failed && cursor < end) fail("unexpected text after the document");
+  return !has_failed;
+}
+
+} // namespace Misc
+} // namespace CGL
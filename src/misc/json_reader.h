@@ -0,0 +1,88 @@
+#ifndef CGL_UTIL_JSONREADER_H
+#define CGL_UTIL_JSONREADER_H
+
+#include <string>
+#include <vector>
+
+namespace CGL {
+namespace Misc {
+
+/**
+ * A pull parser over a JSON document held in memory. Values are read one at
+ * a time, in document order, straight into the caller's variables, so no
+ * document tree is built or copied.
+ *
+ * Objects are walked with begin_object() and next_key(), arrays with
+ * begin_array() and next_element(); between those calls each value must be
+ * consumed with one of the read() overloads or skip(). A read() of the wrong
+ * type returns false and consumes nothing, so the caller can report it and
+ * skip() on. Malformed JSON stops the parse: failed() turns true and every
+ * later call returns false.
+ */
+class JsonReader {
+public:
+  enum Type { OBJECT, ARRAY, STRING, NUMBER, BOOLEAN, NONE, INVALID };
+
+  // Line and column, from 1, of a position in the document
+  struct Location {
+    int line;
+    int column;
+  };
+
+  // The text must stay alive, and be followed by a null character, for as
+  // long as the reader is used
+  JsonReader(const char *begin, const char *end);
+
+  // Type of the next value, and where it starts
+  Type peek();
+  Location location();
+
+  bool begin_object();
+  // Moves to the next member of the current object and reads its key; false
+  // once the object is closed
+  bool next_key(std::string &key);
+
+  bool begin_array();
+  // Moves to the next element of the current array; false once it is closed
+  bool next_element();
+
+  bool read(double &value);
+  // Fails for numbers that are not integers in range
+  bool read(int &value);
+  bool read(unsigned int &value);
+  bool read(bool &value);
+  bool read(std::string &value);
+  void skip();
+
+  // Checks that only whitespace follows the top-level value; false if not,
+  // or if the parse failed earlier
+  bool finish();
+
+  bool failed() const { return has_failed; }
+  const std::string &error() const { return error_message; }
+  const Location &error_location() const { return error_at; }
+
+private:
+  void skip_whitespace();
+  bool expect(char c);
+  bool read_literal(const char *literal);
+  bool fail(const std::string &message);
+
+  const char *cursor;
+  const char *end;
+
+  int line;
+  const char *line_start;
+
+  // Whether the innermost open object or array has had no member yet
+  std::vector<bool> open_first;
+
+  bool has_failed;
+  std::string error_message;
+  Location error_at;
+};
+
+} // namespace Misc
+} // namespace CGL
+
+#endif // CGL_UTIL_JSONREADER_H
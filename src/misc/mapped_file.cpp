@@ -0,0 +1,63 @@
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <fstream>
+#include <iterator>
+
+#include "mapped_file.h"
+
+namespace CGL {
+namespace Misc {
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+bool MappedFile::open(const std::string &filename) {
+  close();
+
+#ifndef _WIN32
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    ::close(fd);
+    return false;
+  }
+  length = info.st_size;
+  if (length > 0) {
+    void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address != MAP_FAILED) {
+      bytes = (const char *)address;
+      mapped = true;
+    }
+  }
+  ::close(fd);
+  if (mapped || length == 0) return true;
+#endif
+
+  std::ifstream in(filename, std::ios::binary);
+  if (!in.good()) return false;
+  buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  bytes = buffer.data();
+  length = buffer.size();
+  return true;
+}
+
+void MappedFile::close() {
+#ifndef _WIN32
+  if (mapped) munmap((void *)bytes, length);
+#endif
+  mapped = false;
+  bytes = nullptr;
+  length = 0;
+  buffer.clear();
+}
+
+} // namespace Misc
+} // namespace CGL
@@ -0,0 +1,39 @@
+#ifndef CGL_UTIL_MAPPEDFILE_H
+#define CGL_UTIL_MAPPEDFILE_H
+
+#include <string>
+#include <vector>
+
+namespace CGL {
+namespace Misc {
+
+/**
+ * A whole file mapped read-only into memory, for as long as the object
+ * lives. Pages are read in by the OS as they are touched. Platforms without
+ * mmap read the file into a buffer instead.
+ */
+class MappedFile {
+public:
+  MappedFile() : bytes(nullptr), length(0), mapped(false) {}
+  ~MappedFile();
+
+  bool open(const std::string &filename);
+  void close();
+
+  const char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+
+  const char *bytes;
+  size_t length;
+  bool mapped;
+  std::vector<char> buffer;
+};
+
+} // namespace Misc
+} // namespace CGL
+
+#endif // CGL_UTIL_MAPPEDFILE_H
@@ -12,6 +12,16 @@
 #define TANGEN_OFFSET 8
 #define VERTEX_SIZE 11
 
+// Layout of one vertex in the GPU vertex buffer: position, normal, uv, tangent
+#define GPU_POSITION_OFFSET 0
+#define GPU_NORMAL_OFFSET 4
+#define GPU_UV_OFFSET 8
+#define GPU_TANGENT_OFFSET 10
+#define GPU_VERTEX_SIZE 14
+
+// Fewest latitude or longitude rings a level of detail may have
+#define SPHERE_MIN_RINGS 6
+
 using namespace nanogui;
 
 namespace CGL {
@@ -21,7 +31,10 @@ SphereMesh::SphereMesh(int num_lat, int num_lon)
 : sphere_num_lat(num_lat)
 , sphere_num_lon(num_lon)
 , sphere_num_vertices((sphere_num_lat + 1) * (sphere_num_lon + 1))
-, sphere_num_indices(6 * sphere_num_lat * sphere_num_lon) {
+, sphere_num_indices(6 * sphere_num_lat * sphere_num_lon)
+, vertex_buffer(0)
+, index_buffer(0)
+, instance_buffer(0) {
   
   Indices.resize(sphere_num_indices);
   Vertices.resize(VERTEX_SIZE * sphere_num_vertices);
@@ -78,89 +91,194 @@ SphereMesh::SphereMesh(int num_lat, int num_lon)
       iptr[5] = i00;
     }
   }
-  
-  build_data();
+}
+
+SphereMesh::~SphereMesh() {
+  for (auto &entry : vertex_arrays) {
+    glDeleteVertexArrays(1, &entry.second);
+  }
+  if (vertex_buffer) glDeleteBuffers(1, &vertex_buffer);
+  if (index_buffer) glDeleteBuffers(1, &index_buffer);
+  if (instance_buffer) glDeleteBuffers(1, &instance_buffer);
+}
+
+// Shared meshes by resolution. Never freed: the meshes own GL objects, which
+// must not be deleted after the context is gone at exit.
+static std::map<std::pair<int, int>, SphereMesh *> &shared_meshes() {
+  static std::map<std::pair<int, int>, SphereMesh *> *meshes =
+      new std::map<std::pair<int, int>, SphereMesh *>();
+  return *meshes;
+}
+
+SphereMesh *SphereMesh::shared(int num_lat, int num_lon) {
+  SphereMesh *&mesh = shared_meshes()[std::make_pair(num_lat, num_lon)];
+  if (!mesh) {
+    mesh = new SphereMesh(num_lat, num_lon);
+  }
+  return mesh;
 }
 
 int SphereMesh::s_index(int x, int y) {
   return ((x) * (sphere_num_lon + 1) + (y));
 }
 
-void SphereMesh::build_data() {
-  
-  positions = MatrixXf(4, sphere_num_indices * 3);
-  normals = MatrixXf(4, sphere_num_indices * 3);
-  uvs = MatrixXf(2, sphere_num_indices * 3);
-  tangents = MatrixXf(4, sphere_num_indices * 3);
-
-  for (int i = 0; i < sphere_num_indices; i += 3) {
-    double *vPtr1 = &Vertices[VERTEX_SIZE * Indices[i]];
-    double *vPtr2 = &Vertices[VERTEX_SIZE * Indices[i + 1]];
-    double *vPtr3 = &Vertices[VERTEX_SIZE * Indices[i + 2]];
-
-    Vector3D p1(vPtr1[VERTEX_OFFSET], vPtr1[VERTEX_OFFSET + 1],
-                vPtr1[VERTEX_OFFSET + 2]);
-    Vector3D p2(vPtr2[VERTEX_OFFSET], vPtr2[VERTEX_OFFSET + 1],
-                vPtr2[VERTEX_OFFSET + 2]);
-    Vector3D p3(vPtr3[VERTEX_OFFSET], vPtr3[VERTEX_OFFSET + 1],
-                vPtr3[VERTEX_OFFSET + 2]);
-
-    Vector3D n1(vPtr1[NORMAL_OFFSET], vPtr1[NORMAL_OFFSET + 1],
-                vPtr1[NORMAL_OFFSET + 2]);
-    Vector3D n2(vPtr2[NORMAL_OFFSET], vPtr2[NORMAL_OFFSET + 1],
-                vPtr2[NORMAL_OFFSET + 2]);
-    Vector3D n3(vPtr3[NORMAL_OFFSET], vPtr3[NORMAL_OFFSET + 1],
-                vPtr3[NORMAL_OFFSET + 2]);
-        
-    Vector3D uv1(vPtr1[TCOORD_OFFSET], vPtr1[TCOORD_OFFSET + 1], 0);
-    Vector3D uv2(vPtr2[TCOORD_OFFSET], vPtr2[TCOORD_OFFSET + 1], 0);
-    Vector3D uv3(vPtr3[TCOORD_OFFSET], vPtr3[TCOORD_OFFSET + 1], 0);
-    
-    Vector3D t1(vPtr1[TANGEN_OFFSET], vPtr1[TANGEN_OFFSET + 1],
-                vPtr1[TANGEN_OFFSET + 2]);
-    Vector3D t2(vPtr2[TANGEN_OFFSET], vPtr2[TANGEN_OFFSET + 1],
-                vPtr2[TANGEN_OFFSET + 2]);
-    Vector3D t3(vPtr3[TANGEN_OFFSET], vPtr3[TANGEN_OFFSET + 1],
-                vPtr3[TANGEN_OFFSET + 2]);
-
-    positions.col(i    ) << p1.x, p1.y, p1.z, 1.0;
-    positions.col(i + 1) << p2.x, p2.y, p2.z, 1.0;
-    positions.col(i + 2) << p3.x, p3.y, p3.z, 1.0;
-
-    normals.col(i    ) << n1.x, n1.y, n1.z, 0.0;
-    normals.col(i + 1) << n2.x, n2.y, n2.z, 0.0;
-    normals.col(i + 2) << n3.x, n3.y, n3.z, 0.0;
-    
-    uvs.col(i    ) << uv1.x, uv1.y;
-    uvs.col(i + 1) << uv2.x, uv2.y;
-    uvs.col(i + 2) << uv3.x, uv3.y;
-    
-    tangents.col(i    ) << t1.x, t1.y, t1.z, 0.0;
-    tangents.col(i + 1) << t2.x, t2.y, t2.z, 0.0;
-    tangents.col(i + 2) << t3.x, t3.y, t3.z, 0.0;
+void SphereMesh::upload_data() {
+  std::vector<float> data(GPU_VERTEX_SIZE * sphere_num_vertices);
+
+  for (int i = 0; i < sphere_num_vertices; i++) {
+    const double *vPtr = &Vertices[VERTEX_SIZE * i];
+    float *gPtr = &data[GPU_VERTEX_SIZE * i];
+
+    for (int k = 0; k < 3; k++) {
+      gPtr[GPU_POSITION_OFFSET + k] = vPtr[VERTEX_OFFSET + k];
+      gPtr[GPU_NORMAL_OFFSET + k] = vPtr[NORMAL_OFFSET + k];
+      gPtr[GPU_TANGENT_OFFSET + k] = vPtr[TANGEN_OFFSET + k];
+    }
+    gPtr[GPU_POSITION_OFFSET + 3] = 1.0;
+    gPtr[GPU_NORMAL_OFFSET + 3] = 0.0;
+    gPtr[GPU_TANGENT_OFFSET + 3] = 0.0;
+
+    gPtr[GPU_UV_OFFSET + 0] = vPtr[TCOORD_OFFSET + 0];
+    gPtr[GPU_UV_OFFSET + 1] = vPtr[TCOORD_OFFSET + 1];
   }
+
+  glGenBuffers(1, &vertex_buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+  glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), data.data(), GL_STATIC_DRAW);
+
+  // The element buffer binding belongs to whichever vertex array is bound,
+  // so fill the index buffer through a target that is not
+  glGenBuffers(1, &index_buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, Indices.size() * sizeof(unsigned int),
+               Indices.data(), GL_STATIC_DRAW);
+
+  glGenBuffers(1, &instance_buffer);
 }
 
-void SphereMesh::draw_sphere(GLShader &shader, const Vector3D &p, double r) {
+GLuint SphereMesh::vertex_array(GLShader &shader) {
+  GLint program;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &program);
 
-  Matrix4f model;
-  model << r, 0, 0, p.x, 0, r, 0, p.y, 0, 0, r, p.z, 0, 0, 0, 1;
+  GLuint &vao = vertex_arrays[program];
+  if (vao) return vao;
+
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+
+  // Per-vertex attributes, from the static interleaved buffer
+  struct { const char *name; int size; int offset; } attribs[] = {
+    {"in_position", 4, GPU_POSITION_OFFSET},
+    {"in_normal", 4, GPU_NORMAL_OFFSET},
+    {"in_uv", 2, GPU_UV_OFFSET},
+    {"in_tangent", 4, GPU_TANGENT_OFFSET},
+  };
 
+  glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+  for (const auto &attrib : attribs) {
+    GLint id = shader.attrib(attrib.name, false);
+    if (id == -1) continue;
+    glEnableVertexAttribArray(id);
+    glVertexAttribPointer(id, attrib.size, GL_FLOAT, GL_FALSE, GPU_VERTEX_SIZE * sizeof(float),
+                          (const void *)(attrib.offset * sizeof(float)));
+  }
+
+  // Per-instance center and radius
+  GLint id = shader.attrib("in_instance", false);
+  if (id != -1) {
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    glEnableVertexAttribArray(id);
+    glVertexAttribPointer(id, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glVertexAttribDivisor(id, 1);
+  }
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+  return vao;
+}
+
+void SphereMesh::add_instance(const Vector3D &p, double r) {
+  instances.push_back(p.x);
+  instances.push_back(p.y);
+  instances.push_back(p.z);
+  instances.push_back(r);
+}
+
+void SphereMesh::draw_instances(GLShader &shader) {
+  if (instances.empty()) return;
+  if (!vertex_buffer) upload_data();
+
+  Matrix4f model;
+  model.setIdentity();
   shader.setUniform("u_model", model);
 
+  glBindVertexArray(vertex_array(shader));
+
+  // Orphan last frame's instance data instead of waiting for the GPU to finish with it
+  glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+  glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(float), nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(float), instances.data());
+
+  glDrawElementsInstanced(GL_TRIANGLES, sphere_num_indices, GL_UNSIGNED_INT, 0,
+                          instances.size() / 4);
+  instances.clear();
+
+  // Restore the shader's own vertex array for the draws that follow
+  shader.bind();
+}
+
+void SphereMesh::select_lods(const Frustum &frustum) {
+  size_t kept = 0;
+
+  for (size_t i = 0; i < instances.size(); i += 4) {
+    Vector3D p(instances[i], instances[i + 1], instances[i + 2]);
+    double r = instances[i + 3];
 
-  shader.uploadAttrib("in_position", positions);
-  if (shader.attrib("in_normal", false) != -1) {
-    shader.uploadAttrib("in_normal", normals);
+    // Half a meridian spans PI * r; keep its rings LOD_TARGET_PIXELS apart
+    double rings = PI * frustum.pixels(r, p, r) / LOD_TARGET_PIXELS;
+    int lat = sphere_num_lat;
+    int lon = sphere_num_lon;
+    while (lat / 2 >= std::max(rings, (double)SPHERE_MIN_RINGS) && lon / 2 >= SPHERE_MIN_RINGS) {
+      lat /= 2;
+      lon /= 2;
+    }
+
+    if (lat == sphere_num_lat) {
+      for (int k = 0; k < 4; k++) {
+        instances[kept++] = instances[i + k];
+      }
+    } else {
+      shared(lat, lon)->add_instance(p, r);
+    }
+  }
+  instances.resize(kept);
+}
+
+void SphereMesh::draw_all_instances(GLShader &shader, const Frustum &frustum) {
+  // Finest meshes first, so instances moved to a coarser mesh are seen again
+  // there. Meshes created on the way sort after the current one.
+  std::map<std::pair<int, int>, SphereMesh *> &meshes = shared_meshes();
+  for (auto it = meshes.rbegin(); it != meshes.rend(); ++it) {
+    it->second->select_lods(frustum);
   }
-  if (shader.attrib("in_uv", false) != -1) {
-    shader.uploadAttrib("in_uv", uvs);
+
+  for (auto &entry : meshes) {
+    entry.second->draw_instances(shader);
   }
-  if (shader.attrib("in_tangent", false) != -1) {
-    shader.uploadAttrib("in_tangent", tangents, false);
+}
+
+void SphereMesh::release_program(GLuint program) {
+  for (auto &entry : shared_meshes()) {
+    std::map<GLint, GLuint> &vertex_arrays = entry.second->vertex_arrays;
+    auto vao = vertex_arrays.find(program);
+    if (vao == vertex_arrays.end()) continue;
+    glDeleteVertexArrays(1, &vao->second);
+    vertex_arrays.erase(vao);
   }
+}
 
-  shader.drawArray(GL_TRIANGLES, 0, sphere_num_indices);
+void SphereMesh::draw_sphere(GLShader &shader, const Vector3D &p, double r) {
+  add_instance(p, r);
+  draw_instances(shader);
 }
 
 } // namespace Misc
@@ -1,11 +1,13 @@
 #ifndef CGL_UTIL_SPHEREDRAWING_H
 #define CGL_UTIL_SPHEREDRAWING_H
 
+#include <map>
 #include <vector>
 
 #include <nanogui/nanogui.h>
 
 #include "CGL/CGL.h"
+#include "frustum.h"
 
 using namespace nanogui;
 
@@ -16,8 +18,39 @@ class SphereMesh {
 public:
   // Supply the desired number of vertices
   SphereMesh(int num_lat = 40, int num_lon = 40);
-  
-  
+  ~SphereMesh();
+
+  /**
+   * Returns the mesh for the given resolution, shared by every caller that
+   * asks for it, so the scene keeps one copy of each sphere on the GPU.
+   */
+  static SphereMesh *shared(int num_lat, int num_lon);
+
+  /**
+   * Queues a sphere with the given position and radius. Queued spheres are
+   * drawn together, with one instanced draw call, by the next draw_instances.
+   */
+  void add_instance(const Vector3D &p, double r);
+
+  /**
+   * Draws every queued sphere using the current view/projection matrix and
+   * color/material settings of the bound shader, then clears the queue.
+   */
+  void draw_instances(GLShader &shader);
+
+  /**
+   * Draws the queued spheres of every shared mesh. Each sphere is first moved
+   * to the coarsest shared mesh, with half the rings per level, that keeps
+   * its rings about LOD_TARGET_PIXELS apart on screen.
+   */
+  static void draw_all_instances(GLShader &shader, const Frustum &frustum = Frustum());
+
+  /**
+   * Deletes every shared mesh's vertex array for a program that is about to
+   * be deleted, so a later program given the same name gets its own.
+   */
+  static void release_program(GLuint program);
+
   /**
    * Draws a sphere with the given position and radius in opengl, using the
    * current modelview/projection matrices and color/material settings.
@@ -29,18 +62,27 @@ private:
   
   int s_index(int x, int y);
   
-  void build_data();
+  void upload_data();
+  void select_lods(const Frustum &frustum);
+  GLuint vertex_array(GLShader &shader);
   
   int sphere_num_lat;
   int sphere_num_lon;
   
   int sphere_num_vertices;
   int sphere_num_indices;
-  
-  MatrixXf positions;
-  MatrixXf normals;
-  MatrixXf uvs;
-  MatrixXf tangents;
+
+  // Static mesh buffers, uploaded once
+  GLuint vertex_buffer;
+  GLuint index_buffer;
+
+  // (center, radius) of each queued instance, streamed every draw
+  std::vector<float> instances;
+  GLuint instance_buffer;
+
+  // Attribute locations differ between programs, so each program that draws
+  // this mesh gets its own vertex array object
+  std::map<GLint, GLuint> vertex_arrays;
 };
 
 
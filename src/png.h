@@ -1,6 +1,7 @@
 #ifndef CGL_PNG_H
 #define CGL_PNG_H
 
+#include <cstddef>
 #include <map>
 #include <vector>
 
@@ -16,7 +17,9 @@ namespace CGL {
   public:
     static int load( const unsigned char* buffer, size_t size, PNG& png );
     static int load( const char* filename, PNG& png );
+    // Writes 8-bit RGBA pixels, top row first; returns 0 on success
     static int save( const char* filename, const PNG& png );
+    static int encode( const PNG& png, std::vector<unsigned char>& out );
   }; // class PNGParser
 
 } // namespace CGL
@@ -0,0 +1,120 @@
+#include <cstring>
+#include <fstream>
+
+#include "misc/mapped_file.h"
+#include "sceneFormat.h"
+
+using CGL::Misc::MappedFile;
+
+// Sections start on multiples of this many bytes
+#define SECTION_ALIGNMENT 8
+
+bool isBinaryScene(const string &filename) {
+  ifstream in(filename, ios::binary);
+  char magic[sizeof(SCENE_FORMAT_MAGIC)];
+  in.read(magic, sizeof(magic));
+  return in.good() && memcmp(magic, SCENE_FORMAT_MAGIC, sizeof(magic)) == 0;
+}
+
+template <typename T>
+static void set_section(SceneFileHeader &header, SceneSection section, const RecordSpan<T> &records,
+                        uint64_t &offset) {
+  offset = (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+  header.sections[section].offset = offset;
+  header.sections[section].count = records.size;
+  offset += records.size * sizeof(T);
+}
+
+template <typename T>
+static void write_section(ofstream &out, const SceneFileHeader &header, SceneSection section,
+                          const RecordSpan<T> &records) {
+  static const char zeros[SECTION_ALIGNMENT] = {0};
+  out.write(zeros, header.sections[section].offset - out.tellp());
+  out.write((const char *)records.data, records.size * sizeof(T));
+}
+
+bool writeBinaryScene(const string &filename, const SceneView &scene) {
+  SceneFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SCENE_FORMAT_MAGIC, sizeof(SCENE_FORMAT_MAGIC));
+  header.version = SCENE_FORMAT_VERSION;
+  header.byte_order = SCENE_FORMAT_BYTE_ORDER;
+
+  uint64_t offset = sizeof(header);
+  set_section(header, SECTION_CLOTHS, scene.cloths, offset);
+  set_section(header, SECTION_PINS, scene.pins, offset);
+  set_section(header, SECTION_TETHERS, scene.tethers, offset);
+  set_section(header, SECTION_POSITIONS, scene.positions, offset);
+  set_section(header, SECTION_SPHERES, scene.spheres, offset);
+  set_section(header, SECTION_PLANES, scene.planes, offset);
+  set_section(header, SECTION_SDFS, scene.sdfs, offset);
+  set_section(header, SECTION_KEYFRAMES, scene.keyframes, offset);
+  set_section(header, SECTION_WINDS, scene.winds, offset);
+  set_section(header, SECTION_STRINGS, scene.strings, offset);
+
+  ofstream out(filename, ios::binary);
+  if (!out.good()) return false;
+  out.write((const char *)&header, sizeof(header));
+  write_section(out, header, SECTION_CLOTHS, scene.cloths);
+  write_section(out, header, SECTION_PINS, scene.pins);
+  write_section(out, header, SECTION_TETHERS, scene.tethers);
+  write_section(out, header, SECTION_POSITIONS, scene.positions);
+  write_section(out, header, SECTION_SPHERES, scene.spheres);
+  write_section(out, header, SECTION_PLANES, scene.planes);
+  write_section(out, header, SECTION_SDFS, scene.sdfs);
+  write_section(out, header, SECTION_KEYFRAMES, scene.keyframes);
+  write_section(out, header, SECTION_WINDS, scene.winds);
+  write_section(out, header, SECTION_STRINGS, scene.strings);
+  return out.good();
+}
+
+template <typename T>
+static bool map_section(const MappedFile &file, const SceneFileHeader &header, SceneSection section,
+                        RecordSpan<T> &records) {
+  uint64_t offset = header.sections[section].offset;
+  uint64_t count = header.sections[section].count;
+  if (offset % SECTION_ALIGNMENT != 0 || offset > file.size() ||
+      count > (file.size() - offset) / sizeof(T)) {
+    return false;
+  }
+  records = RecordSpan<T>((const T *)(file.data() + offset), count);
+  return true;
+}
+
+bool mapBinaryScene(const string &filename, MappedFile &file, SceneView &scene, string &error) {
+  if (!file.open(filename)) {
+    error = "cannot read the file";
+    return false;
+  }
+
+  const SceneFileHeader *header = (const SceneFileHeader *)file.data();
+  if (file.size() < sizeof(SceneFileHeader) ||
+      memcmp(header->magic, SCENE_FORMAT_MAGIC, sizeof(SCENE_FORMAT_MAGIC)) != 0) {
+    error = "not a binary scene";
+    return false;
+  }
+  if (header->byte_order != SCENE_FORMAT_BYTE_ORDER) {
+    error = "written on a machine of the other byte order";
+    return false;
+  }
+  if (header->version != SCENE_FORMAT_VERSION) {
+    error = "format version " + to_string(header->version) + ", expected " +
+            to_string(SCENE_FORMAT_VERSION) + "; convert the scene again";
+    return false;
+  }
+
+  if (!map_section(file, *header, SECTION_CLOTHS, scene.cloths) ||
+      !map_section(file, *header, SECTION_PINS, scene.pins) ||
+      !map_section(file, *header, SECTION_TETHERS, scene.tethers) ||
+      !map_section(file, *header, SECTION_POSITIONS, scene.positions) ||
+      !map_section(file, *header, SECTION_SPHERES, scene.spheres) ||
+      !map_section(file, *header, SECTION_PLANES, scene.planes) ||
+      !map_section(file, *header, SECTION_SDFS, scene.sdfs) ||
+      !map_section(file, *header, SECTION_KEYFRAMES, scene.keyframes) ||
+      !map_section(file, *header, SECTION_WINDS, scene.winds) ||
+      !map_section(file, *header, SECTION_STRINGS, scene.strings)) {
+    error = "truncated or corrupt section table";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,200 @@
+#ifndef SCENE_FORMAT_H
+#define SCENE_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "misc/mapped_file.h"
+
+using namespace std;
+
+/**
+ * Flat records describing a scene, shared by the JSON loader and the binary
+ * scene format.
+ *
+ * A binary scene file is a SceneFileHeader followed by one array of records
+ * per section, each 8-byte aligned, in the byte order and layout below. The
+ * loader maps the file and builds the scene straight from the mapped
+ * records, so nothing is parsed. Records refer to their pins, strings,
+ * particle positions and keyframes by first index and count into the
+ * matching section.
+ *
+ * Any change to a record's layout must bump SCENE_FORMAT_VERSION.
+ */
+
+#define SCENE_FORMAT_VERSION 2
+#define SCENE_FORMAT_MAGIC "CLTHSCN"
+// Written as a native integer; reads back differently on the other endianness
+#define SCENE_FORMAT_BYTE_ORDER 0x01020304u
+
+struct Vector3Record {
+  double x, y, z;
+};
+
+// Pinned grid points x0..x1, y0..y1, inclusive; a single point has
+// x0 == x1 and y0 == y1
+struct PinRecord {
+  int32_t x0, y0, x1, y1;
+};
+
+struct TetherRecord {
+  // Grid vertex the string hangs from
+  int32_t x, y;
+  double length;
+  int32_t segments;
+  int32_t substeps;
+  double density;
+  double bending;
+  int32_t iterations;
+  int32_t anchored;
+  Vector3Record anchor;
+};
+
+struct ClothRecord {
+  double width, height;
+  int32_t num_width_points, num_height_points;
+  float thickness;
+  int32_t orientation;
+  Vector3Record offset;
+
+  // Material; the first cloth's is used for the whole scene
+  uint8_t enable_structural, enable_shearing, enable_bending, padding[5];
+  double damping, density, ks;
+
+  uint32_t first_pin, num_pins;
+  uint32_t first_tether, num_tethers;
+  // Initial particle positions, row by row; none for the default layout
+  uint64_t first_position, num_positions;
+};
+
+struct KeyframeRecord {
+  double time;
+  Vector3Record translation;
+};
+
+// Keyframed motion of a collider
+struct MotionRecord {
+  uint32_t first_keyframe, num_keyframes;
+  uint32_t loop, padding;
+};
+
+struct SphereRecord {
+  Vector3Record origin;
+  double radius, friction;
+  MotionRecord motion;
+};
+
+struct PlaneRecord {
+  Vector3Record point, normal;
+  double friction;
+  MotionRecord motion;
+};
+
+struct SDFRecord {
+  // Mesh path, as a range of the string section
+  uint64_t path_offset, path_length;
+  double friction;
+  int32_t resolution, band;
+  MotionRecord motion;
+};
+
+struct WindRecord {
+  Vector3Record velocity;
+  double turbulence, scale, density, drag, lift, cache_interval;
+  uint32_t seed, padding;
+};
+
+enum SceneSection {
+  SECTION_CLOTHS,
+  SECTION_PINS,
+  SECTION_TETHERS,
+  SECTION_POSITIONS,
+  SECTION_SPHERES,
+  SECTION_PLANES,
+  SECTION_SDFS,
+  SECTION_KEYFRAMES,
+  SECTION_WINDS,
+  SECTION_STRINGS,
+  NUM_SCENE_SECTIONS
+};
+
+struct SceneFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  // Byte offset and record count of each section
+  struct {
+    uint64_t offset, count;
+  } sections[NUM_SCENE_SECTIONS];
+};
+
+// A read-only run of records, in a SceneData or in a mapped file
+template <typename T>
+struct RecordSpan {
+  RecordSpan() : data(nullptr), size(0) {}
+  RecordSpan(const T *data, size_t size) : data(data), size(size) {}
+  RecordSpan(const vector<T> &v) : data(v.data()), size(v.size()) {}
+
+  const T &operator[](size_t i) const { return data[i]; }
+  const T *begin() const { return data; }
+  const T *end() const { return data + size; }
+
+  const T *data;
+  size_t size;
+};
+
+struct SceneView {
+  RecordSpan<ClothRecord> cloths;
+  RecordSpan<PinRecord> pins;
+  RecordSpan<TetherRecord> tethers;
+  RecordSpan<Vector3Record> positions;
+  RecordSpan<SphereRecord> spheres;
+  RecordSpan<PlaneRecord> planes;
+  RecordSpan<SDFRecord> sdfs;
+  RecordSpan<KeyframeRecord> keyframes;
+  RecordSpan<WindRecord> winds;
+  RecordSpan<char> strings;
+};
+
+// A scene being assembled, e.g. while a JSON file is parsed
+struct SceneData {
+  vector<ClothRecord> cloths;
+  vector<PinRecord> pins;
+  vector<TetherRecord> tethers;
+  vector<Vector3Record> positions;
+  vector<SphereRecord> spheres;
+  vector<PlaneRecord> planes;
+  vector<SDFRecord> sdfs;
+  vector<KeyframeRecord> keyframes;
+  vector<WindRecord> winds;
+  vector<char> strings;
+
+  SceneView view() const {
+    SceneView v;
+    v.cloths = cloths;
+    v.pins = pins;
+    v.tethers = tethers;
+    v.positions = positions;
+    v.spheres = spheres;
+    v.planes = planes;
+    v.sdfs = sdfs;
+    v.keyframes = keyframes;
+    v.winds = winds;
+    v.strings = strings;
+    return v;
+  }
+};
+
+// Whether a file starts like a binary scene
+bool isBinaryScene(const string &filename);
+
+bool writeBinaryScene(const string &filename, const SceneView &scene);
+
+// Maps a binary scene file and points scene at its records, which stay
+// valid while file is open. On failure error says what is wrong.
+bool mapBinaryScene(const string &filename, CGL::Misc::MappedFile &file, SceneView &scene,
+                    string &error);
+
+#endif /* SCENE_FORMAT_H */
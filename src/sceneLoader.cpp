@@ -0,0 +1,795 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#include "collision/plane.h"
+#include "collision/sdfCollider.h"
+#include "collision/sphere.h"
+#include "misc/file_utils.h"
+#include "misc/json_reader.h"
+#include "sceneFormat.h"
+#include "sceneLoader.h"
+
+using CGL::Misc::JsonReader;
+using CGL::Misc::MappedFile;
+
+const string SPHERE = "sphere";
+const string PLANE = "plane";
+const string CLOTH = "cloth";
+const string SDF = "sdf";
+const string WIND = "wind";
+
+namespace {
+
+/**
+ * Fills the scene records while the file is parsed, one value at a time.
+ * Problems are collected with their locations instead of ending the load,
+ * so a scene with several mistakes reports all of them at once; only
+ * malformed JSON stops the parse.
+ */
+class SceneParser {
+public:
+  SceneParser(const string &filename, JsonReader &in, SceneData &data)
+      : filename(filename), in(in), data(data) {}
+
+  void scene();
+
+  vector<string> errors;
+
+private:
+  typedef JsonReader::Location Location;
+
+  void cloth();
+  void sphere();
+  void plane();
+  void sdf();
+  void wind_field();
+
+  // Reads the object under a scene key
+  void each_object(const string &type);
+  bool begin_object(const char *type, Location &at);
+
+  string located(const Location &at, const string &message) const;
+  void error(const Location &at, const string &message);
+  void warning(const Location &at, const string &message);
+  void unknown_key(const char *type, const string &key, const Location &at);
+  void require(const char *type, const Location &at, const set<string> &seen,
+               const vector<const char *> &keys);
+
+  // Reads a value into v; on a type mismatch the value is skipped and
+  // reported
+  template <typename T>
+  bool field(const char *type, const string &key, T &v);
+
+  bool take(double &v) { return in.read(v); }
+  bool take(float &v);
+  bool take(int &v) { return in.read(v); }
+  bool take(unsigned int &v) { return in.read(v); }
+  bool take(bool &v) { return in.read(v); }
+  bool take(uint8_t &v);
+  bool take(string &v) { return in.read(v); }
+  bool take(Vector3Record &v);
+  bool take(vector<int> &v);
+
+  static const char *expected(const double &) { return "a number"; }
+  static const char *expected(const float &) { return "a number"; }
+  static const char *expected(const int &) { return "an integer"; }
+  static const char *expected(const unsigned int &) { return "a non-negative integer"; }
+  static const char *expected(const bool &) { return "true or false"; }
+  static const char *expected(const uint8_t &) { return "true or false"; }
+  static const char *expected(const string &) { return "a string"; }
+  static const char *expected(const Vector3Record &) { return "an array of 3 numbers"; }
+  static const char *expected(const vector<int> &) { return "an array of integers"; }
+
+  // Reads an array of objects or points, calling element() on each
+  template <typename F>
+  void each_element(const char *type, const string &key, const char *expected, F element);
+
+  // Reads a {"from": [x, y], "to": [x, y]} pinned region
+  bool pin_region(PinRecord &pin);
+
+  // Keyframe keys shared by every collider
+  bool motion_field(const string &key, MotionRecord &motion, const char *type);
+  void keyframe();
+
+  const string &filename;
+  JsonReader &in;
+  SceneData &data;
+};
+
+string SceneParser::located(const Location &at, const string &message) const {
+  ostringstream s;
+  s << filename << ":" << at.line << ":" << at.column << ": " << message;
+  return s.str();
+}
+
+void SceneParser::error(const Location &at, const string &message) {
+  // Past malformed JSON, whatever is left unread would be reported as missing
+  if (in.failed()) return;
+  errors.push_back(located(at, message));
+}
+
+void SceneParser::warning(const Location &at, const string &message) {
+  if (in.failed()) return;
+  cout << located(at, "warning: " + message) << endl;
+}
+
+void SceneParser::unknown_key(const char *type, const string &key, const Location &at) {
+  warning(at, string("ignoring unknown ") + type + " key \"" + key + "\"");
+  in.skip();
+}
+
+void SceneParser::require(const char *type, const Location &at, const set<string> &seen,
+                          const vector<const char *> &keys) {
+  for (const char *key : keys) {
+    if (!seen.count(key)) {
+      error(at, string("incomplete ") + type + " definition, missing \"" + key + "\"");
+    }
+  }
+}
+
+template <typename T>
+bool SceneParser::field(const char *type, const string &key, T &v) {
+  Location at = in.location();
+  if (take(v)) return true;
+  // take() consumed nothing if the value has the wrong type at the top level
+  if (in.location().line == at.line && in.location().column == at.column) in.skip();
+  error(at, string(type) + " \"" + key + "\" must be " + expected(v));
+  return false;
+}
+
+bool SceneParser::take(float &v) {
+  double d;
+  if (!in.read(d)) return false;
+  v = d;
+  return true;
+}
+
+bool SceneParser::take(uint8_t &v) {
+  bool b;
+  if (!in.read(b)) return false;
+  v = b;
+  return true;
+}
+
+bool SceneParser::take(Vector3Record &v) {
+  if (!in.begin_array()) return false;
+  double *xyz[3] = {&v.x, &v.y, &v.z};
+  int count = 0;
+  bool ok = true;
+  while (in.next_element()) {
+    if (count >= 3 || !in.read(*xyz[count])) {
+      ok = false;
+      in.skip();
+    }
+    count++;
+  }
+  return ok && count == 3;
+}
+
+bool SceneParser::take(vector<int> &v) {
+  if (!in.begin_array()) return false;
+  v.clear();
+  bool ok = true;
+  while (in.next_element()) {
+    int x;
+    if (in.read(x)) {
+      v.push_back(x);
+    } else {
+      ok = false;
+      in.skip();
+    }
+  }
+  return ok;
+}
+
+template <typename F>
+void SceneParser::each_element(const char *type, const string &key, const char *expected, F element) {
+  Location at = in.location();
+  if (!in.begin_array()) {
+    error(at, string(type) + " \"" + key + "\" must be " + expected);
+    in.skip();
+    return;
+  }
+  while (in.next_element()) element();
+}
+
+bool SceneParser::begin_object(const char *type, Location &at) {
+  at = in.location();
+  if (in.begin_object()) return true;
+  error(at, string(type) + " must be an object");
+  in.skip();
+  return false;
+}
+
+void SceneParser::scene() {
+  Location at = in.location();
+  if (!in.begin_object()) {
+    error(at, "a scene must be an object");
+    return;
+  }
+
+  string key;
+  while (in.next_key(key)) {
+    if (key != CLOTH && key != SPHERE && key != PLANE && key != SDF && key != WIND) {
+      error(in.location(), "invalid scene object \"" + key + "\"");
+      in.skip();
+      continue;
+    }
+
+    // Only balloons come in arrays; any other array is reported as not an
+    // object
+    if (key == CLOTH && in.peek() == JsonReader::ARRAY) {
+      in.begin_array();
+      while (in.next_element()) each_object(key);
+    } else {
+      each_object(key);
+    }
+  }
+
+  if (!in.finish()) {
+    errors.push_back(located(in.error_location(), in.error()));
+  }
+}
+
+void SceneParser::each_object(const string &type) {
+  if (type == CLOTH) cloth();
+  else if (type == SPHERE) sphere();
+  else if (type == PLANE) plane();
+  else if (type == SDF) sdf();
+  else wind_field();
+}
+
+bool SceneParser::motion_field(const string &key, MotionRecord &motion, const char *type) {
+  // Optional "keyframes" ([{"time": t, "translation": [x, y, z]}, ...]) and
+  // "loop" entries make any collision object kinematic
+  if (key == "keyframes") {
+    motion.first_keyframe = data.keyframes.size();
+    each_element(type, key, "an array of keyframe objects", [this]() { keyframe(); });
+    motion.num_keyframes = data.keyframes.size() - motion.first_keyframe;
+  } else if (key == "loop") {
+    bool loop = false;
+    field(type, key, loop);
+    motion.loop = loop;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool SceneParser::pin_region(PinRecord &pin) {
+  Location at;
+  if (!begin_object("pinned region", at)) return false;
+
+  vector<int> from, to;
+  set<string> seen;
+  string key;
+  while (in.next_key(key)) {
+    Location key_at = in.location();
+    seen.insert(key);
+    if (key == "from") field("pinned region", key, from);
+    else if (key == "to") field("pinned region", key, to);
+    else unknown_key("pinned region", key, key_at);
+  }
+  require("pinned region", at, seen, {"from", "to"});
+  if (from.size() != 2 || to.size() != 2) return true;
+
+  // Corners may come in any order
+  pin.x0 = min(from[0], to[0]);
+  pin.y0 = min(from[1], to[1]);
+  pin.x1 = max(from[0], to[0]);
+  pin.y1 = max(from[1], to[1]);
+  return true;
+}
+
+void SceneParser::keyframe() {
+  Location at;
+  if (!begin_object("keyframe", at)) return;
+
+  KeyframeRecord keyframe = {0, {0, 0, 0}};
+  set<string> seen;
+  string key;
+  while (in.next_key(key)) {
+    Location key_at = in.location();
+    seen.insert(key);
+    if (key == "time") field("keyframe", key, keyframe.time);
+    else if (key == "translation") field("keyframe", key, keyframe.translation);
+    else unknown_key("keyframe", key, key_at);
+  }
+  require("keyframe", at, seen, {"time", "translation"});
+  data.keyframes.push_back(keyframe);
+}
+
+void SceneParser::cloth() {
+  Location at;
+  if (!begin_object("cloth", at)) return;
+
+  ClothRecord cloth;
+  memset(&cloth, 0, sizeof(cloth));
+  cloth.first_pin = data.pins.size();
+  cloth.first_tether = data.tethers.size();
+  cloth.first_position = data.positions.size();
+
+  // Pins and strings are checked against the grid once its size is known
+  vector<Location> pins_at, tethers_at;
+  // Strings hang from grid vertices, addressed like pinned points
+  Tether defaults(0, 0, 16, 0.01);
+
+  set<string> seen;
+  string key;
+  while (in.next_key(key)) {
+    Location key_at = in.location();
+    seen.insert(key);
+    if (key == "width") field("cloth", key, cloth.width);
+    else if (key == "height") field("cloth", key, cloth.height);
+    else if (key == "num_width_points") field("cloth", key, cloth.num_width_points);
+    else if (key == "num_height_points") field("cloth", key, cloth.num_height_points);
+    // Thickness has always been read at single precision
+    else if (key == "thickness") field("cloth", key, cloth.thickness);
+    else if (key == "orientation") field("cloth", key, cloth.orientation);
+    else if (key == "offset") field("cloth", key, cloth.offset);
+    else if (key == "enable_structural") field("cloth", key, cloth.enable_structural);
+    else if (key == "enable_shearing") field("cloth", key, cloth.enable_shearing);
+    else if (key == "enable_bending") field("cloth", key, cloth.enable_bending);
+    else if (key == "damping") field("cloth", key, cloth.damping);
+    else if (key == "density") field("cloth", key, cloth.density);
+    else if (key == "ks") field("cloth", key, cloth.ks);
+    else if (key == "pinned") {
+      // Single [x, y] points, or {"from": [x, y], "to": [x, y]} regions
+      // such as whole rings of the balloon
+      each_element("cloth", key, "an array of [x, y] points and regions", [&]() {
+        Location pin_at = in.location();
+        PinRecord pin = {-1, -1, -1, -1};
+        if (in.peek() == JsonReader::OBJECT) {
+          if (!pin_region(pin)) return;
+        } else {
+          vector<int> point;
+          if (!field("pinned point", "[x, y]", point)) return;
+          if (point.size() == 2) {
+            pin.x0 = pin.x1 = point[0];
+            pin.y0 = pin.y1 = point[1];
+          }
+        }
+        data.pins.push_back(pin);
+        pins_at.push_back(pin_at);
+      });
+    } else if (key == "positions") {
+      each_element("cloth", key, "an array of [x, y, z] points", [&]() {
+        Vector3Record position = {0, 0, 0};
+        field("cloth", "positions", position);
+        data.positions.push_back(position);
+      });
+    } else if (key == "tethers") {
+      each_element("cloth", key, "an array of objects", [&]() {
+        Location tether_at;
+        if (!begin_object("tether", tether_at)) return;
+
+        TetherRecord tether;
+        memset(&tether, 0, sizeof(tether));
+        tether.x = tether.y = -1;
+        tether.segments = defaults.num_segments;
+        tether.density = defaults.density;
+        tether.bending = defaults.bending;
+        tether.substeps = defaults.substeps;
+        tether.iterations = defaults.iterations;
+
+        set<string> tether_seen;
+        string tether_key;
+        while (in.next_key(tether_key)) {
+          Location tether_key_at = in.location();
+          tether_seen.insert(tether_key);
+          if (tether_key == "vertex") {
+            vector<int> vertex;
+            if (field("tether", tether_key, vertex) && vertex.size() == 2) {
+              tether.x = vertex[0];
+              tether.y = vertex[1];
+            }
+          }
+          else if (tether_key == "length") field("tether", tether_key, tether.length);
+          else if (tether_key == "segments") field("tether", tether_key, tether.segments);
+          else if (tether_key == "density") field("tether", tether_key, tether.density);
+          else if (tether_key == "bending") field("tether", tether_key, tether.bending);
+          else if (tether_key == "substeps") field("tether", tether_key, tether.substeps);
+          else if (tether_key == "iterations") field("tether", tether_key, tether.iterations);
+          else if (tether_key == "anchor") tether.anchored = field("tether", tether_key, tether.anchor);
+          else unknown_key("tether", tether_key, tether_key_at);
+        }
+        require("tether", tether_at, tether_seen, {"vertex", "length"});
+        if (tether_seen.count("length") && (tether.length <= 0 || tether.segments < 1 || tether.density <= 0)) {
+          error(tether_at, "tether length, segments and density must be positive");
+        }
+        data.tethers.push_back(tether);
+        tethers_at.push_back(tether_at);
+      });
+    } else {
+      unknown_key("cloth", key, key_at);
+    }
+  }
+
+  cloth.num_pins = data.pins.size() - cloth.first_pin;
+  cloth.num_tethers = data.tethers.size() - cloth.first_tether;
+  cloth.num_positions = data.positions.size() - cloth.first_position;
+
+  require("cloth", at, seen, {"width", "height", "num_width_points", "num_height_points", "thickness",
+                              "orientation", "enable_structural", "enable_shearing", "enable_bending",
+                              "damping", "density", "ks"});
+  if (cloth.orientation != HORIZONTAL && cloth.orientation != VERTICAL) {
+    error(at, "cloth \"orientation\" must be 0 (horizontal) or 1 (vertical)");
+  }
+
+  int w = cloth.num_width_points, h = cloth.num_height_points;
+  if (!seen.count("num_width_points") || !seen.count("num_height_points")) {
+    data.cloths.push_back(cloth);
+    return;
+  }
+  if (w < 2 || h < 2) {
+    error(at, "cloth needs at least 2 points along each side");
+  }
+  for (size_t i = 0; i < cloth.num_pins; i++) {
+    const PinRecord &pin = data.pins[cloth.first_pin + i];
+    if (pin.x0 < 0 || pin.x1 >= w || pin.y0 < 0 || pin.y1 >= h) {
+      error(pins_at[i], "pinned points must lie on the cloth grid");
+    }
+  }
+  for (size_t i = 0; i < cloth.num_tethers; i++) {
+    const TetherRecord &tether = data.tethers[cloth.first_tether + i];
+    if (tether.x < 0 || tether.x >= w || tether.y < 0 || tether.y >= h) {
+      error(tethers_at[i], "tether vertex must be an [x, y] point on the cloth grid");
+    }
+  }
+  if (cloth.num_positions != 0 && cloth.num_positions != (uint64_t)w * h) {
+    error(at, "cloth \"positions\" must list every particle, row by row");
+  }
+  data.cloths.push_back(cloth);
+}
+
+void SceneParser::sphere() {
+  Location at;
+  if (!begin_object("sphere", at)) return;
+
+  SphereRecord sphere;
+  memset(&sphere, 0, sizeof(sphere));
+
+  set<string> seen;
+  string key;
+  while (in.next_key(key)) {
+    Location key_at = in.location();
+    seen.insert(key);
+    if (key == "origin") field("sphere", key, sphere.origin);
+    else if (key == "radius") field("sphere", key, sphere.radius);
+    else if (key == "friction") field("sphere", key, sphere.friction);
+    else if (!motion_field(key, sphere.motion, "sphere")) unknown_key("sphere", key, key_at);
+  }
+  require("sphere", at, seen, {"origin", "radius", "friction"});
+  data.spheres.push_back(sphere);
+}
+
+void SceneParser::plane() {
+  Location at;
+  if (!begin_object("plane", at)) return;
+
+  PlaneRecord plane;
+  memset(&plane, 0, sizeof(plane));
+
+  set<string> seen;
+  string key;
+  while (in.next_key(key)) {
+    Location key_at = in.location();
+    seen.insert(key);
+    if (key == "point") field("plane", key, plane.point);
+    else if (key == "normal") field("plane", key, plane.normal);
+    else if (key == "friction") field("plane", key, plane.friction);
+    else if (!motion_field(key, plane.motion, "plane")) unknown_key("plane", key, key_at);
+  }
+  require("plane", at, seen, {"point", "normal", "friction"});
+  data.planes.push_back(plane);
+}
+
+void SceneParser::sdf() {
+  Location at;
+  if (!begin_object("sdf", at)) return;
+
+  SDFRecord sdf;
+  memset(&sdf, 0, sizeof(sdf));
+  sdf.resolution = 64;
+  sdf.band = 3;
+  string obj_path;
+
+  set<string> seen;
+  string key;
+  while (in.next_key(key)) {
+    Location key_at = in.location();
+    seen.insert(key);
+    if (key == "obj") field("sdf", key, obj_path);
+    else if (key == "friction") field("sdf", key, sdf.friction);
+    else if (key == "resolution") field("sdf", key, sdf.resolution);
+    else if (key == "band") field("sdf", key, sdf.band);
+    else if (!motion_field(key, sdf.motion, "sdf")) unknown_key("sdf", key, key_at);
+  }
+  require("sdf", at, seen, {"obj", "friction"});
+
+  // Mesh paths are relative to the scene file
+  if (!obj_path.empty() && obj_path[0] != '/') {
+    size_t slash = filename.find_last_of("/\\");
+    if (slash != string::npos) {
+      obj_path = filename.substr(0, slash + 1) + obj_path;
+    }
+  }
+  sdf.path_offset = data.strings.size();
+  sdf.path_length = obj_path.size();
+  data.strings.insert(data.strings.end(), obj_path.begin(), obj_path.end());
+  data.sdfs.push_back(sdf);
+}
+
+void SceneParser::wind_field() {
+  Location at;
+  if (!begin_object("wind", at)) return;
+  if (!data.winds.empty()) {
+    error(at, "at most one wind is supported per scene");
+  }
+
+  WindField defaults;
+  WindRecord wind;
+  memset(&wind, 0, sizeof(wind));
+  wind.turbulence = defaults.turbulence;
+  wind.scale = defaults.scale;
+  wind.density = defaults.air_density;
+  wind.drag = defaults.drag;
+  wind.lift = defaults.lift;
+  wind.cache_interval = defaults.cache_interval;
+  wind.seed = defaults.seed;
+
+  set<string> seen;
+  string key;
+  while (in.next_key(key)) {
+    Location key_at = in.location();
+    seen.insert(key);
+    if (key == "velocity") field("wind", key, wind.velocity);
+    // Everything else is optional
+    else if (key == "turbulence") field("wind", key, wind.turbulence);
+    else if (key == "scale") field("wind", key, wind.scale);
+    else if (key == "density") field("wind", key, wind.density);
+    else if (key == "drag") field("wind", key, wind.drag);
+    else if (key == "lift") field("wind", key, wind.lift);
+    else if (key == "cache_interval") field("wind", key, wind.cache_interval);
+    else if (key == "seed") field("wind", key, wind.seed);
+    else unknown_key("wind", key, key_at);
+  }
+  require("wind", at, seen, {"velocity"});
+  if (wind.scale <= 0 || wind.cache_interval <= 0) {
+    error(at, "wind scale and cache_interval must be positive");
+  }
+  data.winds.push_back(wind);
+}
+
+static Vector3D vector3(const Vector3Record &v) {
+  return Vector3D(v.x, v.y, v.z);
+}
+
+// Whether records [first, first + count) lie within a section
+template <typename T>
+static bool in_section(const RecordSpan<T> &section, uint64_t first, uint64_t count) {
+  return first <= section.size && count <= section.size - first;
+}
+
+static bool set_motion(CollisionObject *co, const MotionRecord &motion, const SceneView &scene) {
+  if (!in_section(scene.keyframes, motion.first_keyframe, motion.num_keyframes)) return false;
+  if (motion.num_keyframes == 0) return true;
+
+  for (uint32_t i = 0; i < motion.num_keyframes; i++) {
+    const KeyframeRecord &key = scene.keyframes[motion.first_keyframe + i];
+    co->keyframes.push_back(Keyframe(key.time, vector3(key.translation)));
+  }
+  stable_sort(co->keyframes.begin(), co->keyframes.end(),
+              [](const Keyframe &a, const Keyframe &b) { return a.time < b.time; });
+  co->loop_keyframes = motion.loop;
+  co->reset_motion();
+  return true;
+}
+
+/**
+ * Creates the simulator objects a scene describes. The JSON parser has
+ * already checked its records with locations; these checks are what a
+ * mapped binary file needs before its indices can be followed.
+ */
+static void buildScene(const SceneView &scene, vector<Cloth *> *cloths, ClothParameters *cp,
+                       vector<CollisionObject *> *objects, WindField **wind,
+                       int sphere_num_lat, int sphere_num_lon, vector<string> &errors) {
+  for (size_t c = 0; c < scene.cloths.size; c++) {
+    const ClothRecord &record = scene.cloths[c];
+    string name = "cloth " + to_string(c);
+    int w = record.num_width_points, h = record.num_height_points;
+    if (w < 2 || h < 2 || (record.orientation != HORIZONTAL && record.orientation != VERTICAL) ||
+        !in_section(scene.pins, record.first_pin, record.num_pins) ||
+        !in_section(scene.tethers, record.first_tether, record.num_tethers) ||
+        !in_section(scene.positions, record.first_position, record.num_positions) ||
+        (record.num_positions != 0 && record.num_positions != (uint64_t)w * h)) {
+      errors.push_back(name + " is invalid");
+      continue;
+    }
+
+    Cloth *cloth = new Cloth();
+    cloth->width = record.width;
+    cloth->height = record.height;
+    cloth->num_width_points = w;
+    cloth->num_height_points = h;
+    cloth->thickness = record.thickness;
+    cloth->orientation = (e_orientation)record.orientation;
+    cloth->offset = vector3(record.offset);
+
+    for (uint32_t i = 0; i < record.num_pins; i++) {
+      const PinRecord &pin = scene.pins[record.first_pin + i];
+      if (pin.x0 < 0 || pin.x0 > pin.x1 || pin.x1 >= w || pin.y0 < 0 || pin.y0 > pin.y1 || pin.y1 >= h) {
+        errors.push_back(name + " has pinned points off the grid");
+        continue;
+      }
+      if (cloth->pinned.empty()) cloth->pinned.assign(w * h, false);
+      for (int y = pin.y0; y <= pin.y1; y++) {
+        fill(cloth->pinned.begin() + y * w + pin.x0, cloth->pinned.begin() + y * w + pin.x1 + 1, true);
+      }
+    }
+
+    for (uint32_t i = 0; i < record.num_tethers; i++) {
+      const TetherRecord &t = scene.tethers[record.first_tether + i];
+      if (t.x < 0 || t.x >= w || t.y < 0 || t.y >= h || t.length <= 0 || t.segments < 1 || t.density <= 0) {
+        errors.push_back(name + " has an invalid tether");
+        continue;
+      }
+      Tether tether(t.y * w + t.x, t.length, t.segments, t.density);
+      tether.bending = t.bending;
+      tether.substeps = max(1, t.substeps);
+      tether.iterations = max(1, t.iterations);
+      tether.anchored = t.anchored;
+      tether.anchor = vector3(t.anchor);
+      cloth->tethers.push_back(tether);
+    }
+
+    for (uint64_t i = 0; i < record.num_positions; i++) {
+      cloth->initial_positions.push_back(vector3(scene.positions[record.first_position + i]));
+    }
+
+    // Material parameters are shared by every cloth; the first one wins
+    if (cloths->empty()) {
+      cp->enable_structural_constraints = record.enable_structural;
+      cp->enable_shearing_constraints = record.enable_shearing;
+      cp->enable_bending_constraints = record.enable_bending;
+      cp->damping = record.damping;
+      cp->density = record.density;
+      cp->ks = record.ks;
+    }
+    cloths->push_back(cloth);
+  }
+
+  for (size_t i = 0; i < scene.spheres.size; i++) {
+    const SphereRecord &record = scene.spheres[i];
+    Sphere *s = new Sphere(vector3(record.origin), record.radius, record.friction, sphere_num_lat, sphere_num_lon);
+    if (!set_motion(s, record.motion, scene)) errors.push_back("sphere " + to_string(i) + " has invalid keyframes");
+    objects->push_back(s);
+  }
+
+  for (size_t i = 0; i < scene.planes.size; i++) {
+    const PlaneRecord &record = scene.planes[i];
+    Plane *p = new Plane(vector3(record.point), vector3(record.normal), record.friction);
+    if (!set_motion(p, record.motion, scene)) errors.push_back("plane " + to_string(i) + " has invalid keyframes");
+    objects->push_back(p);
+  }
+
+  for (size_t i = 0; i < scene.sdfs.size; i++) {
+    const SDFRecord &record = scene.sdfs[i];
+    if (!in_section(scene.strings, record.path_offset, record.path_length)) {
+      errors.push_back("sdf " + to_string(i) + " has an invalid mesh path");
+      continue;
+    }
+    string obj_path(scene.strings.data + record.path_offset, record.path_length);
+    SDFCollider *sdf = new SDFCollider(obj_path, record.friction, record.resolution, record.band);
+    if (!sdf->loaded()) {
+      errors.push_back("could not build an SDF from " + obj_path);
+      delete sdf;
+      continue;
+    }
+    if (!set_motion(sdf, record.motion, scene)) errors.push_back("sdf " + to_string(i) + " has invalid keyframes");
+    objects->push_back(sdf);
+  }
+
+  if (scene.winds.size > 1) {
+    errors.push_back("at most one wind is supported per scene");
+  } else if (scene.winds.size == 1) {
+    const WindRecord &record = scene.winds[0];
+    WindField *w = new WindField();
+    w->base = vector3(record.velocity);
+    w->turbulence = record.turbulence;
+    w->scale = record.scale;
+    w->air_density = record.density;
+    w->drag = record.drag;
+    w->lift = record.lift;
+    w->cache_interval = record.cache_interval;
+    w->seed = record.seed;
+    if (w->scale <= 0 || w->cache_interval <= 0) {
+      errors.push_back("wind scale and cache_interval must be positive");
+    }
+    *wind = w;
+  }
+}
+
+// Parses a JSON scene into records; false if the file cannot be opened
+static bool parseScene(const string &filename, SceneData &data, vector<string> &errors) {
+  // Read the whole file in one go; the parser walks it in place
+  ifstream i(filename, ios::binary);
+  if (!i.good()) {
+    return false;
+  }
+  string text((istreambuf_iterator<char>(i)), istreambuf_iterator<char>());
+  i.close();
+
+  JsonReader in(text.data(), text.data() + text.size());
+  SceneParser parser(filename, in, data);
+  parser.scene();
+  errors = parser.errors;
+  return true;
+}
+
+static void exitOnErrors(const string &filename, const vector<string> &errors) {
+  if (errors.empty()) return;
+  for (const string &e : errors) {
+    cout << e << endl;
+  }
+  cout << errors.size() << (errors.size() == 1 ? " error" : " errors") << " in scene " << filename << endl;
+  exit(-1);
+}
+
+} // namespace
+
+bool loadObjectsFromFile(const string &filename, vector<Cloth *> *cloths, ClothParameters *cp,
+                         vector<CollisionObject *> *objects, WindField **wind,
+                         int sphere_num_lat, int sphere_num_lon) {
+  vector<string> errors;
+
+  if (isBinaryScene(filename)) {
+    // Objects are built straight from the mapped records
+    MappedFile file;
+    SceneView scene;
+    string error;
+    if (!mapBinaryScene(filename, file, scene, error)) {
+      errors.push_back(filename + ": " + error);
+    } else {
+      buildScene(scene, cloths, cp, objects, wind, sphere_num_lat, sphere_num_lon, errors);
+    }
+    exitOnErrors(filename, errors);
+    return true;
+  }
+
+  SceneData data;
+  if (!parseScene(filename, data, errors)) {
+    return false;
+  }
+  exitOnErrors(filename, errors);
+  buildScene(data.view(), cloths, cp, objects, wind, sphere_num_lat, sphere_num_lon, errors);
+  exitOnErrors(filename, errors);
+  return true;
+}
+
+bool convertScene(const string &filename, const string &binary_filename) {
+  SceneData data;
+  vector<string> errors;
+  if (!parseScene(filename, data, errors)) {
+    return false;
+  }
+  exitOnErrors(filename, errors);
+
+  // The binary file may be moved away from the scene, so mesh paths are
+  // stored absolute
+  vector<char> strings;
+  for (SDFRecord &sdf : data.sdfs) {
+    string path = FileUtils::absolute_path(string(data.strings.data() + sdf.path_offset, sdf.path_length));
+    sdf.path_offset = strings.size();
+    sdf.path_length = path.size();
+    strings.insert(strings.end(), path.begin(), path.end());
+  }
+  data.strings.swap(strings);
+
+  return writeBinaryScene(binary_filename, data.view());
+}
@@ -0,0 +1,25 @@
+#ifndef SCENE_LOADER_H
+#define SCENE_LOADER_H
+
+#include <string>
+#include <vector>
+
+#include "aerodynamics.h"
+#include "cloth.h"
+#include "collision/collisionObject.h"
+
+using namespace std;
+
+// Reads a JSON or binary scene file into simulator objects. Returns false
+// if the file cannot be opened. A scene with errors is not loaded: every
+// error is printed, with its line and column for JSON, and the program
+// exits.
+bool loadObjectsFromFile(const string &filename, vector<Cloth *> *cloths, ClothParameters *cp,
+                         vector<CollisionObject *> *objects, WindField **wind,
+                         int sphere_num_lat, int sphere_num_lon);
+
+// Writes a JSON scene out in the binary scene format (see sceneFormat.h).
+// Returns false if either file cannot be opened; exits on scene errors.
+bool convertScene(const string &filename, const string &binary_filename);
+
+#endif /* SCENE_LOADER_H */
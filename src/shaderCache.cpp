@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+
+#include "misc/file_utils.h"
+#include "misc/hash.h"
+#include "shaderCache.h"
+
+using namespace std;
+
+// Tag at the start of every cache file
+static const char CACHE_MAGIC[4] = {'C', 'S', 'P', 'B'};
+
+static string read_file(const string &filename) {
+  ifstream t(filename);
+  return string((istreambuf_iterator<char>(t)), istreambuf_iterator<char>());
+}
+
+// 64-bit FNV-1a, continued from a previous hash
+static uint64_t hash_string(const string &data, uint64_t h = FNV1A_OFFSET_BASIS) {
+  h = CGL::Misc::fnv1a(data.data(), data.size(), h);
+  // Separates consecutive strings, so "ab" + "c" and "a" + "bc" differ
+  h ^= 0xff;
+  h *= FNV1A_PRIME;
+  return h;
+}
+
+static string gl_string(GLenum name) {
+  const GLubyte *s = glGetString(name);
+  return s ? string((const char *)s) : string();
+}
+
+static bool binaries_supported() {
+  if (!glProgramBinary || !glGetProgramBinary) return false;
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
+}
+
+bool CachedShader::init_from_binary(const string &name, GLenum format, const vector<char> &binary) {
+  mName = name;
+  glGenVertexArrays(1, &mVertexArrayObject);
+  mProgramShader = glCreateProgram();
+  glProgramBinary(mProgramShader, format, binary.data(), binary.size());
+
+  GLint status;
+  glGetProgramiv(mProgramShader, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE) {
+    free();
+    return false;
+  }
+  return true;
+}
+
+bool CachedShader::load(const string &name, const string &vertex_fname,
+                        const string &fragment_fname, const string &cache_dir) {
+  string vertex_str = read_file(vertex_fname);
+  string fragment_str = read_file(fragment_fname);
+  if (!binaries_supported()) {
+    return init(name, vertex_str, fragment_str);
+  }
+
+  uint64_t key = hash_string(vertex_str);
+  key = hash_string(fragment_str, key);
+  key = hash_string(gl_string(GL_VENDOR), key);
+  key = hash_string(gl_string(GL_RENDERER), key);
+  key = hash_string(gl_string(GL_VERSION), key);
+
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+  string prefix = name + "_";
+  string cache_fname = prefix + hex + ".bin";
+  string cache_path = cache_dir + "/" + cache_fname;
+
+  // Cache file: magic, binary format, binary length, binary
+  ifstream in(cache_path, ios::binary);
+  if (in.good()) {
+    char magic[4];
+    uint32_t format = 0, length = 0;
+    in.read(magic, sizeof(magic));
+    in.read((char *)&format, sizeof(format));
+    in.read((char *)&length, sizeof(length));
+    vector<char> binary(in.good() ? length : 0);
+    in.read(binary.data(), binary.size());
+    if (in.good() && equal(magic, magic + 4, CACHE_MAGIC) && length > 0 &&
+        init_from_binary(name, format, binary)) {
+      return true;
+    }
+    std::cout << "Shader cache entry " << cache_fname << " is stale; recompiling" << std::endl;
+  }
+  in.close();
+
+  if (!init(name, vertex_str, fragment_str)) return false;
+
+  GLint length = 0;
+  glGetProgramiv(mProgramShader, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return true;
+  vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(mProgramShader, length, nullptr, &format, binary.data());
+
+  if (!FileUtils::make_directory(cache_dir)) return true;
+
+  // Entries for older sources or drivers will never be read again
+  set<string> entries;
+  if (FileUtils::list_files_in_directory(cache_dir, entries)) {
+    for (const string &entry : entries) {
+      if (entry != cache_fname && entry.size() == cache_fname.size() &&
+          entry.compare(0, prefix.size(), prefix) == 0) {
+        remove((cache_dir + "/" + entry).c_str());
+      }
+    }
+  }
+
+  ofstream out(cache_path, ios::binary);
+  uint32_t format32 = format, length32 = length;
+  out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  out.write((const char *)&format32, sizeof(format32));
+  out.write((const char *)&length32, sizeof(length32));
+  out.write(binary.data(), binary.size());
+  return true;
+}
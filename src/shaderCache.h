@@ -0,0 +1,33 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <string>
+#include <vector>
+
+#include <nanogui/nanogui.h>
+
+using namespace nanogui;
+
+/**
+ * A GLShader whose linked program is kept on disk as a driver program binary.
+ *
+ * Binaries are keyed by a hash of both sources and of the GL vendor, renderer
+ * and version strings, so editing a shader or updating the driver misses the
+ * cache and recompiles. A binary the driver rejects is treated as a miss.
+ * Drivers without program binary formats always compile.
+ */
+class CachedShader : public GLShader {
+public:
+  // Builds the program from the two source files, loading it from cache_dir
+  // when a matching binary is there and storing it there otherwise
+  bool load(const std::string &name, const std::string &vertex_fname,
+            const std::string &fragment_fname, const std::string &cache_dir);
+
+  bool is_loaded() const { return mProgramShader != 0; }
+  GLuint program() const { return mProgramShader; }
+
+private:
+  bool init_from_binary(const std::string &name, GLenum format, const std::vector<char> &binary);
+};
+
+#endif /* SHADER_CACHE_H */
@@ -0,0 +1,56 @@
+#include "misc/hash.h"
+#include "sceneLoader.h"
+#include "simulation.h"
+
+Simulation::~Simulation() {
+  for (Cloth *cloth : cloths) delete cloth;
+  for (CollisionObject *co : objects) delete co;
+  delete wind;
+}
+
+bool Simulation::load(const string &filename, int sphere_num_lat, int sphere_num_lon) {
+  if (!loadObjectsFromFile(filename, &cloths, &cp, &objects, &wind, sphere_num_lat, sphere_num_lon)) {
+    return false;
+  }
+  for (Cloth *cloth : cloths) {
+    cloth->buildGrid();
+    cloth->buildClothMesh();
+  }
+  return true;
+}
+
+void Simulation::step(int frames_per_sec, int simulation_steps, const Vector3D &gravity) {
+  vector<Vector3D> external_accelerations = {gravity};
+
+  for (int i = 0; i < simulation_steps; i++) {
+    sim_time += 1.0 / frames_per_sec / simulation_steps;
+    for (CollisionObject *co : objects) {
+      co->advance(sim_time);
+    }
+    if (wind) {
+      wind->advance(sim_time);
+    }
+    for (Cloth *cloth : cloths) {
+      cloth->simulate(frames_per_sec, simulation_steps, &cp, external_accelerations, &objects, wind);
+    }
+    cloth_contact.collide(cloths, simulation_steps);
+  }
+}
+
+void Simulation::reset() {
+  for (Cloth *cloth : cloths) {
+    cloth->reset();
+  }
+  sim_time = 0;
+  for (CollisionObject *co : objects) {
+    co->reset_motion();
+  }
+}
+
+uint64_t Simulation::state_hash() const {
+  uint64_t h = Misc::fnv1a(&sim_time, sizeof(sim_time));
+  for (Cloth *cloth : cloths) {
+    h = cloth->state_hash(h);
+  }
+  return h;
+}
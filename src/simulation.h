@@ -0,0 +1,65 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <string>
+#include <vector>
+
+#include "CGL/CGL.h"
+#include "aerodynamics.h"
+#include "cloth.h"
+#include "clothContact.h"
+#include "collision/collisionObject.h"
+
+using namespace CGL;
+using namespace std;
+
+/**
+ * A scene and everything that advances it, without any rendering. The
+ * viewer steps its scene through one of these, and the benchmarks run
+ * scenes headless the same way. Owns the cloths, collision objects and wind.
+ *
+ * Stepping is deterministic: the same scene, parameters and build give the
+ * same state bit for bit, frame by frame, at any number of threads.
+ * Parallel loops only write results of their own element, and anything
+ * gathered from several elements is summed in a fixed order, never in
+ * thread order. state_hash() lets runs be compared; clothsim_bench -D
+ * checks the guarantee at several thread counts.
+ */
+class Simulation {
+public:
+  Simulation() : wind(nullptr), sim_time(0) {}
+  ~Simulation();
+
+  // Loads a JSON or binary scene and builds its cloths. Returns false if the
+  // file cannot be opened; exits on scene errors like loadObjectsFromFile.
+  bool load(const string &filename, int sphere_num_lat = 40, int sphere_num_lon = 40);
+
+  // Advances one frame of simulation_steps substeps: kinematic colliders and
+  // the wind move to each substep's time, every cloth steps, then contact
+  // between cloths is resolved
+  void step(int frames_per_sec, int simulation_steps, const Vector3D &gravity);
+
+  // Puts the cloths and colliders back where the scene starts
+  void reset();
+
+  // Hash of the simulated time and every particle's exact position
+  uint64_t state_hash() const;
+
+  vector<Cloth *> cloths;
+  ClothParameters cp;
+  vector<CollisionObject *> objects;
+  // Null when the scene has no wind
+  WindField *wind;
+
+  // Simulated time, which drives kinematic collision objects and the wind
+  double sim_time;
+
+private:
+  Simulation(const Simulation &);
+  Simulation &operator=(const Simulation &);
+
+  // Pushes apart particles of different cloths
+  ClothContact cloth_contact;
+};
+
+#endif /* SIMULATION_H */
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include "../misc/getopt.h" // getopt for windows
+#else
+#include <getopt.h>
+#include <unistd.h>
+#endif
+
+#include "../cloth.h"
+#include "../clothEnsemble.h"
+#include "parameter_sweep.h"
+
+using namespace std;
+
+/**
+ * Tunes balloon materials by brute force: runs a scene headless once for
+ * every combination of the given parameter values, many runs at a time,
+ * and writes one CSV row per run with the balloons' final volume, the
+ * largest spring strain seen and the time it took them to settle.
+ */
+
+void usageError(const char *binaryName) {
+  printf("Usage: %s -f <scene> -p <parameter> [options]\n", binaryName);
+  printf("Options:\n");
+  printf("  -f     <STRING>    Scene to run, JSON or binary.\n");
+  printf("  -p     <STRING>    Values of one parameter, as name=first:last:count or\n");
+  printf("                     name=a,b,c; may be repeated for different parameters.\n");
+  printf("                     Names are damping, density, ks, thickness and\n");
+  printf("                     inflation; others keep the scene's values.\n");
+  printf("  -n     <INT>       Frames per run. Default 600.\n");
+  printf("  -j     <INT>       Runs at a time. Default the number of cores.\n");
+  printf("  -u                 Leave worker threads unpinned.\n");
+  printf("  -e                 Step %d runs at a time per worker in SIMD lanes. Only\n",
+         ENSEMBLE_LANES);
+  printf("                     for a single balloon without strings or wind.\n");
+  printf("  -v     <FLOAT>     Particle speed (m/s) below which a scene has settled.\n");
+  printf("                     Default %g.\n", SLEEP_SPEED);
+  printf("  -o     <STRING>    Write results to a file instead of stdout.\n");
+  printf("\n");
+  exit(-1);
+}
+
+int main(int argc, char **argv) {
+  SweepOptions options;
+  options.frames = 600;
+  options.threads = max(1u, thread::hardware_concurrency());
+  options.pin_threads = true;
+  options.settle_speed = SLEEP_SPEED;
+  options.ensemble = false;
+  string output;
+
+  int c;
+  while ((c = getopt(argc, argv, "f:p:n:j:uev:o:")) != -1) {
+    switch (c) {
+      case 'f': {
+        options.scene = optarg;
+        break;
+      }
+      case 'p': {
+        SweepParameter parameter;
+        if (!parse_sweep_parameter(optarg, parameter)) {
+          fprintf(stderr, "Cannot read parameter values %s\n", optarg);
+          usageError(argv[0]);
+        }
+        for (const SweepParameter &p : options.parameters) {
+          if (p.name == parameter.name) {
+            fprintf(stderr, "%s is given more than once\n", p.name.c_str());
+            usageError(argv[0]);
+          }
+        }
+        options.parameters.push_back(parameter);
+        break;
+      }
+      case 'n': {
+        options.frames = max(1, atoi(optarg));
+        break;
+      }
+      case 'j': {
+        options.threads = max(1, atoi(optarg));
+        break;
+      }
+      case 'u': {
+        options.pin_threads = false;
+        break;
+      }
+      case 'e': {
+        options.ensemble = true;
+        break;
+      }
+      case 'v': {
+        options.settle_speed = max(0.0, atof(optarg));
+        break;
+      }
+      case 'o': {
+        output = optarg;
+        break;
+      }
+      default: {
+        usageError(argv[0]);
+        break;
+      }
+    }
+  }
+  if (options.scene.empty() || options.parameters.empty()) {
+    usageError(argv[0]);
+  }
+
+  options.out = stdout;
+  if (!output.empty()) {
+    options.out = fopen(output.c_str(), "w");
+    if (!options.out) {
+      fprintf(stderr, "Cannot write %s\n", output.c_str());
+      return -1;
+    }
+  }
+
+  int status = run_parameter_sweep(options);
+  if (options.out != stdout) fclose(options.out);
+  return status;
+}
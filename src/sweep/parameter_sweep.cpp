@@ -0,0 +1,494 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "../clothEnsemble.h"
+#include "../simulation.h"
+#include "parameter_sweep.h"
+
+// Same stepping as the viewer's defaults
+#define SWEEP_FRAMES_PER_SEC 90
+#define SWEEP_SIMULATION_STEPS 30
+
+// Springs shorter than this at rest, such as those between the particles
+// that meet at a balloon's poles, have no meaningful strain
+#define SWEEP_MIN_REST_LENGTH 1e-9
+
+namespace {
+
+enum SweptParameter { DAMPING, DENSITY, KS, THICKNESS, INFLATION, NUM_PARAMETERS };
+
+const char *PARAMETER_NAMES[NUM_PARAMETERS] = {"damping", "density", "ks", "thickness",
+                                               "inflation"};
+
+struct RunResult {
+  double values[NUM_PARAMETERS];
+  double volume;
+  double max_strain;
+  // Simulated time after which no particle moved faster than the settle
+  // speed, or -1 if the scene was still moving at the end
+  double settle_time;
+  double seconds;
+};
+
+// Runs not yet started, owned by one worker; others take from the back
+// when their own are done
+struct RunQueue {
+  mutex lock;
+  deque<size_t> runs;
+};
+
+int parameter_index(const string &name) {
+  for (int p = 0; p < NUM_PARAMETERS; p++) {
+    if (name == PARAMETER_NAMES[p]) return p;
+  }
+  return -1;
+}
+
+bool parse_number(const string &text, double &value) {
+  char *end;
+  value = strtod(text.c_str(), &end);
+  return !text.empty() && *end == '\0' && std::isfinite(value);
+}
+
+void get_values(const Simulation &simulation, double values[NUM_PARAMETERS]) {
+  values[DAMPING] = simulation.cp.damping;
+  values[DENSITY] = simulation.cp.density;
+  values[KS] = simulation.cp.ks;
+  values[THICKNESS] = simulation.cloths.empty() ? 0 : simulation.cloths[0]->thickness;
+  values[INFLATION] = simulation.cp.inflation;
+}
+
+void set_values(Simulation &simulation, const double values[NUM_PARAMETERS]) {
+  simulation.cp.damping = values[DAMPING];
+  simulation.cp.density = values[DENSITY];
+  simulation.cp.ks = values[KS];
+  simulation.cp.inflation = values[INFLATION];
+  for (Cloth *cloth : simulation.cloths) {
+    cloth->thickness = values[THICKNESS];
+  }
+}
+
+// Largest stretch or compression of any spring, relative to its rest length
+double max_strain(const Simulation &simulation) {
+  double strain = 0;
+  for (const Cloth *cloth : simulation.cloths) {
+    for (const Spring &s : cloth->springs) {
+      if (s.rest_length < SWEEP_MIN_REST_LENGTH) continue;
+      double length = (s.pm_a->position - s.pm_b->position).norm();
+      strain = max(strain, fabs(length - s.rest_length) / s.rest_length);
+    }
+  }
+  return strain;
+}
+
+// Volume enclosed by the balloons' meshes, by the divergence theorem
+double enclosed_volume(const Simulation &simulation) {
+  double volume = 0;
+  for (const Cloth *cloth : simulation.cloths) {
+    if (!cloth->clothMesh) continue;
+    double signed_volume = 0;
+    for (const Triangle *t : cloth->clothMesh->triangles) {
+      signed_volume += dot(t->pm1->position, cross(t->pm2->position, t->pm3->position));
+    }
+    volume += fabs(signed_volume) / 6;
+  }
+  return volume;
+}
+
+// Follows one run's strain and motion frame by frame
+class RunTracker {
+public:
+  RunTracker(const Simulation &simulation);
+
+  // Called after every frame, with the run's particles in the simulation
+  void update(const Simulation &simulation, double sim_time, double settle_speed);
+  void finish(const Simulation &simulation, RunResult &result) const;
+
+private:
+  vector<Vector3D> last_positions;
+  double strain;
+  double settle_time;
+  bool moving;
+};
+
+RunTracker::RunTracker(const Simulation &simulation) : settle_time(0), moving(false) {
+  for (const Cloth *cloth : simulation.cloths) {
+    for (const PointMass &pm : cloth->point_masses) last_positions.push_back(pm.position);
+  }
+  strain = max_strain(simulation);
+}
+
+void RunTracker::update(const Simulation &simulation, double sim_time, double settle_speed) {
+  double max_distance = 0;
+  size_t i = 0;
+  for (const Cloth *cloth : simulation.cloths) {
+    for (const PointMass &pm : cloth->point_masses) {
+      max_distance = max(max_distance, (pm.position - last_positions[i]).norm());
+      last_positions[i++] = pm.position;
+    }
+  }
+  moving = max_distance * SWEEP_FRAMES_PER_SEC > settle_speed;
+  if (moving) settle_time = sim_time;
+  strain = max(strain, max_strain(simulation));
+}
+
+void RunTracker::finish(const Simulation &simulation, RunResult &result) const {
+  result.volume = enclosed_volume(simulation);
+  result.max_strain = strain;
+  result.settle_time = moving ? -1 : settle_time;
+}
+
+#ifdef __linux__
+// CPUs listed like 0-3,8-11
+vector<int> parse_cpu_list(const string &text) {
+  vector<int> cpus;
+  stringstream ss(text);
+  string range;
+  while (getline(ss, range, ',')) {
+    int first, last;
+    int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+    if (n < 1) continue;
+    if (n == 1) last = first;
+    for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+// The CPUs this process may run on, ordered so that consecutive workers
+// alternate between NUMA nodes and the runs share every node's memory
+// bandwidth
+vector<int> numa_interleaved_cpus() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return vector<int>();
+
+  vector<vector<int>> nodes;
+  vector<bool> listed(CPU_SETSIZE, false);
+  for (int node = 0;; node++) {
+    ifstream in("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+    if (!in) break;
+    string text;
+    getline(in, text);
+    vector<int> cpus;
+    for (int cpu : parse_cpu_list(text)) {
+      if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed) && !listed[cpu]) {
+        cpus.push_back(cpu);
+        listed[cpu] = true;
+      }
+    }
+    if (!cpus.empty()) nodes.push_back(cpus);
+  }
+  // Without NUMA information, every CPU is on one node
+  vector<int> unlisted;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed) && !listed[cpu]) unlisted.push_back(cpu);
+  }
+  if (!unlisted.empty()) nodes.push_back(unlisted);
+
+  vector<int> order;
+  for (size_t i = 0;; i++) {
+    bool any = false;
+    for (const vector<int> &cpus : nodes) {
+      if (i < cpus.size()) {
+        order.push_back(cpus[i]);
+        any = true;
+      }
+    }
+    if (!any) break;
+  }
+  return order;
+}
+
+void pin_to_cpu(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+#else
+vector<int> numa_interleaved_cpus() { return vector<int>(); }
+void pin_to_cpu(int cpu) {}
+#endif
+
+class Sweep {
+public:
+  Sweep(const SweepOptions &options, const double base[NUM_PARAMETERS], bool ensemble);
+
+  void run(int num_threads);
+  void write_csv(FILE *out) const;
+
+private:
+  // Parameter values of a run; the last parameter varies fastest
+  void run_values(size_t run, double values[NUM_PARAMETERS]) const;
+  bool take(size_t worker, size_t &run);
+  void work(size_t worker, int cpu);
+  void report(size_t runs);
+  void simulate(Simulation &simulation, RunResult &result) const;
+  void simulate(Simulation &simulation, ClothEnsemble &members, const vector<size_t> &runs);
+
+  const SweepOptions &options;
+  bool ensemble;
+  double base[NUM_PARAMETERS];
+  size_t num_runs;
+  vector<RunResult> results;
+
+  vector<RunQueue> queues;
+  atomic<size_t> completed;
+  mutex progress_lock;
+};
+
+Sweep::Sweep(const SweepOptions &options, const double base[NUM_PARAMETERS], bool ensemble)
+    : options(options), ensemble(ensemble), num_runs(1), completed(0) {
+  copy(base, base + NUM_PARAMETERS, this->base);
+  for (const SweepParameter &p : options.parameters) {
+    num_runs *= p.values.size();
+  }
+  results.resize(num_runs);
+}
+
+void Sweep::run_values(size_t run, double values[NUM_PARAMETERS]) const {
+  copy(base, base + NUM_PARAMETERS, values);
+  for (size_t i = options.parameters.size(); i-- > 0;) {
+    const SweepParameter &p = options.parameters[i];
+    values[parameter_index(p.name)] = p.values[run % p.values.size()];
+    run /= p.values.size();
+  }
+}
+
+void Sweep::run(int num_threads) {
+  // A worker with fewer runs than lanes would leave lanes empty
+  size_t lanes = ensemble ? ENSEMBLE_LANES : 1;
+  size_t num_workers = max<size_t>(1, min<size_t>(num_threads, (num_runs + lanes - 1) / lanes));
+
+  // Each worker starts with a contiguous share of the runs
+  vector<RunQueue> shares(num_workers);
+  queues.swap(shares);
+  for (size_t w = 0; w < num_workers; w++) {
+    for (size_t run = w * num_runs / num_workers; run < (w + 1) * num_runs / num_workers; run++) {
+      queues[w].runs.push_back(run);
+    }
+  }
+
+  vector<int> cpus;
+  if (options.pin_threads) cpus = numa_interleaved_cpus();
+  vector<thread> workers;
+  for (size_t w = 0; w < num_workers; w++) {
+    int cpu = cpus.empty() ? -1 : cpus[w % cpus.size()];
+    workers.push_back(thread(&Sweep::work, this, w, cpu));
+  }
+  for (thread &worker : workers) {
+    worker.join();
+  }
+  fprintf(stderr, "\n");
+}
+
+bool Sweep::take(size_t worker, size_t &run) {
+  {
+    lock_guard<mutex> lock(queues[worker].lock);
+    if (!queues[worker].runs.empty()) {
+      run = queues[worker].runs.front();
+      queues[worker].runs.pop_front();
+      return true;
+    }
+  }
+  // Steal from the far end of another worker's share, which it would reach
+  // last
+  for (size_t i = 1; i < queues.size(); i++) {
+    RunQueue &victim = queues[(worker + i) % queues.size()];
+    lock_guard<mutex> lock(victim.lock);
+    if (!victim.runs.empty()) {
+      run = victim.runs.back();
+      victim.runs.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void Sweep::work(size_t worker, int cpu) {
+  if (cpu >= 0) pin_to_cpu(cpu);
+#ifdef _OPENMP
+  // The runs are parallel, not the loops inside them
+  omp_set_num_threads(1);
+#endif
+
+  // Loaded by the worker after pinning, so that its particles and springs
+  // are allocated on the worker's own node. The scene was already read once
+  // without errors, so it loads.
+  Simulation simulation;
+  simulation.load(options.scene);
+
+  if (ensemble) {
+    ClothEnsemble members(*simulation.cloths[0]);
+    vector<size_t> runs;
+    size_t run;
+    do {
+      runs.clear();
+      while (runs.size() < ENSEMBLE_LANES && take(worker, run)) runs.push_back(run);
+      if (!runs.empty()) simulate(simulation, members, runs);
+    } while (runs.size() == ENSEMBLE_LANES);
+    return;
+  }
+
+  // Only the particles go back between runs; the grid, springs and mesh
+  // are built once per worker
+  bool fresh = true;
+  size_t run;
+  while (take(worker, run)) {
+    if (!fresh) simulation.reset();
+    fresh = false;
+
+    RunResult &result = results[run];
+    run_values(run, result.values);
+    set_values(simulation, result.values);
+    simulate(simulation, result);
+    report(1);
+  }
+}
+
+void Sweep::report(size_t runs) {
+  size_t done = completed += runs;
+  lock_guard<mutex> lock(progress_lock);
+  fprintf(stderr, "\r%zu/%zu runs", done, num_runs);
+}
+
+void Sweep::simulate(Simulation &simulation, RunResult &result) const {
+  auto start = chrono::steady_clock::now();
+
+  RunTracker tracker(simulation);
+  for (int f = 0; f < options.frames; f++) {
+    simulation.step(SWEEP_FRAMES_PER_SEC, SWEEP_SIMULATION_STEPS, Vector3D(0, -9.8, 0));
+    tracker.update(simulation, simulation.sim_time, options.settle_speed);
+  }
+
+  tracker.finish(simulation, result);
+  result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void Sweep::simulate(Simulation &simulation, ClothEnsemble &members, const vector<size_t> &runs) {
+  auto start = chrono::steady_clock::now();
+
+  vector<ClothParameters> parameters;
+  for (size_t run : runs) {
+    run_values(run, results[run].values);
+    set_values(simulation, results[run].values);
+    parameters.push_back(simulation.cp);
+  }
+  // The simulation only holds the colliders and, in turn, each member's
+  // particles while its metrics are taken
+  simulation.reset();
+  members.reset(parameters);
+  vector<RunTracker> trackers(runs.size(), RunTracker(simulation));
+  vector<PointMass> &point_masses = simulation.cloths[0]->point_masses;
+
+  for (int f = 0; f < options.frames; f++) {
+    members.step(SWEEP_FRAMES_PER_SEC, SWEEP_SIMULATION_STEPS, Vector3D(0, -9.8, 0),
+                 simulation.objects);
+    for (size_t m = 0; m < runs.size(); m++) {
+      members.get_member(m, point_masses);
+      trackers[m].update(simulation, members.sim_time, options.settle_speed);
+    }
+  }
+
+  // The runs took their time together, so each is charged an even share
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  for (size_t m = 0; m < runs.size(); m++) {
+    members.get_member(m, point_masses);
+    trackers[m].finish(simulation, results[runs[m]]);
+    results[runs[m]].seconds = seconds / runs.size();
+  }
+  report(runs.size());
+}
+
+void Sweep::write_csv(FILE *out) const {
+  fprintf(out, "run");
+  for (int p = 0; p < NUM_PARAMETERS; p++) {
+    fprintf(out, ",%s", PARAMETER_NAMES[p]);
+  }
+  fprintf(out, ",final_volume,max_strain,settle_time,seconds\n");
+  for (size_t run = 0; run < num_runs; run++) {
+    const RunResult &r = results[run];
+    fprintf(out, "%zu", run + 1);
+    for (int p = 0; p < NUM_PARAMETERS; p++) {
+      fprintf(out, ",%.6g", r.values[p]);
+    }
+    fprintf(out, ",%.6g,%.6g,%.4f,%.3f\n", r.volume, r.max_strain, r.settle_time, r.seconds);
+  }
+}
+
+} // namespace
+
+bool parse_sweep_parameter(const string &spec, SweepParameter &parameter) {
+  size_t equals = spec.find('=');
+  if (equals == string::npos) return false;
+  parameter.name = spec.substr(0, equals);
+  parameter.values.clear();
+  if (parameter_index(parameter.name) < 0) return false;
+
+  string values = spec.substr(equals + 1);
+  size_t colon = values.find(':');
+  if (colon != string::npos) {
+    size_t second = values.find(':', colon + 1);
+    if (second == string::npos) return false;
+    double first, last, count;
+    if (!parse_number(values.substr(0, colon), first) ||
+        !parse_number(values.substr(colon + 1, second - colon - 1), last) ||
+        !parse_number(values.substr(second + 1), count) || count < 1 || count != floor(count)) {
+      return false;
+    }
+    for (int i = 0; i < count; i++) {
+      parameter.values.push_back(count == 1 ? first : first + (last - first) * i / (count - 1));
+    }
+    return true;
+  }
+
+  stringstream ss(values);
+  string item;
+  while (getline(ss, item, ',')) {
+    double value;
+    if (!parse_number(item, value)) return false;
+    parameter.values.push_back(value);
+  }
+  return !parameter.values.empty();
+}
+
+int run_parameter_sweep(const SweepOptions &options) {
+  // Read once up front, so that scene errors are reported once and the
+  // workers' own loads cannot fail
+  double base[NUM_PARAMETERS];
+  bool ensemble = options.ensemble;
+  {
+    Simulation simulation;
+    if (!simulation.load(options.scene)) {
+      cerr << "Cannot read scene " << options.scene << endl;
+      return -1;
+    }
+    get_values(simulation, base);
+    if (options.ensemble && !ClothEnsemble::supports(simulation.cloths, simulation.wind)) {
+      cerr << "Scene " << options.scene << " cannot run as an ensemble; running one run at a time"
+           << endl;
+      ensemble = false;
+    }
+  }
+
+  Sweep sweep(options, base, ensemble);
+  sweep.run(options.threads);
+  sweep.write_csv(options.out);
+  return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef PARAMETER_SWEEP_H
+#define PARAMETER_SWEEP_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Values to try for one material parameter: damping, density, ks,
+// thickness or inflation
+struct SweepParameter {
+  string name;
+  vector<double> values;
+};
+
+struct SweepOptions {
+  string scene;
+  // Every combination of the values is run
+  vector<SweepParameter> parameters;
+  int frames;
+  int threads;
+  // Pin each worker to a core, spread across NUMA nodes
+  bool pin_threads;
+  // Largest particle speed (m/s) at which a scene counts as settled
+  double settle_speed;
+  // Each worker steps several runs at once as a ClothEnsemble, for scenes
+  // it supports
+  bool ensemble;
+  FILE *out;
+};
+
+// Reads name=first:last:count, count values evenly spaced from first to
+// last, or name=a,b,c. False if the name is unknown or a value is malformed.
+bool parse_sweep_parameter(const string &spec, SweepParameter &parameter);
+
+// Runs the scene once per combination of parameter values, with runs spread
+// over a pool of worker threads, and writes each run's parameters and
+// results as a CSV row, in run order. Returns -1 if the scene cannot be
+// read, otherwise 0.
+int run_parameter_sweep(const SweepOptions &options);
+
+#endif /* PARAMETER_SWEEP_H */
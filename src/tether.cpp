@@ -0,0 +1,131 @@
+#include <cmath>
+
+#include "tether.h"
+
+using namespace std;
+
+void Tether::build(const Vector3D &attachment) {
+  particles.clear();
+  particles.reserve(num_segments + 1);
+
+  for (int i = 0; i <= num_segments; i++) {
+    Vector3D pos;
+    if (anchored) {
+      pos = attachment + (anchor - attachment) * ((double)i / num_segments);
+    } else {
+      pos = attachment - Vector3D(0, segment_length() * i, 0);
+    }
+    particles.emplace_back(pos, false);
+  }
+
+  // The ends are moved by the balloon and the anchor, never by integration
+  particles.front().pinned = true;
+  particles.back().pinned = anchored;
+}
+
+void Tether::reset() {
+  for (PointMass &pm : particles) {
+    pm.position = pm.start_position;
+    pm.last_position = pm.start_position;
+  }
+}
+
+void Tether::solve_constraints() {
+  double rest = segment_length();
+  int n = particles.size();
+
+  for (int it = 0; it < iterations; it++) {
+    // Segments keep their length
+    for (int i = 0; i + 1 < n; i++) {
+      PointMass &a = particles[i], &b = particles[i + 1];
+      double wa = a.pinned ? 0 : 1, wb = b.pinned ? 0 : 1;
+      if (wa + wb == 0) continue;
+
+      Vector3D d = b.position - a.position;
+      double dist = d.norm();
+      if (dist == 0) continue;
+      Vector3D correction = d * ((dist - rest) / dist / (wa + wb));
+      a.position += correction * wa;
+      b.position -= correction * wb;
+    }
+
+    // Particles two apart resist folding toward each other
+    if (bending <= 0) continue;
+    for (int i = 0; i + 2 < n; i++) {
+      PointMass &a = particles[i], &b = particles[i + 2];
+      double wa = a.pinned ? 0 : 1, wb = b.pinned ? 0 : 1;
+      if (wa + wb == 0) continue;
+
+      Vector3D d = b.position - a.position;
+      double dist = d.norm();
+      if (dist == 0 || dist >= 2 * rest) continue;
+      Vector3D correction = d * (bending * (dist - 2 * rest) / dist / (wa + wb));
+      a.position += correction * wa;
+      b.position -= correction * wb;
+    }
+  }
+}
+
+void Tether::collide(vector<CollisionObject *> *collision_objects, Broadphase &broadphase) {
+  // Everything past the attachment, as one block through the cloth's broadphase
+  PointMassBlock block;
+  block.begin = &particles[1];
+  block.count = particles.size() - 1;
+  block.min = block.max = block.begin[0].position;
+  for (size_t i = 0; i < block.count; i++) {
+    block.extend(block.begin[i].position);
+    block.extend(block.begin[i].last_position);
+  }
+  broadphase.for_each_near(block, [&](int idx) { (*collision_objects)[idx]->collide(block); });
+  if (anchored) particles.back().position = anchor;
+}
+
+void Tether::simulate(PointMass &attachment, double attachment_mass, bool attachment_fixed,
+                      double delta_t, const Vector3D &acceleration, double damping,
+                      vector<CollisionObject *> *collision_objects, Broadphase &broadphase) {
+  if (particles.size() < 2) return;
+
+  double h = delta_t / substeps;
+  double keep = pow(1 - damping / 100.0, 1.0 / substeps);
+  Vector3D from = attachment.last_position, to = attachment.position;
+  PointMass &head = particles.front();
+
+  for (int s = 1; s <= substeps; s++) {
+    head.last_position = head.position;
+    head.position = from + (to - from) * ((double)s / substeps);
+
+    for (PointMass &pm : particles) {
+      if (pm.pinned) continue;
+      Vector3D new_position = pm.position + keep * (pm.position - pm.last_position) + acceleration * h * h;
+      pm.last_position = pm.position;
+      pm.position = new_position;
+    }
+    solve_constraints();
+    if (!collision_objects->empty()) collide(collision_objects, broadphase);
+  }
+
+  // The first segment's stretch is shared between the balloon vertex and
+  // the string by inverse mass
+  double particle_mass = density * segment_length();
+  double wa = attachment_fixed ? 0 : 1 / attachment_mass;
+  double wb = particles[1].pinned ? 0 : 1 / particle_mass;
+  Vector3D d = particles[1].position - attachment.position;
+  double dist = d.norm();
+  double rest = segment_length();
+  if (dist > rest && wa + wb > 0) {
+    Vector3D correction = d * ((dist - rest) / dist / (wa + wb));
+    attachment.position += correction * wa;
+    particles[1].position -= correction * wb;
+  }
+
+  // A tied string never lets the balloon drift further than its length
+  if (anchored && !attachment_fixed) {
+    Vector3D r = attachment.position - anchor;
+    double reach = r.norm();
+    if (reach > length) {
+      attachment.position -= r * ((reach - length) / reach);
+    }
+  }
+
+  head.position = attachment.position;
+}
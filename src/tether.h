@@ -0,0 +1,71 @@
+#ifndef TETHER_H
+#define TETHER_H
+
+#include <vector>
+
+#include "CGL/CGL.h"
+#include "collision/broadphase.h"
+#include "collision/collisionObject.h"
+#include "pointMass.h"
+
+using namespace CGL;
+using namespace std;
+
+/**
+ * A balloon string: a chain of particles hanging from one balloon vertex,
+ * held together by distance constraints and stiffened by constraints between
+ * every other particle.
+ *
+ * The first particle rides on the balloon vertex. Within a cloth step the
+ * string takes its own, shorter substeps while that vertex is swept along its
+ * motion for the step, and afterwards the first segment's tension pulls the
+ * vertex back, weighted by the two masses. A string tied to the ground also
+ * keeps the balloon within its length of the anchor.
+ */
+struct Tether {
+  Tether(int vertex, double length, int num_segments, double density)
+      : vertex(vertex), length(length), num_segments(num_segments), density(density),
+        bending(0.1), substeps(2), iterations(4), anchored(false) {}
+
+  // Lays the string out from the balloon vertex, straight down or toward
+  // its anchor
+  void build(const Vector3D &attachment);
+  void reset();
+
+  // Advances the string over one cloth step of length delta_t, during which
+  // the attached vertex moved from its last position to its current one,
+  // then couples the string back into that vertex unless it is held fixed
+  // (pinned, or asleep)
+  void simulate(PointMass &attachment, double attachment_mass, bool attachment_fixed,
+                double delta_t, const Vector3D &acceleration, double damping,
+                vector<CollisionObject *> *collision_objects, Broadphase &broadphase);
+
+  double segment_length() const { return length / num_segments; }
+
+  // Index of the balloon particle the string hangs from
+  int vertex;
+
+  double length;
+  int num_segments;
+  // Mass per unit length (kg/m)
+  double density;
+  // Fraction of the bending violation corrected per iteration, in [0, 1]
+  double bending;
+
+  // Substeps per cloth step, and constraint sweeps per substep
+  int substeps;
+  int iterations;
+
+  // Far end tied to a fixed point, or left to dangle
+  bool anchored;
+  Vector3D anchor;
+
+  // particles[0] is the attachment point
+  vector<PointMass> particles;
+
+private:
+  void solve_constraints();
+  void collide(vector<CollisionObject *> *collision_objects, Broadphase &broadphase);
+};
+
+#endif /* TETHER_H */